@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "discord/mix.h"
+#include "discord/rtp.h"
+#include "discord/voice_receive.h"
+
+namespace
+{
+    using namespace discord;
+
+    constexpr size_t frame_floats = rtp::frame_samples * 2;
+
+    // What the encoder thread does to each 20 ms frame before Opus sees it: the first source
+    // scaled into the mix, the rest accumulated, then clamped. "realtime" is how many seconds
+    // of audio that is per second of CPU
+    void audio_mix(benchmark::State &state)
+    {
+        size_t                          count = state.range(0);
+        std::vector<std::vector<float>> sources(count, std::vector<float>(frame_floats));
+        for (size_t s = 0; s < count; s++)
+            for (size_t i = 0; i < frame_floats; i++)
+                sources[s][i] = 0.5f * std::sin(0.01f * (i + 1) * (s + 1));
+
+        std::vector<float> mixed(frame_floats);
+        for (auto _ : state)
+        {
+            mix::scale(mixed.data(), sources[0].data(), 0.8f, frame_floats);
+            for (size_t s = 1; s < count; s++)
+                mix::accumulate(mixed.data(), sources[s].data(), 0.5f, frame_floats);
+            mix::saturate(mixed.data(), frame_floats);
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(state.iterations() * rtp::frame_samples * count);
+        state.counters["realtime"] = benchmark::Counter(
+          state.iterations() * rtp::frame_ms / 1000.0,
+          benchmark::Counter::kIsRate);
+    }
+    BENCHMARK(audio_mix)->Arg(1)->Arg(2)->Arg(4)->Arg(8);
+
+    // A speaker's packets through the JitterBuffer, arriving every 20 ms as a bad network
+    // delivers them: 'loss' percent never arrive, 'reorder' percent swap with the next one,
+    // and one in a hundred each comes twice, comes 200 ms late or skips two seconds ahead.
+    // The counters are per packet sent, so "concealed" should come out near the loss
+    void voice_jitter(benchmark::State &state)
+    {
+        constexpr size_t count = 4096;
+        u32              loss = state.range(0), reorder = state.range(1);
+
+        struct Arrival
+        {
+            u16 sequence;
+            u64 at_us;
+        };
+        std::mt19937                       random(42);
+        std::uniform_int_distribution<u32> percent(0, 99);
+        std::vector<Arrival>               arrivals;
+        u16                                sequence = 0;
+        for (size_t i = 0; i < count; i++, sequence++)
+        {
+            u64 at  = i * rtp::frame_ms * 1000;
+            u32 odd = percent(random);
+            if (odd == 0)
+                sequence += 100;    // Past capacity
+            else if (odd == 1)
+                arrivals.push_back({ sequence, at });
+            else if (odd == 2)
+                at += 200'000;
+            if (percent(random) >= loss) arrivals.push_back({ sequence, at });
+            if (arrivals.size() > 1 && percent(random) < reorder)
+                std::swap(arrivals.back().sequence, arrivals[arrivals.size() - 2].sequence);
+        }
+        std::stable_sort(
+          arrivals.begin(),
+          arrivals.end(),
+          [](const Arrival &a, const Arrival &b) { return a.at_us < b.at_us; });
+
+        u8                   payload[64] = {}, out[rtp::max_frame_size];
+        JitterBuffer::Popped popped;
+        u64                  played = 0, concealed = 0, fec = 0;
+        u64                  late = 0, duplicate = 0, resync = 0;
+        for (auto _ : state)
+        {
+            JitterBuffer buffer;
+            for (auto &arrival : arrivals)
+            {
+                switch (buffer.push(arrival.sequence, payload, sizeof(payload), arrival.at_us))
+                {
+                case JitterBuffer::Push::late: late++; break;
+                case JitterBuffer::Push::duplicate: duplicate++; break;
+                case JitterBuffer::Push::resync: resync++; break;
+                default: break;
+                }
+                while (buffer.pop(popped, out, arrival.at_us))
+                {
+                    played++;
+                    concealed += popped.lost;
+                    fec += popped.lost && popped.length > 0;
+                }
+            }
+            benchmark::DoNotOptimize(out);
+        }
+
+        double sent = (double) state.iterations() * count;
+        state.SetItemsProcessed(state.iterations() * arrivals.size());
+        state.counters["played"]    = played / sent;
+        state.counters["concealed"] = concealed / sent;
+        state.counters["fec"]       = fec / sent;
+        state.counters["late"]      = late / sent;
+        state.counters["duplicate"] = duplicate / sent;
+        state.counters["resync"]    = resync / sent;
+    }
+    BENCHMARK(voice_jitter)->Args({ 0, 0 })->Args({ 5, 5 })->Args({ 20, 20 });
+}    // namespace
@@ -0,0 +1,68 @@
+#include <iostream>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+
+#include "fixtures.h"
+#include "GLSbot.h"
+#include "discord/scan.h"
+
+namespace
+{
+    // A session GLSbot::replay() can handshake with: Hello and READY first, unless the
+    // traffic is a capture that starts with its own
+    std::vector<std::string> session(const std::vector<std::string> &traffic)
+    {
+        std::vector<std::string> payloads;
+        if (discord::scan::envelope(traffic.front()).op != 10)
+        {
+            payloads.push_back(fixtures::hello());
+            payloads.push_back(fixtures::ready(2));
+        }
+        payloads.insert(payloads.end(), traffic.begin(), traffic.end());
+        return payloads;
+    }
+
+    // The whole consumer: Gateway handing out events and GLSbot::run() handling them, nothing
+    // sent. Commands print, so std::cout is muted while measuring
+    void replay(benchmark::State &state, const std::vector<std::string> &payloads)
+    {
+        static int recordings = 0;
+        auto       path =
+          fixtures::write_recording(payloads, fmt::format("glsbot-bench-{}.rec", recordings++));
+
+        auto *out = std::cout.rdbuf(nullptr);
+        for (auto _ : state)
+        {
+            GLSbot bot;
+            bot.replay(path, false, "");
+        }
+        std::cout.rdbuf(out);
+        std::cout.clear();
+
+        state.SetItemsProcessed(state.iterations() * payloads.size());
+    }
+
+    void glsbot_replay(benchmark::State &state)
+    {
+        replay(state, session(fixtures::traffic()));
+    }
+    BENCHMARK(glsbot_replay)->Unit(benchmark::kMillisecond);
+
+    // Every message a command, so the time goes into splitting and routing them
+    void glsbot_commands(benchmark::State &state)
+    {
+        static const char *commands[] = { "!ping", "!cache", "!report the bot is down",
+                                          "!shutdown", "!unknown command", "!report" };
+
+        std::vector<std::string> traffic;
+        for (u64 i = 0; i < 5000; i++)
+            traffic.push_back(fixtures::dispatch(
+              "MESSAGE_CREATE",
+              i + 2,
+              fixtures::message_create(900000000000000000 + i, commands[i % 6])));
+        replay(state, session(traffic));
+    }
+    BENCHMARK(glsbot_commands)->Unit(benchmark::kMillisecond);
+}    // namespace
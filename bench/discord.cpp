@@ -0,0 +1,154 @@
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "fixtures.h"
+#include "discord/cache.h"
+#include "discord/json.h"
+#include "discord/prefixes.h"
+#include "discord/scan.h"
+#include "discord/views.h"
+#include "util/arena.h"
+
+namespace
+{
+    using namespace discord;
+
+    size_t total_size(const std::vector<std::string> &payloads)
+    {
+        size_t size = 0;
+        for (auto &payload : payloads) size += payload.size();
+        return size;
+    }
+
+    // What get_incoming() reads off every payload
+    void discord_envelope(benchmark::State &state)
+    {
+        auto &payloads = fixtures::traffic();
+        for (auto _ : state)
+            for (auto &payload : payloads)
+            {
+                auto envelope = scan::envelope(payload);
+                benchmark::DoNotOptimize(envelope);
+            }
+        state.SetItemsProcessed(state.iterations() * payloads.size());
+        state.SetBytesProcessed(state.iterations() * total_size(payloads));
+    }
+    BENCHMARK(discord_envelope);
+
+    // event::data(): a DOM for 'd', out of the per-event Arena
+    void discord_parse(benchmark::State &state)
+    {
+        auto &payloads = fixtures::traffic();
+        Arena arena;
+        for (auto _ : state)
+            for (auto &payload : payloads)
+            {
+                Arena::Scope scope(arena);
+                auto         d      = scan::envelope(payload).d;
+                auto         parsed = json::parse(d.empty() ? "null" : d);
+                benchmark::DoNotOptimize(parsed);
+            }
+        state.SetItemsProcessed(state.iterations() * payloads.size());
+        state.SetBytesProcessed(state.iterations() * total_size(payloads));
+    }
+    BENCHMARK(discord_parse);
+
+    // Everything GLSbot::run() does with an event before looking for commands: envelope, and a
+    // DOM and cache update for the events the cache takes, all within one Arena scope
+    void discord_dispatch(benchmark::State &state)
+    {
+        auto &payloads = fixtures::traffic();
+        Arena arena;
+        Cache cache;
+        for (auto _ : state)
+            for (auto &payload : payloads)
+            {
+                Arena::Scope scope(arena);
+                auto         envelope = scan::envelope(payload);
+                if (envelope.op != 0) continue;
+
+                std::string name(envelope.t);
+                if (!Cache::updates_on(name)) continue;
+                auto data = json::parse(envelope.d.empty() ? "null" : envelope.d);
+                cache.update(name, data);
+            }
+        state.SetItemsProcessed(state.iterations() * payloads.size());
+    }
+    BENCHMARK(discord_dispatch);
+
+    // What a command handler reads off a MESSAGE_CREATE, through a DOM and through a view
+    void discord_message_fields_dom(benchmark::State &state)
+    {
+        auto  message = fixtures::message_create(1, "!ping");
+        Arena arena;
+        for (auto _ : state)
+        {
+            Arena::Scope scope(arena);
+            auto         data = json::parse(message);
+            benchmark::DoNotOptimize(data["content"].get<std::string_view>());
+            benchmark::DoNotOptimize(data["channel_id"].get<std::string_view>());
+            benchmark::DoNotOptimize(data["author"]["id"].get<std::string_view>());
+        }
+        state.SetBytesProcessed(state.iterations() * message.size());
+    }
+    BENCHMARK(discord_message_fields_dom);
+
+    void discord_message_fields_view(benchmark::State &state)
+    {
+        auto message = fixtures::message_create(1, "!ping");
+        for (auto _ : state)
+        {
+            MessageCreate view(message);
+            benchmark::DoNotOptimize(view.content());
+            benchmark::DoNotOptimize(view.channel_id());
+            benchmark::DoNotOptimize(view.author().id());
+        }
+        state.SetBytesProcessed(state.iterations() * message.size());
+    }
+    BENCHMARK(discord_message_fields_view);
+
+    // The gateway's filter on MESSAGE_CREATE, for a message that isn't a command
+    void discord_prefix_reject(benchmark::State &state)
+    {
+        auto            message = fixtures::message_create(1, "just talking");
+        CommandPrefixes prefixes;
+        prefixes.set_guild(1, "?");
+        for (auto _ : state) benchmark::DoNotOptimize(prefixes.match(message));
+        state.SetBytesProcessed(state.iterations() * message.size());
+    }
+    BENCHMARK(discord_prefix_reject);
+
+    // Cache writes for a GUILD_CREATE into an empty cache, by member count
+    void discord_cache_guild_create(benchmark::State &state)
+    {
+        Arena        arena;
+        Arena::Scope scope(arena);
+        auto         data = json::parse(fixtures::guild_create(0, 50, state.range(0)));
+        for (auto _ : state)
+        {
+            state.PauseTiming();
+            {
+                Cache cache;
+                state.ResumeTiming();
+                cache.update("GUILD_CREATE", data);
+                state.PauseTiming();
+            }
+            state.ResumeTiming();
+        }
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+    }
+    BENCHMARK(discord_cache_guild_create)->Arg(100)->Arg(1000);
+
+    // The streaming path for member chunks, which never builds a DOM
+    void discord_members_chunk(benchmark::State &state)
+    {
+        auto  chunk = fixtures::members_chunk(0, state.range(0));
+        Cache cache;
+        for (auto _ : state)
+            cache.stream_members_chunk(chunk, [](const Cache::MemberView &) {});
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+        state.SetBytesProcessed(state.iterations() * chunk.size());
+    }
+    BENCHMARK(discord_members_chunk)->Arg(100)->Arg(1000);
+}    // namespace
@@ -0,0 +1,297 @@
+// End to end: gateway frames in, handlers done, over a real loopback connection.
+//
+// A thread in here plays Discord. It answers the upgrade and the Identify with Hello and READY,
+// then streams the benchmark traffic (see fixtures.h) as fast as the socket takes it, or at
+// --rate. On the other end is a dry-run GLSbot, so every frame goes through the WebSocket
+// reader, the Gateway and GLSbot::run() like it would in production, minus the REST calls.
+//
+//   glsbot-bench-e2e [--events <count>] [--rate <events/s>] [--tls <cert.pem> <key.pem>]
+//
+// Reports sustained events/s, percentiles of glsbot_event_latency_microseconds (a frame
+// being read to its handler returning) and the bot's CPU time per event, which leaves out
+// the server thread's.
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <ctime>
+#endif
+
+#include "fixtures.h"
+#include "GLSbot.h"
+#include "discord/scan.h"
+#include "util/metrics.h"
+#include "mock/server.h"
+
+namespace
+{
+    struct Options
+    {
+        u64         events      = 200000;
+        u64         rate        = 0;    // Events/s, 0 = unthrottled
+        std::string certificate = "";
+        std::string key         = "";
+    };
+
+    struct Result
+    {
+        bool ok         = false;
+        u64  events     = 0;
+        u64  wall_us    = 0;
+        u64  bot_cpu_us = 0;
+        u64  p50 = 0, p99 = 0, p999 = 0;    // Microseconds
+    };
+
+    struct Frame
+    {
+        std::string wire;
+        bool        dispatch;    // Or a HeartbeatACK, which doesn't count as an event
+    };
+
+#if defined(_WIN32)
+    u64 cpu_us(HANDLE thread, bool process)
+    {
+        FILETIME creation, exit, kernel, user;
+        if (process)
+            GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+        else
+            GetThreadTimes(thread, &creation, &exit, &kernel, &user);
+        auto us = [](FILETIME time)
+        { return (((u64) time.dwHighDateTime << 32) | time.dwLowDateTime) / 10; };
+        return us(kernel) + us(user);
+    }
+    u64 process_cpu_us() { return cpu_us(nullptr, true); }
+    u64 thread_cpu_us() { return cpu_us(GetCurrentThread(), false); }
+#else
+    u64 cpu_us(clockid_t clock)
+    {
+        timespec time;
+        clock_gettime(clock, &time);
+        return (u64) time.tv_sec * 1000000 + time.tv_nsec / 1000;
+    }
+    u64 process_cpu_us() { return cpu_us(CLOCK_PROCESS_CPUTIME_ID); }
+    u64 thread_cpu_us() { return cpu_us(CLOCK_THREAD_CPUTIME_ID); }
+#endif
+
+    // The traffic as wire frames, with whatever a capture has besides dispatches left out as
+    // the handshake already happened. Sequence numbers are left alone; nothing checks them
+    std::vector<Frame> encode_traffic()
+    {
+        std::vector<Frame> frames;
+        for (auto &payload : fixtures::traffic())
+        {
+            auto envelope = discord::scan::envelope(payload);
+            bool dispatch = envelope.op == 0 && envelope.t != "READY" && envelope.t != "RESUMED";
+            if (!dispatch && envelope.op != 11) continue;
+
+            frames.push_back({ "", dispatch });
+            mock::Connection::encode(frames.back().wire, WebSocket::Opcode::text_frame, payload);
+        }
+        return frames;
+    }
+
+    // Events the bot is done with: handled, or dropped unparsed by the gateway for being
+    // unsubscribed, or messages that aren't commands
+    u64 consumed(metrics::Histogram &handled)
+    {
+        static auto &filtered = metrics::registry().counter("gateway_events_filtered_total");
+        static auto &rejected = metrics::registry().counter("gateway_events_rejected_total");
+        return handled.count() + filtered.value() + rejected.value();
+    }
+
+    bool wait_handled(metrics::Histogram &handled, u64 count, u64 timeout_ms)
+    {
+        // Only counts as stuck when nothing at all gets handled for that long
+        u64 last = consumed(handled), deadline = metrics::now_us() + timeout_ms * 1000;
+        while (consumed(handled) < count)
+        {
+            if (consumed(handled) != last)
+            {
+                last     = consumed(handled);
+                deadline = metrics::now_us() + timeout_ms * 1000;
+            }
+            if (metrics::now_us() > deadline) return false;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        return true;
+    }
+
+    void serve(const ServerSocket &listener, const Options &options, Result &result)
+    {
+        constexpr size_t batch_bytes = 64 * 1024;
+
+        static auto &handled = metrics::registry().histogram("glsbot_event_latency_microseconds");
+
+        auto frames = encode_traffic();
+        if (std::none_of(frames.begin(), frames.end(), [](auto &frame) { return frame.dispatch; }))
+        {
+            std::cerr << "No dispatches in the traffic\n";
+            return;
+        }
+
+        mock::Request request;
+        auto          socket = listener.accept();
+        if (!socket.is_valid() || !mock::read_request(socket, request)) return;
+        mock::Connection ws(std::move(socket));
+        if (!ws.accept(request)) return;
+
+        // Identify or Resume, either way the bot gets a fresh session
+        ws.send_text(fixtures::hello());
+        WebSocket::Opcode opcode;
+        std::string       payload;
+        while (true)
+        {
+            auto read = ws.read(opcode, payload, 10000);
+            if (read != mock::Connection::Read::message) return;
+            if (opcode != WebSocket::Opcode::text_frame) continue;
+            auto op = discord::scan::envelope(payload).op;
+            if (op == 2 || op == 6) break;
+        }
+        ws.send_text(fixtures::ready(2));
+        // Not timing the handshake
+        if (!wait_handled(handled, 1, 10000)) return;
+
+        u64 start_count   = consumed(handled);
+        u64 start_us      = metrics::now_us();
+        u64 start_process = process_cpu_us();
+        u64 start_thread  = thread_cpu_us();
+
+        std::string batch;
+        size_t      next = 0;
+        u64         sent = 0;
+        while (sent < options.events && ws.is_open())
+        {
+            u64 due = options.events;
+            if (options.rate > 0)
+                due = std::min(due, (metrics::now_us() - start_us) * options.rate / 1000000 + 1);
+            if (due <= sent)
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                continue;
+            }
+
+            batch.clear();
+            while (sent < due && batch.size() < batch_bytes)
+            {
+                auto &frame = frames[next];
+                batch += frame.wire;
+                sent += frame.dispatch;
+                next = (next + 1) % frames.size();
+            }
+            if (!ws.send(batch)) return;
+        }
+        if (!wait_handled(handled, start_count + sent, 10000))
+        {
+            std::cerr << "The bot stopped handling events at "
+                      << consumed(handled) - start_count << " of " << sent << "\n";
+            return;
+        }
+
+        result.events     = sent;
+        result.wall_us    = metrics::now_us() - start_us;
+        result.bot_cpu_us = (process_cpu_us() - start_process) - (thread_cpu_us() - start_thread);
+        result.p50        = handled.quantile(0.5);
+        result.p99        = handled.quantile(0.99);
+        result.p999       = handled.quantile(0.999);
+        result.ok         = true;
+
+        // A close handshake, so the connection isn't reset under the bot while it hangs up.
+        // read() reports closed once the bot's close frame arrives
+        std::string close;
+        mock::Connection::encode(close, WebSocket::Opcode::connection_close, "\x03\xE8");
+        ws.send(close);
+        while (ws.read(opcode, payload, 10000) == mock::Connection::Read::message) { }
+    }
+}    // namespace
+
+int main(int argc, char **argv)
+{
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--events" && i + 1 < argc)
+            options.events = std::stoull(argv[++i]);
+        else if (arg == "--rate" && i + 1 < argc)
+            options.rate = std::stoull(argv[++i]);
+        else if (arg == "--tls" && i + 2 < argc)
+        {
+            options.certificate = argv[++i];
+            options.key         = argv[++i];
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--events <count>] [--rate <events/s>] [--tls <cert> <key>]\n";
+            return -1;
+        }
+    }
+    bool tls = !options.certificate.empty();
+
+    auto listener = ServerSocket::listen("127.0.0.1", "0");
+    if (!listener.is_valid()) return -1;
+    if (tls && !listener.use_certificate(options.certificate, options.key)) return -1;
+
+    // The Gateway keeps its session in the working directory and would try to resume it
+    auto directory = std::filesystem::temp_directory_path() / "glsbot-bench-e2e";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    std::filesystem::current_path(directory);
+
+    Result      result;
+    std::thread server(serve, std::cref(listener), std::cref(options), std::ref(result));
+
+    // Handlers print, so std::cout is muted until the report
+    auto *out = std::cout.rdbuf(nullptr);
+    {
+        GLSbot bot;
+        bot.set_dry_run(true);
+        bot.set_gateway_url(fmt::format("{}://127.0.0.1:{}", tls ? "wss" : "ws", listener.port()));
+        bot.start("bench", "");
+    }
+    std::cout.rdbuf(out);
+    std::cout.clear();
+    server.join();
+
+    if (!result.ok)
+    {
+        std::cerr << "Benchmark did not complete\n";
+        return -1;
+    }
+
+    double seconds = result.wall_us / 1e6;
+    std::cout << fmt::format(
+      "{} events over {}, {}\n",
+      result.events,
+      tls ? "TLS" : "plain TCP",
+      options.rate > 0 ? fmt::format("offered at {} events/s", options.rate) : "unthrottled");
+    std::cout << fmt::format(
+      "  throughput  {:.0f} events/s ({:.2f} s)\n",
+      result.events / seconds,
+      seconds);
+    std::cout << fmt::format(
+      "  latency     p50 {} us, p99 {} us, p99.9 {} us\n",
+      result.p50,
+      result.p99,
+      result.p999);
+    std::cout << fmt::format(
+      "  cpu         {:.2f} us/event, {:.0f}% of a core\n",
+      (double) result.bot_cpu_us / result.events,
+      100.0 * result.bot_cpu_us / result.wall_us);
+    return 0;
+}
@@ -0,0 +1,252 @@
+#include "fixtures.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <random>
+
+#include <fmt/format.h>
+
+#include "websocket/recording.h"
+
+namespace
+{
+    constexpr char user[] =
+      "{{\"username\":\"user{0}\",\"public_flags\":0,\"id\":\"{1}\",\"discriminator\":\"{2:04}\","
+      "\"avatar\":\"8342729096ea3675442027381ff50dfe\"}}";
+
+    constexpr char message[] =
+      "{{\"type\":0,\"tts\":false,\"timestamp\":\"2021-01-01T00:00:00.000000+00:00\","
+      "\"referenced_message\":null,\"pinned\":false,\"nonce\":\"{0}\",\"mentions\":[],"
+      "\"mention_roles\":[],\"mention_everyone\":false,\"member\":{{\"roles\":[],\"mute\":false,"
+      "\"joined_at\":\"2020-06-01T00:00:00.000000+00:00\",\"hoisted_role\":null,\"deaf\":false}},"
+      "\"id\":\"{0}\",\"flags\":0,\"embeds\":[],\"edited_timestamp\":null,\"content\":\"{1}\","
+      "\"components\":[],\"channel_id\":\"{2}\",\"author\":{3},\"attachments\":[],"
+      "\"guild_id\":\"{4}\"}}";
+
+    constexpr char typing_start[] =
+      "{{\"user_id\":\"{0}\",\"timestamp\":1609459200,\"member\":{{\"user\":{1},\"roles\":[],"
+      "\"mute\":false,\"joined_at\":\"2020-06-01T00:00:00.000000+00:00\",\"deaf\":false}},"
+      "\"channel_id\":\"{2}\",\"guild_id\":\"{3}\"}}";
+
+    constexpr char presence_update[] =
+      "{{\"user\":{{\"id\":\"{0}\"}},\"status\":\"online\",\"guild_id\":\"{1}\","
+      "\"client_status\":{{\"desktop\":\"online\"}},\"activities\":[{{\"type\":0,"
+      "\"name\":\"Game {2}\",\"id\":\"{3:x}\",\"created_at\":1609459200000}}]}}";
+
+    constexpr char channel[] =
+      "{{\"type\":0,\"topic\":null,\"rate_limit_per_user\":0,\"position\":{0},"
+      "\"permission_overwrites\":[],\"parent_id\":null,\"nsfw\":false,\"name\":\"channel-{0}\","
+      "\"last_message_id\":null,\"id\":\"{1}\"}}";
+
+    constexpr char member[] =
+      "{{\"user\":{0},\"roles\":[],\"mute\":false,\"joined_at\":"
+      "\"2020-06-01T00:00:00.000000+00:00\",\"hoisted_role\":null,\"deaf\":false}}";
+
+    constexpr u64 guild_id   = 800000000000000000;
+    constexpr u64 channel_id = 810000000000000000;
+    constexpr u64 user_id    = 820000000000000000;
+
+    std::string make_user(u64 index)
+    {
+        return fmt::format(user, index, user_id + index, index % 10000);
+    }
+
+    // Word salad of chat-like lengths, from a fixed seed
+    std::string make_content(std::mt19937 &rng)
+    {
+        static const char *words[] = { "the", "bot", "is", "down", "again", "lol", "anyone",
+                                       "here", "gg", "what", "time", "raid", "tonight", "ok",
+                                       "sure", "!ping", "cant", "join", "voice", "brb" };
+
+        std::string content;
+        size_t      count = 1 + rng() % 24;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (i > 0) content.push_back(' ');
+            content += words[rng() % (sizeof(words) / sizeof(*words))];
+        }
+        return content;
+    }
+
+    std::vector<std::string> synthetic()
+    {
+        std::mt19937             rng(1234);
+        std::vector<std::string> payloads;
+        u64                      s = 1;
+
+        for (u64 guild = 0; guild < 2; guild++)
+            payloads.push_back(fixtures::dispatch(
+              "GUILD_CREATE",
+              s++,
+              fixtures::guild_create(guild, guild == 0 ? 40 : 15, guild == 0 ? 250 : 60)));
+
+        for (u64 i = 0; i < 5000; i++)
+        {
+            u64 guild = guild_id + rng() % 2;
+            u64 from  = rng() % 250;
+            u32 kind  = rng() % 100;
+            if (kind < 60)
+                payloads.push_back(fixtures::dispatch(
+                  "MESSAGE_CREATE",
+                  s++,
+                  fmt::format(
+                    message,
+                    900000000000000000 + i,
+                    make_content(rng),
+                    channel_id + rng() % 15,
+                    make_user(from),
+                    guild)));
+            else if (kind < 80)
+                payloads.push_back(fixtures::dispatch(
+                  "TYPING_START",
+                  s++,
+                  fmt::format(typing_start, user_id + from, make_user(from), channel_id, guild)));
+            else if (kind < 95)
+                payloads.push_back(fixtures::dispatch(
+                  "PRESENCE_UPDATE",
+                  s++,
+                  fmt::format(presence_update, user_id + from, guild, rng() % 50, rng())));
+            else if (kind < 99)
+                payloads.push_back(fixtures::dispatch(
+                  "GUILD_MEMBER_UPDATE",
+                  s++,
+                  fmt::format(
+                    "{{\"guild_id\":\"{}\",\"user\":{},\"roles\":[],\"nick\":\"nick{}\"}}",
+                    guild,
+                    make_user(from),
+                    i)));
+            else
+                payloads.push_back("{\"t\":null,\"s\":null,\"op\":11,\"d\":null}");
+        }
+        return payloads;
+    }
+
+    std::vector<std::string> recorded(const std::string &path)
+    {
+        std::vector<std::string> payloads;
+        Playback                 playback(path);
+        WebSocket::IFrame        frame;
+        u64                      offset_us;
+        while (playback.next(frame, offset_us))
+            if (frame.opcode == WebSocket::Opcode::text_frame)
+                payloads.emplace_back(
+                  (const char *) frame.payload_data.get() + frame.app_data_offset,
+                  frame.payload_length);
+
+        if (payloads.empty())
+        {
+            std::cerr << "No text frames in " << path << "\n";
+            std::exit(-1);
+        }
+        return payloads;
+    }
+}    // namespace
+
+const std::vector<std::string> &fixtures::traffic()
+{
+    static const std::vector<std::string> payloads = []
+    {
+        const char *path = std::getenv("GLSBOT_BENCH_RECORDING");
+        return path ? recorded(path) : synthetic();
+    }();
+    return payloads;
+}
+
+std::string fixtures::hello()
+{
+    return "{\"t\":null,\"s\":null,\"op\":10,\"d\":{\"heartbeat_interval\":41250}}";
+}
+
+std::string fixtures::ready(u32 guilds)
+{
+    std::string guild_list;
+    for (u32 i = 0; i < guilds; i++)
+    {
+        if (i > 0) guild_list.push_back(',');
+        guild_list += fmt::format("{{\"id\":\"{}\",\"unavailable\":true}}", guild_id + i);
+    }
+    return dispatch(
+      "READY",
+      1,
+      fmt::format(
+        "{{\"v\":9,\"user\":{},\"guilds\":[{}],\"session_id\":\"bench\","
+        "\"application\":{{\"id\":\"{}\",\"flags\":0}}}}",
+        make_user(0),
+        guild_list,
+        user_id));
+}
+
+std::string fixtures::dispatch(std::string_view t, u64 s, std::string_view d)
+{
+    return fmt::format("{{\"t\":\"{}\",\"s\":{},\"op\":0,\"d\":{}}}", t, s, d);
+}
+
+std::string fixtures::guild_create(u64 guild, u32 channels, u32 members)
+{
+    std::string channel_list, member_list;
+    for (u32 i = 0; i < channels; i++)
+    {
+        if (i > 0) channel_list.push_back(',');
+        channel_list += fmt::format(channel, i, channel_id + guild * 1000 + i);
+    }
+    for (u32 i = 0; i < members; i++)
+    {
+        if (i > 0) member_list.push_back(',');
+        member_list += fmt::format(member, make_user(i));
+    }
+
+    return fmt::format(
+      "{{\"id\":\"{0}\",\"name\":\"Guild {1}\",\"owner_id\":\"{2}\",\"member_count\":{3},"
+      "\"large\":false,\"unavailable\":false,\"joined_at\":\"2020-06-01T00:00:00.000000+00:00\","
+      "\"roles\":[],\"emojis\":[],\"features\":[],\"voice_states\":[],\"presences\":[],"
+      "\"threads\":[],\"channels\":[{4}],\"members\":[{5}]}}",
+      guild_id + guild,
+      guild,
+      user_id,
+      members,
+      channel_list,
+      member_list);
+}
+
+std::string fixtures::members_chunk(u64 guild, u32 members)
+{
+    std::string member_list;
+    for (u32 i = 0; i < members; i++)
+    {
+        if (i > 0) member_list.push_back(',');
+        member_list += fmt::format(member, make_user(i));
+    }
+    return fmt::format(
+      "{{\"guild_id\":\"{}\",\"members\":[{}],\"chunk_index\":0,\"chunk_count\":1}}",
+      guild_id + guild,
+      member_list);
+}
+
+std::string fixtures::message_create(u64 id, std::string_view content)
+{
+    return fmt::format(message, id, content, channel_id, make_user(id % 250), guild_id);
+}
+
+std::string
+  fixtures::write_recording(const std::vector<std::string> &payloads, const std::string &name)
+{
+    auto path = (std::filesystem::temp_directory_path() / name).string();
+
+    Recorder recorder(path);
+    for (size_t i = 0; i < payloads.size(); i++)
+    {
+        WebSocket::IFrame frame;
+        frame.opcode          = WebSocket::Opcode::text_frame;
+        frame.rsv             = 0;
+        frame.payload_length  = payloads[i].size();
+        frame.payload_data    = BufferPool::global().acquire(payloads[i].size());
+        frame.app_data_offset = 0;
+        frame.received_us     = i * 100;
+        std::memcpy(frame.payload_data.get(), payloads[i].data(), payloads[i].size());
+        recorder.write(frame);
+    }
+    recorder.flush();
+    return path;
+}
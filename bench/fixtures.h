@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "util/types.h"
+
+// Inputs for the benchmarks. Shaped like what Discord sends, and identical on every run so
+// numbers can be compared across commits. Set GLSBOT_BENCH_RECORDING to a --record file to
+// measure captured traffic instead of the synthetic mix.
+namespace fixtures
+{
+    // Whole gateway payloads ({"op","d","s","t"}) in roughly the mix a busy bot sees
+    const std::vector<std::string> &traffic();
+
+    // What a session opens with, for anything that runs the real handshake
+    std::string hello();
+    std::string ready(u32 guilds);
+
+    // Wraps 'd' in a dispatch payload
+    std::string dispatch(std::string_view t, u64 s, std::string_view d);
+
+    std::string guild_create(u64 guild_id, u32 channels, u32 members);
+    std::string members_chunk(u64 guild_id, u32 members);
+    std::string message_create(u64 id, std::string_view content);
+
+    // Writes 'payloads' as a recording (see websocket/recording.h) in the temp directory and
+    // returns its path
+    std::string write_recording(const std::vector<std::string> &payloads, const std::string &name);
+}    // namespace fixtures
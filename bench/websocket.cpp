@@ -0,0 +1,140 @@
+#include <cstring>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <zlib-ng.h>
+
+#include "fixtures.h"
+#include "websocket/buffer_pool.h"
+#include "websocket/frame.h"
+
+namespace
+{
+    size_t total_size(const std::vector<std::string> &payloads)
+    {
+        size_t size = 0;
+        for (auto &payload : payloads) size += payload.size();
+        return size;
+    }
+
+    void websocket_mask(benchmark::State &state)
+    {
+        std::vector<u8> src(state.range(0), 'x'), dst(state.range(0));
+        for (auto _ : state)
+        {
+            mask_copy(dst.data(), src.data(), src.size(), 0x12345678);
+            benchmark::ClobberMemory();
+        }
+        state.SetBytesProcessed(state.iterations() * state.range(0));
+    }
+    BENCHMARK(websocket_mask)->Arg(16)->Arg(256)->Arg(4096)->Arg(65536);
+
+    // What send_frame() does before queueing: pooled buffer, fragments, masking
+    void websocket_encode(benchmark::State &state)
+    {
+        std::string payload(state.range(0), 'x');
+        for (auto _ : state)
+        {
+            auto   buffer = BufferPool::global().acquire(encoded_capacity(payload.size()));
+            size_t length = encode_message(
+              buffer.get(),
+              WebSocket::Opcode::text_frame,
+              (const u8 *) payload.data(),
+              payload.size());
+            benchmark::DoNotOptimize(length);
+        }
+        state.SetBytesProcessed(state.iterations() * state.range(0));
+    }
+    BENCHMARK(websocket_encode)->Arg(64)->Arg(1024)->Arg(16384);
+
+    // What listen() does per frame once the bytes are in: header, pooled payload, unmasking.
+    // The traffic is laid out as one unmasked server stream, with the memcpy standing in for
+    // the socket read
+    void websocket_decode(benchmark::State &state)
+    {
+        auto &payloads = fixtures::traffic();
+
+        std::vector<u8> stream;
+        for (auto &payload : payloads)
+        {
+            FrameHeader header { true, 0, WebSocket::Opcode::text_frame, false, 0, payload.size() };
+            u8          raw[FrameHeader::max_size];
+            stream.insert(stream.end(), raw, raw + header.encode(raw));
+            stream.insert(stream.end(), payload.begin(), payload.end());
+        }
+
+        for (auto _ : state)
+        {
+            const u8 *in = stream.data();
+            while (in < stream.data() + stream.size())
+            {
+                auto header = FrameHeader::decode(in);
+                in += FrameHeader::size(in);
+
+                auto payload = BufferPool::global().acquire(header.payload_length);
+                std::memcpy(payload.get(), in, header.payload_length);
+                if (header.masked)
+                    mask_copy(
+                      payload.get(),
+                      payload.get(),
+                      header.payload_length,
+                      header.masking_key);
+                in += header.payload_length;
+                benchmark::DoNotOptimize(payload.get());
+            }
+        }
+        state.SetItemsProcessed(state.iterations() * payloads.size());
+        state.SetBytesProcessed(state.iterations() * stream.size());
+    }
+    BENCHMARK(websocket_decode);
+
+    // Discord's zlib-stream transport compression: one deflate stream for the whole
+    // connection, every message ending in a sync flush
+    void websocket_inflate(benchmark::State &state)
+    {
+        auto &payloads = fixtures::traffic();
+
+        std::vector<std::vector<u8>> messages;
+        {
+            zng_stream deflater {};
+            zng_deflateInit(&deflater, 6);
+            std::vector<u8> out;
+            for (auto &payload : payloads)
+            {
+                out.resize(zng_deflateBound(&deflater, payload.size()) + 16);
+                deflater.next_in   = (const u8 *) payload.data();
+                deflater.avail_in  = payload.size();
+                deflater.next_out  = out.data();
+                deflater.avail_out = out.size();
+                zng_deflate(&deflater, Z_SYNC_FLUSH);
+                messages.emplace_back(out.data(), deflater.next_out);
+            }
+            zng_deflateEnd(&deflater);
+        }
+
+        size_t          compressed = 0;
+        std::vector<u8> out(64 * 1024);
+        for (auto &message : messages) compressed += message.size();
+        for (auto _ : state)
+        {
+            zng_stream inflater {};
+            zng_inflateInit(&inflater);
+            for (auto &message : messages)
+            {
+                inflater.next_in  = message.data();
+                inflater.avail_in = message.size();
+                do {
+                    inflater.next_out  = out.data();
+                    inflater.avail_out = out.size();
+                    zng_inflate(&inflater, Z_SYNC_FLUSH);
+                } while (inflater.avail_in > 0 || inflater.avail_out == 0);
+                benchmark::DoNotOptimize(out.data());
+            }
+            zng_inflateEnd(&inflater);
+        }
+        state.SetItemsProcessed(state.iterations() * payloads.size());
+        state.SetBytesProcessed(state.iterations() * total_size(payloads));
+        state.counters["ratio"] = (double) total_size(payloads) / compressed;
+    }
+    BENCHMARK(websocket_inflate);
+}    // namespace
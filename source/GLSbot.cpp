@@ -1,5 +1,6 @@
 #include "GLSbot.h"
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <string_view>
@@ -8,69 +9,184 @@
 #include <cctype>
 #include <string>
 
-#include <cpr/cpr.h>
 #include <fmt/format.h>
 #include <json/json.hpp>
 
+#include "discord/scan.h"
+#include "util/metrics.h"
+
 namespace
 {
-    inline std::string send_message(std::string_view token, std::string_view id, std::string &json)
+    bool offline = false;    // Replaying a recording or a dry run, so there is nobody to talk to
+
+    constexpr u64 answer_timeout_us = 60'000'000;    // For a command waiting on a reply
+    constexpr u64 drain_timeout_us  = 5'000'000;     // For handlers still going at shutdown
+
+    Task<std::string> send_message(discord::Rest &rest, std::string id, std::string json)
     {
-        auto response = cpr::Post(
-          cpr::Url(fmt::format("https://discord.com/api/channels/{}/messages", id)),
-          cpr::Header { { "Authorization", fmt::format("Bot {}", token) },
-                        { "Content-Type", "application/json" } },
-          cpr::VerifySsl(false),
-          cpr::Body { json });
-
-        auto parsed = nlohmann::json::parse(response.text);
-        if (parsed.find("id") == parsed.end())
+        if (offline) co_return "";
+
+        auto response = co_await rest.async_post(
+          "POST /channels/{channel.id}/messages",
+          fmt::format("/channels/{}/messages", id),
+          json);
+        auto message_id = discord::scan::string(discord::scan::field(response.body, "id"));
+        if (!response.ok() || message_id.empty())
         {
-            std::cout << "Failed to send message\n";
-            std::cout << response.text << "\n";
-            return "";
+            std::cout << "Failed to send message (" << response.status << ")\n";
+            std::cout << response.body << "\n";
+            co_return "";
         }
 
-        return parsed["id"].get<std::string>();
-    }
-    inline std::string
-      send_response(std::string_view token, nlohmann::json &event_data, std::string &json)
-    {
-        auto channel_id = event_data["channel_id"].get<std::string_view>();
-        return send_message(token, channel_id, json);
+        co_return std::string(message_id);
     }
 
-    inline std::string create_dm(std::string_view token, std::string_view user_id)
+    Task<std::string> create_dm(discord::Rest &rest, std::string user_id)
     {
-        std::string json     = fmt::format("{{\"recipient_id\": \"{}\"}}", user_id);
-        auto        response = cpr::Post(
-          cpr::Url("https://discord.com/api/users/@me/channels"),
-          cpr::Header { { "Authorization", fmt::format("Bot {}", token) },
-                        { "Content-Type", "application/json" } },
-          cpr::VerifySsl(false),
-          cpr::Body { json });
-
-        return nlohmann::json::parse(response.text)["id"].get<std::string>();
+        if (offline) co_return "";
+
+        auto response = co_await rest.async_post(
+          "POST /users/@me/channels",
+          "/users/@me/channels",
+          fmt::format("{{\"recipient_id\": \"{}\"}}", user_id));
+        auto channel_id = discord::scan::string(discord::scan::field(response.body, "id"));
+        if (!response.ok() || channel_id.empty())
+        {
+            std::cout << "Failed to create DM (" << response.status << ")\n";
+            std::cout << response.body << "\n";
+            co_return "";
+        }
+
+        co_return std::string(channel_id);
     }
 }    // namespace
 
+GLSbot::GLSbot()
+{
+    // Handlers resumed from other threads get run() out of its wait for frames
+    loop.set_wake([this] { gateway.wake(); });
+
+    // What run() and the cache handle. The member events only come with the privileged
+    // GUILD_MEMBERS intent, which has to be configured
+    using discord::Event;
+    gateway.subscribe({ Event::ready,
+                        Event::resumed,
+                        Event::guild_create,
+                        Event::guild_update,
+                        Event::guild_delete,
+                        Event::channel_create,
+                        Event::channel_update,
+                        Event::channel_delete,
+                        Event::guild_member_add,
+                        Event::guild_member_update,
+                        Event::guild_member_remove,
+                        Event::guild_members_chunk,
+                        Event::voice_state_update,
+                        Event::voice_server_update,
+                        Event::message_create });
+    // Most messages aren't commands, and are dropped on their first few bytes. Unless a
+    // command is waiting for an answer, which needn't be one
+    gateway.set_filter(
+      Event::message_create,
+      [this](std::string_view raw)
+      { return waiters.waiting_for(Event::message_create) || prefixes.match(raw) > 0; });
+}
+
 void GLSbot::start(std::string_view token, std::string_view owner_user)
 {
+    rest.authorize(token);
     if (gateway.connect(token) < 0) std::__throw_runtime_error("Failed to connect to gateway");
     std::cout << "Successfully Connected to Gateway\n";
 
-    std::string                   owner_dm;
-    std::vector<std::string_view> words;
+    run(token, owner_user);
+}
+
+void GLSbot::replay(const std::string &path, bool realtime, std::string_view owner_user)
+{
+    offline = true;
+
+    u64 start = metrics::now_us();
+    if (gateway.replay(path, realtime) < 0)
+        std::__throw_runtime_error("Failed to replay recording");
+
+    size_t events  = run("", owner_user);
+    double seconds = (metrics::now_us() - start) / 1e6;
+    std::cout << fmt::format(
+      "Replayed {} events in {:.2f} s ({:.0f} events/s)\n",
+      events,
+      seconds,
+      events / seconds);
+    close();
+}
+
+bool GLSbot::record(const std::string &path)
+{
+    return gateway.record(path);
+}
+
+size_t GLSbot::run(std::string_view token, std::string_view owner_user)
+{
+    static auto &event_latency =
+      metrics::registry().histogram("glsbot_event_latency_microseconds");
+    metrics::registry().describe(
+      "glsbot_event_latency_microseconds",
+      "Time from a frame arriving to the bot being done with its event");
+
+    std::string scratch;    // For unescaping
+    size_t      handled = 0;
     while (gateway.connected())
     {
         int incoming = gateway.get_incoming();
-        for (int _ = 0; _ < incoming; _++)
+        for (int _ = 0; _ < incoming; _++, handled++)
         {
-            auto [event_name, event_data] = gateway.next_event();
+            // Everything built while handling the event is released in one go at the end
+            Arena::Scope scope(event_arena);
+
+            auto  event      = gateway.next_event();
+            auto &event_name = event.name;
+            // Recorded however the handler leaves
+            metrics::Timer timer(event_latency, event.received_us);
             // std::cout << event_name << "\n";
-            // std::cout << event_data.dump(-1) << "\n";
+            // std::cout << event.raw << "\n";
+
+            // Resumed once this event is done with, so they see the cache updated for it
+            bool awaited = waiters.size() > 0 && waiters.dispatch(event_name, event.raw);
+
+            if (event_name == "GUILD_MEMBERS_CHUNK")
+            {
+                // Chunks hold up to 1000 members, so stream them instead of parsing a DOM
+                bool found_owner = false;
+                cache.stream_members_chunk(
+                  event.raw,
+                  [&](const discord::Cache::MemberView &member)
+                  {
+                      if (
+                        owner_user.size() > 5 &&
+                        member.discriminator == owner_user.substr(owner_user.size() - 4, 4))
+                      {
+                          owner_id    = std::to_string(member.user_id);
+                          found_owner = true;
+                      }
+                      // Can be used for other purposes
+                  });
+                if (found_owner) write_cache();
+                continue;
+            }
+
+            // Handlers read their fields off views, so only the cache builds a DOM
+            if (discord::Cache::updates_on(event_name)) cache.update(event_name, event.data());
+
             if (event_name == "READY")
             {
+                // A READY without a user (from a hand-made recording, say) is no reason to fall
+                // over
+                auto ready = event.as<discord::Ready>();
+                if (ready.has("user"))
+                {
+                    voice.set_user(std::to_string(ready.user().id()));
+                    if (mention_prefix) prefixes.set_mention(ready.user().id());
+                }
+
                 std::string presence =
                   "{\"status\":\"online\",\"afk\":false,\"activities\":"
                   "[{\"name\":\"Your Screams\",\"type\":2,\"created_at\":";
@@ -82,6 +198,7 @@ void GLSbot::start(std::string_view token, std::string_view owner_user)
             {
                 if (!std::filesystem::exists("./cache.json"))
                 {
+                    if (offline) continue;
                     std::cout << "Resume cache non-existant! Unable to properly resume bot\n";
                     gateway.disconnect();
                     gateway.connect(token);
@@ -99,7 +216,7 @@ void GLSbot::start(std::string_view token, std::string_view owner_user)
                 guilds    = json["guilds"].get<std::vector<std::string>>();
                 owner_id  = json["owner_id"].get<std::string>();
 
-                owner_dm = create_dm(token, owner_id);
+                if (!owner_id.empty()) loop.spawn(open_owner_dm());
 
                 std::string presence =
                   "{\"status\":\"online\",\"afk\":false,\"activities\":"
@@ -110,7 +227,7 @@ void GLSbot::start(std::string_view token, std::string_view owner_user)
             }
             else if (event_name == "GUILD_CREATE")
             {
-                std::string id = event_data["id"].get<std::string>();
+                std::string id = std::to_string(event.as<discord::GuildCreate>().id());
                 guilds.push_back(id);
 
                 if (owner_id.empty() & !owner_user.empty())
@@ -125,119 +242,321 @@ void GLSbot::start(std::string_view token, std::string_view owner_user)
 
                 write_cache();
             }
-            else if (event_name == "GUILD_MEMBERS_CHUNK")
+            else if (event_name == "VOICE_STATE_UPDATE" || event_name == "VOICE_SERVER_UPDATE")
             {
-                auto users = event_data["members"].get<std::vector<nlohmann::json>>();
-                if (users.size() == 0) continue;
-                for (auto &user : users)
-                {
-                    if (
-                      user["user"]["discriminator"].get<std::string_view>() ==
-                      owner_user.substr(owner_user.size() - 4, 4))
-                    {
-                        owner_id = user["user"]["id"].get<std::string>();
-                        write_cache();
-                    }
-                    // Can be used for other purposes
-                }
+                if (voice.update(event_name, event.raw) && !offline) voice.connect();
             }
             else if (event_name == "MESSAGE_CREATE")
             {
-                std::string author = fmt::format(
-                  "{}#{}",
-                  event_data["author"]["username"].get<std::string>(),
-                  event_data["author"]["discriminator"].get<std::string>());
-                std::string_view content = event_data["content"].get<std::string_view>();
-
-                if (content.empty()) continue;
-                if (content[0] != '!') continue;
-                std::cout << author << ": " << content << "\n";
-
-                // Split into individual words
-                words.clear();
-                size_t index = 1;    // +1 for escape-char
-                while (index < content.size())
-                {
-                    size_t nindex = content.find(' ', index);
-                    if (nindex == std::string_view::npos) nindex = content.size();
-                    auto word = std::string_view(content.data() + index, nindex - index);
-                    words.push_back(word);
-                    index = nindex + 1;
-                }
-                if (words.size() == 0)
-                    std::__throw_runtime_error("Something really fucked up. words.size == 0");
+                // The answer a command was waiting for isn't a command of its own
+                if (awaited) continue;
 
-                if (words[0] == "ping")
-                {
-                    // TODO: Ping latency in ms
-                    std::string post = "{\"content\":\"pong!\"}";
-                    send_response(token, event_data, post);
-                }
-                if (words[0] == "shutdown" | words[0] == "die")
-                {
-                    std::string post;
-                    if (words[0] == "shutdown")
-                    {
-                        if (event_data["author"]["id"].get<std::string>() == owner_id)
-                            post = "{\"content\":\"Turning off the bot. Goodbye\"}";
-                        else
-                            post = "{\"content\":\"You do not have permission to do this\"}";
-                    }
-                    else
-                    {
-                        if (event_data["author"]["id"].get<std::string>() == owner_id)
-                            post = "{\"content\":\"ok.\"}";
-                        else
-                            post = "{\"content\":\"no.\"}";
-                    }
-                    send_response(token, event_data, post);
-
-                    if (event_data["author"]["id"].get<std::string>() == owner_id)
-                    {
-                        write_cache();
-                        gateway.disconnect();
-                    }
-                }
-                if (words[0] == "report")
-                {
-                    std::string post;
-                    if (owner_id.empty())
-                        post =
-                          "{\"content\":\"This has been disabled. Please contact a Server "
-                          "Moderator through your DMs instead\"}";
-                    else if (words.size() == 1)
-                        post =
-                          "{\"content\":\"No problem to send. Please specify the problem after "
-                          "'!report'\"}";
-                    else
-                        post = "{\"content\":\"Reported the problem to Bot Owner\"}";
-                    send_response(token, event_data, post);
-
-                    if (!owner_id.empty() && words.size() > 1)
-                    {
-                        if (owner_dm.empty()) owner_dm = create_dm(token, owner_id);
-                        post = "{\"content\":\"Reported by " + author + ":\"}";
-                        send_message(token, owner_dm, post);
-
-                        post = "{\"content\":\"";
-                        post += content.substr(8);
-                        post += "\"}";
-                        send_message(token, owner_dm, post);
-                    }
-                }
+                // The gateway turned away the rest already, unless someone was waiting on
+                // messages. Prefixes have no escapes in them, so they're as long either way
+                auto               view     = event.as<discord::MessageCreate>();
+                discord::snowflake guild_id = view.guild_id();
+                size_t             prefix   = prefixes.match(guild_id, view.content());
+                if (prefix == 0) continue;
+
+                std::string_view content = view.content(scratch);
+                Message          message;
+                message.prefix  = content.substr(0, prefix);
+                message.content = content.substr(prefix);
+
+                auto user          = view.author();
+                message.author =
+                  fmt::format("{}#{}", user.username(scratch), user.discriminator());
+                message.author_id  = std::to_string(user.id());
+                message.channel_id = std::to_string(view.channel_id());
+                if (guild_id != 0) message.guild_id = std::to_string(guild_id);
+                std::cout << message.author << ": " << content << "\n";
+                // Runs until it has to wait on something, then finishes from loop.poll()
+                loop.spawn(command(std::move(message)));
+            }
+        }
+
+        // Handlers whose requests, timers or awaited events came in meanwhile
+        loop.poll();
+    }
+
+    // Give handlers a moment to finish what they started, like the goodbye before a shutdown
+    waiters.cancel_all();
+    u64 until = metrics::now_us() + drain_timeout_us;
+    for (loop.poll(); loop.in_flight() > 0 && metrics::now_us() < until; loop.poll())
+        loop.wait(until - metrics::now_us());
+    return handled;
+}
+
+Task<> GLSbot::command(Message message)
+{
+    auto &content = message.content;
+    auto &channel = message.channel_id;
+
+    // Split into individual words
+    std::vector<std::string_view> words;
+    size_t                        index = 0;
+    while (index < content.size())
+    {
+        size_t nindex = content.find(' ', index);
+        if (nindex == std::string_view::npos) nindex = content.size();
+        auto word = std::string_view(content.data() + index, nindex - index);
+        if (!word.empty()) words.push_back(word);    // Runs of spaces
+        index = nindex + 1;
+    }
+    if (words.size() == 0) co_return;    // Only the prefix
+
+    if (words[0] == "ping")
+    {
+        std::string post = "{\"content\":\"pong!\"}";
+        if (u64 latency = gateway.latency_us(); latency > 0)
+            post =
+              fmt::format("{{\"content\":\"pong! Heartbeat: {:.1f} ms\"}}", latency / 1000.0);
+        co_await send_message(rest, channel, post);
+    }
+    if (words[0] == "shutdown" | words[0] == "die")
+    {
+        std::string post;
+        if (words[0] == "shutdown")
+        {
+            if (message.author_id == owner_id)
+                post = "{\"content\":\"Turning off the bot. Goodbye\"}";
+            else
+                post = "{\"content\":\"You do not have permission to do this\"}";
+        }
+        else
+        {
+            if (message.author_id == owner_id)
+                post = "{\"content\":\"ok.\"}";
+            else
+                post = "{\"content\":\"no.\"}";
+        }
+        co_await send_message(rest, channel, post);
+
+        if (message.author_id == owner_id)
+        {
+            write_cache();
+            gateway.disconnect();
+        }
+    }
+    if (words[0] == "cache")
+    {
+        std::string post;
+        if (message.author_id == owner_id)
+            post = fmt::format("{{\"content\":\"{}\"}}", cache.report());
+        else
+            post = "{\"content\":\"You do not have permission to do this\"}";
+        co_await send_message(rest, channel, post);
+    }
+    if (words[0] == "join" || words[0] == "leave")
+    {
+        if (message.guild_id.empty()) co_return;
+
+        // Only ever a number into the payload, whatever was typed
+        discord::snowflake channel_id = 0;
+        if (words[0] == "join" && words.size() > 1) channel_id = discord::to_snowflake(words[1]);
+        if (words[0] == "join" && channel_id == 0)
+        {
+            std::string post = fmt::format(
+              "{{\"content\":\"Please specify the voice channel id after '{}join'\"}}",
+              message.prefix);
+            co_await send_message(rest, channel, post);
+            co_return;
+        }
+        gateway.send_event(
+          discord::Gateway::VoiceStateUpdate,
+          discord::Voice::state_update(discord::to_snowflake(message.guild_id), channel_id));
+    }
+    if (words[0] == "play" || words[0] == "sfx" || words[0] == "stop")
+    {
+        // Music starts over, sound effects mix in on top of whatever is playing
+        bool mixing = words[0] == "sfx" && voice.transport().playing() && !audio.finished();
+        if (!mixing)
+        {
+            voice.transport().stop();
+            audio.stop();
+        }
+        if (words[0] == "stop") co_return;
+
+        // Only files straight from the audio directory
+        std::string post;
+        std::string path = fmt::format("audio/{}", words.size() > 1 ? words[1] : "");
+        if (words.size() == 1 || words[1].empty() || words[1][0] == '.' ||
+            words[1].find_first_of("/\\") != std::string_view::npos)
+            post = fmt::format(
+              "{{\"content\":\"Please specify a file in audio/ after '{}{}'\"}}",
+              message.prefix,
+              words[0]);
+        else if (voice.state() != discord::Voice::State::session)
+            post = fmt::format(
+              "{{\"content\":\"Join a voice channel first with '{}join'\"}}",
+              message.prefix);
+        else if (mixing ? !audio.add(path) : !audio.open(path))
+            post = "{\"content\":\"Could not play that file\"}";
+        else
+        {
+            if (!mixing)
+            {
+                voice.speaking(true);
+                voice.transport().play([this](u8 *frame, size_t capacity)
+                                       { return audio.next(frame, capacity); });
             }
+            co_return;
         }
+        co_await send_message(rest, channel, post);
     }
+    if (words[0] == "report")
+    {
+        if (owner_id.empty())
+        {
+            co_await send_message(
+              rest,
+              channel,
+              "{\"content\":\"This has been disabled. Please contact a Server Moderator through "
+              "your DMs instead\"}");
+            co_return;
+        }
+
+        // Whatever follows the command's name
+        size_t      after   = words[0].data() + words[0].size() - content.data();
+        std::string problem = content.substr(std::min(content.size(), after + 1));
+        if (problem.empty())
+        {
+            // Asked for, rather than turned away
+            co_await send_message(
+              rest,
+              channel,
+              "{\"content\":\"What is the problem? Reply within a minute to report it\"}");
+            auto channel_id = discord::to_snowflake(channel);
+            auto author_id  = discord::to_snowflake(message.author_id);
+            auto answer     = co_await waiters.next(
+              discord::Event::message_create,
+              [&](std::string_view raw)
+              {
+                  discord::MessageCreate reply(raw);
+                  return reply.channel_id() == channel_id && reply.author().id() == author_id;
+              },
+              answer_timeout_us);
+            std::string scratch;
+            if (answer) problem = discord::MessageCreate(*answer).content(scratch);
+            if (problem.empty())
+            {
+                co_await send_message(rest, channel, "{\"content\":\"Nothing reported\"}");
+                co_return;
+            }
+        }
+        co_await send_message(rest, channel, "{\"content\":\"Reported the problem to Bot Owner\"}");
+
+        // Dumped, so quotes and the like in them stay in the JSON string
+        if (owner_dm.empty()) owner_dm = co_await create_dm(rest, owner_id);
+        co_await send_message(
+          rest,
+          owner_dm,
+          fmt::format(
+            "{{\"content\":{}}}",
+            nlohmann::json("Reported by " + message.author + ":").dump()));
+        co_await send_message(
+          rest,
+          owner_dm,
+          fmt::format("{{\"content\":{}}}", nlohmann::json(problem).dump()));
+    }
+}
+
+Task<> GLSbot::open_owner_dm()
+{
+    owner_dm = co_await create_dm(rest, owner_id);
 }
 
 void GLSbot::close()
 {
+    auto &stats = event_arena.stats();
+    if (stats.resets > 0)
+        std::cout << fmt::format(
+          "Event arena: {} events, {:.1f} allocations/event served from the arena, {} mallocs "
+          "total ({} KiB held)\n",
+          stats.resets,
+          (double) stats.allocations / stats.resets,
+          stats.chunk_allocations,
+          event_arena.capacity() / 1024);
+
+    voice.close();
+    if (receiver)
+    {
+        // Its workers are done with the recorder once it's gone
+        voice.transport().set_receiver(nullptr);
+        receiver.reset();
+        recorder->close();
+    }
     write_cache();
     gateway.close();
 }
 
+void GLSbot::set_dry_run(bool dry_run)
+{
+    offline = dry_run;
+}
+
+void GLSbot::set_cache_retention(discord::Cache::Retention retention)
+{
+    cache.set_retention(retention);
+}
+
+void GLSbot::set_gateway_url(std::string url)
+{
+    gateway.set_url(std::move(url));
+}
+
+void GLSbot::set_api_url(std::string url)
+{
+    gateway.set_api_url(url);
+    rest.set_url(std::move(url));
+}
+
+void GLSbot::set_inbound_limit(WebSocket::InboundLimit limit)
+{
+    gateway.set_inbound_limit(std::move(limit));
+}
+
+void GLSbot::set_intents(u32 intents)
+{
+    gateway.set_intents(intents);
+}
+
+bool GLSbot::set_prefix(std::string_view prefix)
+{
+    return prefixes.set_default(prefix);
+}
+
+bool GLSbot::set_guild_prefix(discord::snowflake guild_id, std::string_view prefix)
+{
+    return prefixes.set_guild(guild_id, prefix);
+}
+
+void GLSbot::set_mention_prefix(bool enabled)
+{
+    mention_prefix = enabled;
+}
+
+bool GLSbot::set_voice_recordings(const std::string &directory)
+{
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error)
+    {
+        std::cout << "Could not create " << directory << " for voice recordings\n";
+        return false;
+    }
+
+    recorder = std::make_unique<discord::VoiceRecorder>(directory);
+    receiver = std::make_unique<discord::VoiceReceiver>(
+      [this](const discord::VoiceReceiver::Frame &frame) { recorder->write(frame); });
+    voice.transport().set_receiver(receiver.get());
+    return true;
+}
+
 void GLSbot::write_cache()
 {
+    if (offline) return;
+
     nlohmann::json json;
     json["owner_id"]     = owner_id;
     json["guilds"]       = guilds;
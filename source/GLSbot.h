@@ -1,22 +1,91 @@
 #pragma once
 
+#include <memory>
 #include <string>
 
+#include "discord/audio.h"
 #include "discord/gateway.h"
+#include "discord/cache.h"
+#include "discord/prefixes.h"
+#include "discord/rest.h"
+#include "discord/voice.h"
+#include "discord/voice_receive.h"
+#include "discord/voice_record.h"
+#include "discord/waiters.h"
+#include "util/arena.h"
+#include "util/event_loop.h"
+#include "util/task.h"
 
 class GLSbot
 {
 public:
-    GLSbot() = default;
+    GLSbot();
 
     void start(std::string_view token, std::string_view owner_user);
+    // Runs over a recorded session instead of the gateway. Nothing is sent and no files are
+    // written. Without 'realtime' events are handled as fast as possible
+    void replay(const std::string &path, bool realtime, std::string_view owner_user);
+    // Captures the session's inbound frames to 'path' for replay()
+    bool record(const std::string &path);
 
     void close();
     void write_cache();
 
+    // Handle events as usual, but without calling the REST API or writing files. What replay()
+    // does, for benchmarking against a live connection
+    void set_dry_run(bool dry_run);
+
+    void set_cache_retention(discord::Cache::Retention retention);
+    void set_gateway_url(std::string url);
+    // Base of Discord's HTTP API, e.g. to use a mock server
+    void set_api_url(std::string url);
+    void set_inbound_limit(WebSocket::InboundLimit limit);
+    // In place of what the handled events need, e.g. to add privileged intents
+    void set_intents(u32 intents);
+    // What commands start with, "!" by default. False for one that can't be a prefix
+    bool set_prefix(std::string_view prefix);
+    bool set_guild_prefix(discord::snowflake guild_id, std::string_view prefix);
+    // Mentioning the bot works as a prefix too
+    void set_mention_prefix(bool enabled);
+    // Records everyone heard in voice to a WAV file each in 'directory'. Off without it
+    bool set_voice_recordings(const std::string &directory);
+
 private:
+    // A command, copied out of its MESSAGE_CREATE as its handler outlives the event
+    struct Message
+    {
+        std::string channel_id;
+        std::string guild_id;    // Empty in DMs
+        std::string author_id;
+        std::string author;     // name#discriminator
+        std::string prefix;     // As it was used, for replies to mention
+        std::string content;    // After the prefix
+    };
+
     discord::Gateway gateway;
+    discord::Cache   cache;
+    // Command handlers run here, on run()'s thread. After the gateway it wakes, before the
+    // Rest that resumes handlers on it
+    EventLoop              loop;
+    discord::EventWaiters  waiters { loop };
+    discord::Rest          rest;
+    // Before voice, whose pacing thread reads from it
+    discord::AudioPipeline audio;
+    // Before voice too, whose receive thread feeds them. Only when recording
+    std::unique_ptr<discord::VoiceRecorder> recorder;
+    std::unique_ptr<discord::VoiceReceiver> receiver;
+    discord::Voice                          voice;
+    Arena            event_arena;    // Backs each event's DOM and scratch, reset per event
+
+    // Checked by the gateway's filter on MESSAGE_CREATE, and again by run()
+    discord::CommandPrefixes prefixes;
+    bool                     mention_prefix = false;
 
     std::string              owner_id;
+    std::string              owner_dm;
     std::vector<std::string> guilds;
+
+    size_t run(std::string_view token, std::string_view owner_user);
+    Task<> command(Message message);
+    Task<> open_owner_dm();
 };
\ No newline at end of file
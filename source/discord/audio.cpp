@@ -0,0 +1,604 @@
+#include "audio.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#include <opus.h>
+
+#include "discord/mix.h"
+#include "util/metrics.h"
+
+namespace
+{
+    constexpr size_t ring_frames = 16;       // 320 ms ahead, as far as a sound effect lags
+    constexpr size_t read_frames = 1024;     // Input sample frames per read
+    constexpr i32    bitrate     = 64000;    // What a voice channel defaults to
+
+    inline u16 le16(const u8 *in) { return in[0] | in[1] << 8; }
+    inline u32 le32(const u8 *in) { return (u32) le16(in) | (u32) le16(in + 2) << 16; }
+
+    // One sample of any of the formats a WAV can hold, scaled to [-1, 1)
+    inline float sample(const u8 *in, u16 bits, bool floating)
+    {
+        if (floating)
+        {
+            float value;
+            std::memcpy(&value, in, sizeof(value));
+            return value;
+        }
+        switch (bits)
+        {
+        case 8: return (in[0] - 128) / 128.0f;    // The one unsigned format
+        case 16: return (i16) le16(in) / 32768.0f;
+        case 24:
+            return (i32) ((u32) in[0] << 8 | (u32) in[1] << 16 | (u32) in[2] << 24) /
+                   2147483648.0f;
+        default: return (i32) le32(in) / 2147483648.0f;
+        }
+    }
+}    // namespace
+
+discord::FrameRing::FrameRing(size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    frames.resize(size);
+    mask = size - 1;
+}
+
+discord::AudioPipeline::AudioPipeline() : ring(ring_frames)
+{
+    int error;
+    encoder = opus_encoder_create(rtp::sample_rate, 2, OPUS_APPLICATION_AUDIO, &error);
+    if (error != OPUS_OK) std::__throw_runtime_error(opus_strerror(error));
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate));
+}
+
+discord::AudioPipeline::~AudioPipeline()
+{
+    stop();
+    opus_encoder_destroy(encoder);
+}
+
+bool discord::AudioPipeline::open(const std::string &path, float gain)
+{
+    stop();
+    ring.clear();
+    primed = false;
+    opus_encoder_ctl(encoder, OPUS_RESET_STATE);
+    return add(path, gain);
+}
+
+bool discord::AudioPipeline::add(const std::string &path, float gain)
+{
+    auto source = AudioSource::open(path);
+    if (!source) return false;
+    source->gain = gain;
+    if (source->content)
+        if (auto clip = clip_cache().find(ClipCache::key(source->content, gain)))
+        {
+            auto cached  = std::make_unique<CachedClip>(std::move(clip), std::move(source));
+            cached->gain = gain;
+            source       = std::move(cached);
+        }
+
+    std::lock_guard<std::mutex> lock(added_mutex);
+    added.push_back(std::move(source));
+    if (running) return true;
+
+    // Never started, or ran out of sources. Once it's said so it doesn't look at 'added' again.
+    // The encoder starts afresh too, so what it encodes can be recorded and replayed as is
+    if (worker.joinable()) worker.join();
+    opus_encoder_ctl(encoder, OPUS_RESET_STATE);
+    done    = false;
+    running = true;
+    worker  = std::thread(&AudioPipeline::encode, this);
+    return true;
+}
+
+void discord::AudioPipeline::stop()
+{
+    running = false;
+    if (worker.joinable()) worker.join();
+    done = true;
+
+    std::lock_guard<std::mutex> lock(added_mutex);
+    added.clear();
+    sources.clear();
+    recorded = nullptr;
+    recording.reset();
+}
+
+size_t discord::AudioPipeline::next(u8 *frame, size_t capacity)
+{
+    static auto &underruns = metrics::registry().counter("voice_underruns_total");
+    // Once: it takes the registry's lock, which the pacing thread mustn't wait on every tick
+    [[maybe_unused]] static const bool described = []
+    {
+        metrics::registry().describe(
+          "voice_underruns_total",
+          "Voice ticks that found no encoded frame ready while the input was still going");
+        return true;
+    }();
+
+    auto *front = ring.front();
+    if (!front)
+    {
+        // Before the first frame is just the encoder starting up
+        if (primed && !done) underruns.add();
+        return 0;
+    }
+    primed = true;
+
+    size_t length = std::min<size_t>(front->length, capacity);
+    std::memcpy(frame, front->data, length);
+    ring.release();
+    return length;
+}
+
+std::unique_ptr<discord::AudioSource> discord::AudioSource::open(const std::string &path)
+{
+    if (path == "-")
+    {
+        auto source = std::make_unique<PcmSource>(std::cin);
+        if (!source->start()) return nullptr;
+        return source;
+    }
+
+    MappedFile file;
+    if (!file.open(path))
+    {
+        std::cerr << "Could not open " << path << "\n";
+        return nullptr;
+    }
+    u64 content = file.size() <= ClipCache::max_file_size
+                    ? ClipCache::hash(file.data(), file.size())
+                    : 0;
+
+    std::unique_ptr<AudioSource> source;
+    if (file.size() >= 4 && std::memcmp(file.data(), "OggS", 4) == 0)
+    {
+        auto opus = std::make_unique<OggOpusSource>(std::move(file));
+        if (opus->start()) source = std::move(opus);
+    }
+    else
+    {
+        auto pcm = std::make_unique<PcmSource>(std::move(file));
+        if (pcm->start())
+            source = std::move(pcm);
+        else
+            std::cerr << path << " isn't a WAV file we can play\n";
+    }
+    if (source) source->content = content;
+    return source;
+}
+
+float *discord::AudioSource::reserve(size_t frames)
+{
+    pending.resize((pending_frames + frames) * 2);
+    return pending.data() + pending_frames * 2;
+}
+
+bool discord::AudioSource::refill()
+{
+    // Keep only from the sample the next output starts at
+    size_t consumed = std::min<size_t>(position, pending_frames);
+    pending.erase(pending.begin(), pending.begin() + consumed * 2);
+    pending_frames -= consumed;
+    position -= consumed;
+    return decode();
+}
+
+bool discord::AudioSource::fill(float *pcm)
+{
+    // Linear interpolation between input samples. Good enough for the usual 44.1 kHz, and
+    // 48 kHz input comes through untouched
+    size_t produced = 0;
+    while (produced < rtp::frame_samples)
+    {
+        size_t index = position;
+        if (index + 1 >= pending_frames)
+        {
+            if (refill()) continue;
+            if (produced == 0) return false;
+            std::fill(pcm + produced * 2, pcm + rtp::frame_samples * 2, 0.0f);
+            return true;
+        }
+
+        float        t = position - index;
+        const float *a = &pending[index * 2];
+        pcm[produced * 2]     = a[0] + (a[2] - a[0]) * t;
+        pcm[produced * 2 + 1] = a[1] + (a[3] - a[1]) * t;
+        produced++;
+        position += step;
+    }
+    return true;
+}
+
+bool discord::PcmSource::start()
+{
+    if (!read_header()) return false;
+    if (input) raw.resize(std::max(raw.size(), read_frames * format.channels * format.bits / 8));
+    step = (double) format.sample_rate / rtp::sample_rate;
+    return true;
+}
+
+size_t discord::PcmSource::take(u8 *out, size_t length)
+{
+    if (input)
+    {
+        input->read((char *) out, length);
+        return input->gcount();
+    }
+    length = std::min(length, file.size() - cursor);
+    std::memcpy(out, file.data() + cursor, length);
+    cursor += length;
+    return length;
+}
+
+bool discord::PcmSource::skip(size_t length)
+{
+    if (input) return (bool) input->ignore(length);
+    if (length > file.size() - cursor) return false;
+    cursor += length;
+    return true;
+}
+
+bool discord::PcmSource::read_header()
+{
+    format    = {};
+    raw_size  = 0;
+    data_left = SIZE_MAX;
+
+    u8     riff[12];
+    size_t got = take(riff, sizeof(riff));
+    if (got < sizeof(riff) || std::memcmp(riff, "RIFF", 4) != 0 ||
+        std::memcmp(riff + 8, "WAVE", 4) != 0)
+    {
+        // Raw PCM, and what was read is the start of it
+        cursor = 0;
+        raw.assign(riff, riff + got);
+        raw_size = input ? got : 0;
+        return true;
+    }
+
+    // Chunks up to the samples; "fmt " comes first
+    format.bits = 0;
+    while (true)
+    {
+        u8 chunk[8];
+        if (take(chunk, sizeof(chunk)) < sizeof(chunk)) return false;
+        u32 size = le32(chunk + 4);
+        if (std::memcmp(chunk, "data", 4) == 0)
+        {
+            // Writers to pipes can't go back to fill it in, and leave it 0 or all ones
+            if (size != 0 && size != UINT32_MAX) data_left = size;
+            break;
+        }
+        if (std::memcmp(chunk, "fmt ", 4) != 0)
+        {
+            if (!skip(size + (size & 1))) return false;    // Chunks are padded to even sizes
+            continue;
+        }
+
+        std::vector<u8> fmt(size + (size & 1));
+        if (size < 16 || take(fmt.data(), fmt.size()) < fmt.size()) return false;
+        u16 tag            = le16(fmt.data());
+        format.channels    = le16(fmt.data() + 2);
+        format.sample_rate = le32(fmt.data() + 4);
+        format.bits        = le16(fmt.data() + 14);
+        // WAVE_FORMAT_EXTENSIBLE, the real tag starts its subformat GUID
+        if (tag == 0xFFFE && size >= 26) tag = le16(fmt.data() + 24);
+        format.floating = tag == 3;
+
+        if ((tag != 1 && tag != 3) || format.channels == 0 || format.sample_rate == 0)
+            return false;
+        if (format.floating ? format.bits != 32 : (format.bits % 8 != 0 || format.bits > 32))
+            return false;
+    }
+    return format.bits != 0;
+}
+
+bool discord::PcmSource::decode()
+{
+    size_t    frame_bytes = format.channels * format.bits / 8;
+    const u8 *from;
+    size_t    frames;
+    if (input)
+    {
+        input->read((char *) raw.data() + raw_size, std::min(raw.size() - raw_size, data_left));
+        raw_size += input->gcount();
+        data_left -= std::min<size_t>(input->gcount(), data_left);
+        from   = raw.data();
+        frames = raw_size / frame_bytes;
+    }
+    else
+    {
+        // Straight from the mapping. A partial frame at the end is dropped
+        from   = file.data() + cursor;
+        frames = std::min(read_frames, std::min(file.size() - cursor, data_left) / frame_bytes);
+        cursor += frames * frame_bytes;
+        data_left -= std::min(frames * frame_bytes, data_left);
+        file.advance(cursor);
+    }
+    if (frames == 0) return false;
+
+    // Mono is doubled up, anything past stereo takes front left and right
+    float *out   = reserve(frames);
+    u16    width = format.bits / 8;
+    for (size_t i = 0; i < frames; i++)
+    {
+        const u8 *in = from + i * frame_bytes;
+        out[i * 2]   = sample(in, format.bits, format.floating);
+        out[i * 2 + 1] =
+          format.channels > 1 ? sample(in + width, format.bits, format.floating) : out[i * 2];
+    }
+    pending_frames += frames;
+
+    if (input)
+    {
+        // A partial frame, from a pipe say, waits for the rest
+        raw_size -= frames * frame_bytes;
+        std::memmove(raw.data(), raw.data() + frames * frame_bytes, raw_size);
+    }
+    return true;
+}
+
+discord::OggOpusSource::~OggOpusSource()
+{
+    if (decoder) opus_decoder_destroy(decoder);
+}
+
+bool discord::OggOpusSource::start()
+{
+    // The identification header, first packet of the first page
+    if (!next_page() || !next_packet() || !header()) return false;
+
+    int error;
+    decoder = opus_decoder_create(rtp::sample_rate, 2, &error);
+    if (error != OPUS_OK)
+    {
+        std::cerr << "Could not create an Opus decoder: " << opus_strerror(error) << "\n";
+        decoder = nullptr;
+        return false;
+    }
+    // Output gain, in Q7.8 dB, is for the decoder to apply
+    opus_decoder_ctl(decoder, OPUS_SET_GAIN((i16) le16(packet.data() + 16)));
+
+    // Then the comment header, which nothing here needs
+    packet.clear();
+    return next_packet();
+}
+
+bool discord::OggOpusSource::header()
+{
+    if (packet.size() < 19 || std::memcmp(packet.data(), "OpusHead", 8) != 0)
+    {
+        std::cerr << "Not an Ogg Opus file\n";
+        return false;
+    }
+    // Mapping family 0 is mono or stereo. 1 and up are surround, for a multistream decoder
+    u8 channels = packet[9], family = packet[18];
+    if (family != 0 || channels == 0 || channels > 2)
+    {
+        std::cerr << "Only mono and stereo Ogg Opus can be played\n";
+        return false;
+    }
+    pre_skip = le16(packet.data() + 10);
+    return true;
+}
+
+bool discord::OggOpusSource::next_page()
+{
+    while (true)
+    {
+        // "OggS", version, flags, granule position, serial, sequence, CRC, lacing values
+        constexpr size_t header_size = 27;
+        if (file.size() - cursor < header_size) return false;
+        const u8 *page = file.data() + cursor;
+        if (std::memcmp(page, "OggS", 4) != 0) return false;
+
+        size_t count = page[26];
+        if (file.size() - cursor < header_size + count) return false;
+        size_t length = 0;
+        for (size_t i = 0; i < count; i++) length += page[header_size + i];
+        if (file.size() - cursor < header_size + count + length) return false;
+
+        cursor += header_size + count + length;
+        file.advance(cursor);
+
+        // Anything multiplexed in with the first stream, video say, isn't ours
+        u32 page_serial = le32(page + 14);
+        if (packets == 0 && !segments) serial = page_serial;
+        if (page_serial != serial) continue;
+
+        segments      = page + header_size;
+        segment_count = count;
+        segment       = 0;
+        body          = segments + count;
+        return true;
+    }
+}
+
+bool discord::OggOpusSource::next_packet()
+{
+    // A packet is segments up to one shorter than 255 bytes, and may carry on over pages
+    while (true)
+    {
+        if (segment == segment_count && !next_page()) return false;
+        if (segment == segment_count) continue;    // A page with no segments at all
+
+        u8 lacing = segments[segment++];
+        packet.insert(packet.end(), body, body + lacing);
+        body += lacing;
+        if (lacing < 255)
+        {
+            packets++;
+            return true;
+        }
+    }
+}
+
+bool discord::OggOpusSource::decode()
+{
+    constexpr size_t max_samples = 5760;    // 120 ms, the longest a packet can be
+    while (true)
+    {
+        packet.clear();
+        if (!next_packet()) return false;
+
+        float *out = reserve(max_samples);
+        int samples = opus_decode_float(decoder, packet.data(), packet.size(), out, max_samples, 0);
+        if (samples < 0) continue;    // Damaged, the next one may not be
+
+        // The first few ms are the encoder getting going
+        size_t dropped = std::min<size_t>(pre_skip, samples);
+        pre_skip -= dropped;
+        if (dropped == (size_t) samples) continue;
+        std::memmove(out, out + dropped * 2, (samples - dropped) * 2 * sizeof(float));
+        pending_frames += samples - dropped;
+        return true;
+    }
+}
+
+void discord::AudioPipeline::encode()
+{
+    static auto &encode_time = metrics::registry().histogram("voice_encode_microseconds");
+    static auto &buffered    = metrics::registry().gauge("voice_buffered_frames");
+    metrics::registry().describe(
+      "voice_encode_microseconds",
+      "Time to encode one 20 ms Opus frame");
+    metrics::registry().describe("voice_buffered_frames", "Opus frames encoded ahead of playback");
+
+    std::array<float, rtp::frame_samples * 2> mixed, pcm;
+    while (running)
+    {
+        // Full: far enough ahead to sleep off a few frames
+        auto *frame = ring.claim();
+        if (!frame)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(rtp::frame_ms * 4));
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(added_mutex);
+            bool alone = sources.empty() && added.size() == 1;
+            for (auto &source : added) sources.push_back(std::move(source));
+            added.clear();
+            if (sources.empty())
+            {
+                done    = true;
+                running = false;
+                return;
+            }
+            if (alone) record(sources[0].get());
+        }
+
+        // A cached clip on its own goes out as it was encoded the first time
+        auto *cached = sources.size() == 1 ? dynamic_cast<CachedClip *>(sources[0].get()) : nullptr;
+        if (cached && cached->encoded(*frame))
+        {
+            ring.publish();
+            buffered.set(ring.size());
+            continue;
+        }
+
+        // The first source straight into the mix, the rest on top
+        bool mixing = false;
+        for (size_t i = 0; i < sources.size();)
+        {
+            auto &source = *sources[i];
+            if (!source.fill(mixing ? pcm.data() : mixed.data()))
+            {
+                // Played out alone from the start, so the next play of it can skip all this
+                if (&source == recorded)
+                {
+                    clip_cache().insert(recording_key, std::move(recording));
+                    recorded = nullptr;
+                }
+                sources.erase(sources.begin() + i);
+                continue;
+            }
+            if (mixing)
+                mix::accumulate(mixed.data(), pcm.data(), source.gain, mixed.size());
+            else if (source.gain != 1)
+                mix::scale(mixed.data(), mixed.data(), source.gain, mixed.size());
+            mixing = true;
+            i++;
+        }
+        if (!mixing) continue;
+        if (recorded && sources.size() > 1)
+        {
+            recorded = nullptr;    // Mixed with something, so not what it sounds like alone
+            recording.reset();
+        }
+        mix::saturate(mixed.data(), mixed.size());
+
+        i32 length;
+        {
+            metrics::Timer timed(encode_time);
+            length = opus_encode_float(
+              encoder,
+              mixed.data(),
+              rtp::frame_samples,
+              frame->data,
+              sizeof(frame->data));
+        }
+        if (length < 0)
+        {
+            std::cerr << "Opus encoding failed: " << opus_strerror(length) << "\n";
+            break;
+        }
+        frame->length = length;
+        if (recorded) recording->add(frame->data, length);
+        ring.publish();
+        buffered.set(ring.size());
+    }
+
+    std::lock_guard<std::mutex> lock(added_mutex);
+    recorded = nullptr;
+    recording.reset();
+    done    = true;
+    running = false;
+}
+
+void discord::AudioPipeline::record(AudioSource *source)
+{
+    recorded = nullptr;
+    recording.reset();
+    // Cached already, or not worth it
+    if (source->content == 0) return;
+
+    recorded      = source;
+    recording     = std::make_shared<OpusClip>();
+    recording_key = ClipCache::key(source->content, source->gain);
+}
+
+bool discord::CachedClip::encoded(FrameRing::Frame &frame)
+{
+    if (decoding || played == clip->frames()) return false;
+    size_t    length;
+    const u8 *data = clip->frame(played++, length);
+    std::memcpy(frame.data, data, length);
+    frame.length = length;
+    return true;
+}
+
+bool discord::CachedClip::fill(float *pcm)
+{
+    if (!decoding)
+    {
+        if (played == clip->frames()) return false;
+        // Catch the file up to where the cached frames had got to
+        decoding = true;
+        for (size_t i = 0; i < played; i++)
+            if (!file->fill(pcm)) return false;
+    }
+    if (!file->fill(pcm)) return false;
+    played++;
+    return true;
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <atomic>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util/mapped_file.h"
+#include "util/types.h"
+#include "discord/clip_cache.h"
+#include "discord/rtp.h"
+
+struct OpusEncoder;
+struct OpusDecoder;
+
+namespace discord
+{
+    // Encoded Opus frames between one producer and one consumer, without locks: the encoder
+    // thread fills slots ahead of the clock and the pacing thread takes them. Slots are reused
+    // in place, so neither side allocates or copies more than the frame itself
+    class FrameRing
+    {
+    public:
+        struct Frame
+        {
+            u16 length;
+            u8  data[rtp::max_frame_size];
+        };
+
+        // 'capacity' is rounded up to a power of two
+        explicit FrameRing(size_t capacity);
+
+        // Producer: the next free slot, nullptr while full. Visible to the consumer once
+        // published
+        Frame *claim() noexcept
+        {
+            size_t head = write.load(std::memory_order_relaxed);
+            if (head - read.load(std::memory_order_acquire) == frames.size()) return nullptr;
+            return &frames[head & mask];
+        }
+        void publish() noexcept
+        {
+            write.store(write.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        // Consumer: the oldest frame, nullptr while empty. Stays valid until released
+        const Frame *front() noexcept
+        {
+            size_t tail = read.load(std::memory_order_relaxed);
+            if (tail == write.load(std::memory_order_acquire)) return nullptr;
+            return &frames[tail & mask];
+        }
+        void release() noexcept
+        {
+            read.store(read.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        size_t size() const noexcept { return write.load() - read.load(); }
+        size_t capacity() const noexcept { return frames.size(); }
+        // Only with neither side running
+        void clear() noexcept { read = write.load(); }
+
+    private:
+        std::vector<Frame> frames;
+        size_t             mask;
+
+        // On lines of their own, so the two threads don't bounce one cache line between them
+        alignas(64) std::atomic_size_t write { 0 };
+        alignas(64) std::atomic_size_t read { 0 };
+    };
+
+    // One input to the mix, as 48 kHz stereo float 20 ms at a time. Subclasses decode into
+    // 'pending' at whatever rate the input is, and fill() resamples from there
+    class AudioSource
+    {
+    public:
+        virtual ~AudioSource() = default;
+
+        // Whichever kind 'path' is: Ogg Opus, a WAV file or raw 48 kHz stereo s16le PCM such as
+        // ffmpeg's "-f s16le -ar 48000 -ac 2" writes. Standard input for "-". nullptr if none
+        static std::unique_ptr<AudioSource> open(const std::string &path);
+
+        // One 20 ms frame, zero-padded at the end. False once there is none
+        virtual bool fill(float *pcm);
+
+        float gain    = 1;
+        u64   content = 0;    // ClipCache::hash() of a file small enough to cache, else 0
+
+    protected:
+        // Input converted to stereo float, not yet resampled, and where in it the next output
+        // sample falls
+        std::vector<float> pending;
+        size_t             pending_frames = 0;
+        double             position       = 0;
+        double             step           = 1;    // Input rate over 48 kHz
+
+        // Room for 'frames' more stereo frames at the end of 'pending'; decode() adds
+        // whatever it wrote of them to 'pending_frames'
+        float *reserve(size_t frames);
+        // Some more of 'pending'. False at the end of the input
+        virtual bool decode() = 0;
+
+    private:
+        bool refill();
+    };
+
+    // A WAV file or raw PCM. Files are mapped and read in place; standard input is read into a
+    // buffer
+    class PcmSource final : public AudioSource
+    {
+    public:
+        explicit PcmSource(MappedFile file) : file(std::move(file)) { }
+        explicit PcmSource(std::istream &input) : input(&input) { }
+
+        bool start();
+
+    private:
+        struct Format
+        {
+            u32  sample_rate = rtp::sample_rate;
+            u16  channels    = 2;
+            u16  bits        = 16;
+            bool floating    = false;
+        };
+
+        MappedFile    file;
+        size_t        cursor = 0;    // In 'file'
+        std::istream *input  = nullptr;
+        Format        format;
+        // What is left of a WAV's data chunk, so chunks after it aren't played. Unbounded for
+        // raw PCM, and for WAVs streamed without knowing their size
+        size_t        data_left = SIZE_MAX;
+
+        // Read from 'input', a partial frame of it at most
+        std::vector<u8> raw;
+        size_t          raw_size = 0;
+
+        size_t take(u8 *out, size_t length);
+        bool   skip(size_t length);
+        bool   read_header();
+        bool   decode() override;
+    };
+
+    // Ogg Opus, as opusenc and ffmpeg write it: one or two channels in one logical stream. Its
+    // packets are demuxed from the mapped file as playback gets to them
+    class OggOpusSource final : public AudioSource
+    {
+    public:
+        explicit OggOpusSource(MappedFile file) : file(std::move(file)) { }
+        ~OggOpusSource() override;
+
+        bool start();
+
+    private:
+        MappedFile file;
+        size_t     cursor = 0;    // The next page in 'file'
+
+        // The page being read: its lacing values, and its body from the next segment on
+        u32       serial;
+        const u8 *segments      = nullptr;
+        size_t    segment_count = 0, segment = 0;
+        const u8 *body          = nullptr;
+
+        std::vector<u8> packet;    // Segments so far of one that may span pages
+        u64             packets  = 0;
+        u32             pre_skip = 0;    // Encoder warm-up samples still to drop
+
+        OpusDecoder *decoder = nullptr;
+
+        bool next_page();
+        bool next_packet();
+        bool header();
+        bool decode() override;
+    };
+
+    // A clip found in the ClipCache. Played alone, AudioPipeline sends its frames as they are;
+    // once something mixes in, it is decoded from the file after all, from where it had got to
+    class CachedClip final : public AudioSource
+    {
+    public:
+        CachedClip(std::shared_ptr<const OpusClip> clip, std::unique_ptr<AudioSource> file) :
+            clip(std::move(clip)), file(std::move(file))
+        {
+        }
+
+        // The next frame as it was encoded. False at the end, or once it is being decoded
+        bool encoded(FrameRing::Frame &frame);
+        bool fill(float *pcm) override;
+
+    private:
+        std::shared_ptr<const OpusClip> clip;
+        std::unique_ptr<AudioSource>    file;
+        size_t                          played   = 0;    // Frames, either way
+        bool                            decoding = false;
+
+        bool decode() override { return false; }
+    };
+
+    // Audio for a voice connection: mixes any number of AudioSources, music and sound effects
+    // say, and encodes 20 ms Opus frames of the mix on a thread of its own, a little ahead of
+    // the send clock. next() is what VoiceUdp::play() calls on each tick and only ever takes a
+    // finished frame.
+    class AudioPipeline
+    {
+    public:
+        AudioPipeline();
+        ~AudioPipeline();
+
+        AudioPipeline(const AudioPipeline &) = delete;
+        AudioPipeline &operator=(const AudioPipeline &) = delete;
+
+        // Starts over with just 'path'. Not while anything is calling next(); stop VoiceUdp
+        // first
+        bool open(const std::string &path, float gain = 1);
+        // Mixes 'path' into whatever is playing, from the next frame encoded. Any time
+        bool add(const std::string &path, float gain = 1);
+        void stop();
+
+        // The next frame into 'frame', 0 if there is none yet or every source has ended. The
+        // first case is an underrun
+        size_t next(u8 *frame, size_t capacity);
+        // Everything was encoded and played
+        bool finished() const noexcept { return done && ring.size() == 0; }
+
+    private:
+        FrameRing    ring;
+        OpusEncoder *encoder = nullptr;
+
+        // Sources go through 'added' to the worker, which alone touches 'sources'
+        std::mutex                                added_mutex;
+        std::vector<std::unique_ptr<AudioSource>> added;
+        std::vector<std::unique_ptr<AudioSource>> sources;
+
+        std::thread      worker;
+        std::atomic_bool running { false };
+        std::atomic_bool done { true };
+        bool             primed = false;    // next() has had a frame since open()
+
+        // Frames of the one source playing, to go in the ClipCache if it plays out alone
+        AudioSource *             recorded = nullptr;
+        std::shared_ptr<OpusClip> recording;
+        u64                       recording_key;
+
+        void encode();
+        void record(AudioSource *source);
+    };
+}    // namespace discord
@@ -0,0 +1,297 @@
+#include "cache.h"
+
+#include <fmt/format.h>
+
+namespace
+{
+    // Missing and null fields both read as empty
+    inline std::string_view field(const discord::json &object, const char *key)
+    {
+        auto it = object.find(key);
+        if (it == object.end() || !it->is_string()) return {};
+        return it->get_ref<const discord::json::string_t &>();
+    }
+
+    template<typename T>
+    inline T number(const discord::json &object, const char *key)
+    {
+        auto it = object.find(key);
+        if (it == object.end() || !it->is_number()) return T {};
+        return it->get<T>();
+    }
+}    // namespace
+
+template<typename Map, typename Key>
+auto discord::Cache::reserve(Map &map, const Key &key, size_t limit)
+{
+    if (map.size() >= limit)
+    {
+        // Updates to entries we already have still go through
+        auto *existing = map.find(key);
+        if (!existing && limit != 0) dropped++;
+        return std::make_pair(existing, false);
+    }
+    return map.insert(key);
+}
+
+void discord::Cache::update(std::string_view event_name, const json &data)
+{
+    if (event_name == "GUILD_CREATE" || event_name == "GUILD_UPDATE")
+    {
+        if (data.value("unavailable", false)) return;
+
+        snowflake id = to_snowflake(field(data, "id"));
+        put_guild(
+          id,
+          field(data, "name"),
+          to_snowflake(field(data, "owner_id")),
+          number<u32>(data, "member_count"));
+
+        if (auto it = data.find("channels"); it != data.end() && it->is_array())
+            for (auto &channel : *it) put_channel(id, channel);
+        if (auto it = data.find("members"); it != data.end() && it->is_array())
+            for (auto &member : *it) put_member(id, member);
+    }
+    else if (event_name == "GUILD_DELETE")
+    {
+        // 'unavailable' means an outage, not that we were removed from the guild
+        if (!data.value("unavailable", false)) remove_guild(to_snowflake(field(data, "id")));
+    }
+    else if (event_name == "CHANNEL_CREATE" || event_name == "CHANNEL_UPDATE")
+    {
+        snowflake guild_id = to_snowflake(field(data, "guild_id"));
+        if (guild_id != 0) put_channel(guild_id, data);
+    }
+    else if (event_name == "CHANNEL_DELETE")
+        remove_channel(to_snowflake(field(data, "id")));
+    else if (event_name == "GUILD_MEMBER_ADD" || event_name == "GUILD_MEMBER_UPDATE")
+    {
+        snowflake guild_id = to_snowflake(field(data, "guild_id"));
+        if (event_name == "GUILD_MEMBER_ADD")
+            if (auto *guild = guilds.find(guild_id)) guild->member_count++;
+        put_member(guild_id, data);
+    }
+    else if (event_name == "GUILD_MEMBER_REMOVE")
+    {
+        snowflake guild_id = to_snowflake(field(data, "guild_id"));
+        if (auto *guild = guilds.find(guild_id); guild && guild->member_count > 0)
+            guild->member_count--;
+        if (auto it = data.find("user"); it != data.end())
+            remove_member(guild_id, to_snowflake(field(*it, "id")));
+    }
+    else if (event_name == "GUILD_MEMBERS_CHUNK")
+    {
+        snowflake guild_id = to_snowflake(field(data, "guild_id"));
+        if (auto it = data.find("members"); it != data.end() && it->is_array())
+            for (auto &member : *it) put_member(guild_id, member);
+    }
+}
+
+bool discord::Cache::updates_on(std::string_view event_name) noexcept
+{
+    // Keep in step with the branches in update()
+    constexpr std::string_view handled[] = {
+        "GUILD_CREATE",
+        "GUILD_UPDATE",
+        "GUILD_DELETE",
+        "CHANNEL_CREATE",
+        "CHANNEL_UPDATE",
+        "CHANNEL_DELETE",
+        "GUILD_MEMBER_ADD",
+        "GUILD_MEMBER_UPDATE",
+        "GUILD_MEMBER_REMOVE",
+        "GUILD_MEMBERS_CHUNK",
+    };
+    for (auto name : handled)
+        if (name == event_name) return true;
+    return false;
+}
+
+void discord::Cache::put_guild(
+  snowflake        id,
+  std::string_view name,
+  snowflake        owner_id,
+  u32              member_count)
+{
+    if (id == 0) return;
+    auto [guild, _] = reserve(guilds, id, retention.guilds);
+    if (!guild) return;
+
+    // Interned before the old name is let go of, so an unchanged name isn't stored again
+    auto name_id = strings.intern(name);
+    strings.release(guild->name);
+    guild->name     = name_id;
+    guild->owner_id = owner_id;
+    if (member_count != 0) guild->member_count = member_count;    // Absent from GUILD_UPDATE
+}
+
+void discord::Cache::put_channel(
+  snowflake        id,
+  snowflake        guild_id,
+  snowflake        parent_id,
+  std::string_view name,
+  u16              position,
+  u8               type)
+{
+    if (id == 0) return;
+    auto [channel, _] = reserve(channels, id, retention.channels);
+    if (!channel) return;
+
+    auto name_id = strings.intern(name);
+    strings.release(channel->name);
+    *channel = { guild_id, parent_id, name_id, position, type };
+}
+
+void discord::Cache::put_member(
+  snowflake        guild_id,
+  snowflake        user_id,
+  std::string_view username,
+  std::string_view discriminator,
+  std::string_view nick)
+{
+    if (guild_id == 0 || user_id == 0) return;
+    auto [member, added] = reserve(members, MemberKey { guild_id, user_id }, retention.members);
+    if (!member) return;
+
+    if (added)
+    {
+        auto &users  = members_of(guild_id);
+        member->slot = (u32) users.size();
+        users.push_back(user_id);
+    }
+
+    u16 tag = 0;
+    std::from_chars(discriminator.data(), discriminator.data() + discriminator.size(), tag);
+    auto username_id = strings.intern(username);
+    auto nick_id     = strings.intern(nick);
+    strings.release(member->username);
+    strings.release(member->nick);
+    *member = { username_id, nick_id, member->slot, tag };
+}
+
+void discord::Cache::put_channel(snowflake guild_id, const json &channel)
+{
+    put_channel(
+      to_snowflake(field(channel, "id")),
+      guild_id,
+      to_snowflake(field(channel, "parent_id")),
+      field(channel, "name"),
+      number<u16>(channel, "position"),
+      number<u8>(channel, "type"));
+}
+
+void discord::Cache::put_member(snowflake guild_id, const json &member)
+{
+    auto it = member.find("user");
+    if (it == member.end()) return;
+
+    put_member(
+      guild_id,
+      to_snowflake(field(*it, "id")),
+      field(*it, "username"),
+      field(*it, "discriminator"),
+      field(member, "nick"));
+}
+
+void discord::Cache::remove_guild(snowflake id)
+{
+    auto *guild = guilds.find(id);
+    if (!guild) return;
+    strings.release(guild->name);
+    guilds.erase(id);
+
+    channels.erase_if(
+      [&](snowflake, const Channel &channel)
+      {
+          if (channel.guild_id != id) return false;
+          strings.release(channel.name);
+          return true;
+      });
+
+    auto it = guild_members.find(id);
+    if (it == guild_members.end()) return;
+    for (snowflake user_id : it->second)
+    {
+        auto *member = members.find({ id, user_id });
+        strings.release(member->username);
+        strings.release(member->nick);
+        members.erase({ id, user_id });
+    }
+    guild_members.erase(it);
+    last_guild = 0;
+}
+
+std::vector<discord::snowflake> &discord::Cache::members_of(snowflake guild_id)
+{
+    // A GUILD_CREATE or a chunk is all the one guild, so it's usually the last one asked for
+    if (guild_id != last_guild)
+    {
+        last_guild   = guild_id;
+        last_members = &guild_members[guild_id];
+    }
+    return *last_members;
+}
+
+void discord::Cache::remove_channel(snowflake id)
+{
+    auto *channel = channels.find(id);
+    if (!channel) return;
+    strings.release(channel->name);
+    channels.erase(id);
+}
+
+void discord::Cache::remove_member(snowflake guild_id, snowflake user_id)
+{
+    auto *member = members.find({ guild_id, user_id });
+    if (!member) return;
+    strings.release(member->username);
+    strings.release(member->nick);
+
+    // The last of the guild's list takes its place
+    auto     &users = members_of(guild_id);
+    u32       slot  = member->slot;
+    snowflake moved = users.back();
+    users[slot]     = moved;
+    users.pop_back();
+    if (moved != user_id) members.find({ guild_id, moved })->slot = slot;
+    if (users.empty())
+    {
+        guild_members.erase(guild_id);
+        last_guild = 0;
+    }
+
+    members.erase({ guild_id, user_id });
+}
+
+discord::Cache::Footprint discord::Cache::footprint() const noexcept
+{
+    // The per-guild member lists count towards members, with a rough 4 pointers per node
+    size_t member_bytes = members.memory_usage() + guild_members.bucket_count() * sizeof(void *) +
+      guild_members.size() *
+        (sizeof(snowflake) + sizeof(std::vector<snowflake>) + 4 * sizeof(void *));
+    for (auto &[_, users] : guild_members) member_bytes += users.capacity() * sizeof(snowflake);
+
+    return { guilds.size(),  channels.size(),        members.size(),
+             strings.size(), guilds.memory_usage(),  channels.memory_usage(),
+             member_bytes,   strings.memory_usage(), dropped,
+             strings.compactions() };
+}
+
+std::string discord::Cache::report() const
+{
+    auto fp = footprint();
+    return fmt::format(
+      "guilds: {} ({} KiB), channels: {} ({} KiB), members: {} ({} KiB), "
+      "strings: {} ({} KiB), total: {} KiB, dropped: {}, string compactions: {}",
+      fp.guilds,
+      fp.guild_bytes / 1024,
+      fp.channels,
+      fp.channel_bytes / 1024,
+      fp.members,
+      fp.member_bytes / 1024,
+      fp.strings,
+      fp.string_bytes / 1024,
+      fp.total_bytes() / 1024,
+      fp.dropped,
+      fp.compactions);
+}
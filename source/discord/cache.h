@@ -0,0 +1,214 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include "util/types.h"
+#include "util/flat_map.h"
+#include "util/string_pool.h"
+#include "discord/snowflake.h"
+#include "discord/scan.h"
+#include "discord/json.h"
+
+namespace discord
+{
+    // In-memory copy of the guilds, channels and members the gateway tells us about.
+    // Everything is keyed by snowflake and names are interned, so an entry is a few
+    // dozen bytes and lookups are a single probe sequence.
+    class Cache
+    {
+    public:
+        struct Guild
+        {
+            StringPool::id name;
+            snowflake      owner_id;
+            u32            member_count;
+        };
+
+        struct Channel
+        {
+            snowflake      guild_id;
+            snowflake      parent_id;
+            StringPool::id name;
+            u16            position;
+            u8             type;
+        };
+
+        struct Member
+        {
+            StringPool::id username;
+            StringPool::id nick;
+            u32            slot;    // Index in its guild's list in 'guild_members'
+            u16            discriminator;
+        };
+
+        struct MemberKey
+        {
+            snowflake guild_id;
+            snowflake user_id;
+
+            bool operator==(const MemberKey &other) const noexcept
+            {
+                return guild_id == other.guild_id && user_id == other.user_id;
+            }
+            bool operator!=(const MemberKey &other) const noexcept { return !(*this == other); }
+        };
+
+        // A member as it appears in the raw payload
+        struct MemberView
+        {
+            snowflake        user_id;
+            std::string_view username;
+            std::string_view discriminator;
+            std::string_view nick;
+        };
+
+        // Max entries kept per entity type. 0 disables caching that type.
+        // Once full, new entries are dropped (and counted) rather than evicting old ones.
+        // A disabled type isn't counted, as nothing of it is meant to be kept
+        struct Retention
+        {
+            size_t guilds   = std::numeric_limits<size_t>::max();
+            size_t channels = std::numeric_limits<size_t>::max();
+            size_t members  = 1000000;
+        };
+
+        struct Footprint
+        {
+            size_t guilds, channels, members, strings;    // Entry counts
+            size_t guild_bytes, channel_bytes, member_bytes, string_bytes;
+            size_t dropped;
+            size_t compactions;    // Of the string pool
+
+            size_t total_bytes() const noexcept
+            {
+                return guild_bytes + channel_bytes + member_bytes + string_bytes;
+            }
+        };
+
+        Cache() = default;
+
+        void set_retention(Retention retention) noexcept { this->retention = retention; }
+
+        // Feeds a gateway dispatch into the cache. Unknown events are ignored
+        void update(std::string_view event_name, const json &data);
+        // Whether update() does anything with these, so others needn't be parsed for it
+        static bool updates_on(std::string_view event_name) noexcept;
+
+        // Feeds a raw GUILD_MEMBERS_CHUNK 'd' into the cache one member at a time, without
+        // building a DOM, and calls visit(const MemberView &) on each member
+        template<typename F>
+        void stream_members_chunk(std::string_view raw, F &&visit);
+
+        void put_guild(snowflake id, std::string_view name, snowflake owner_id, u32 member_count);
+        void put_channel(
+          snowflake        id,
+          snowflake        guild_id,
+          snowflake        parent_id,
+          std::string_view name,
+          u16              position,
+          u8               type);
+        void put_member(
+          snowflake        guild_id,
+          snowflake        user_id,
+          std::string_view username,
+          std::string_view discriminator,
+          std::string_view nick);
+
+        void remove_guild(snowflake id);
+        void remove_channel(snowflake id);
+        void remove_member(snowflake guild_id, snowflake user_id);
+
+        const Guild *  guild(snowflake id) const noexcept { return guilds.find(id); }
+        const Channel *channel(snowflake id) const noexcept { return channels.find(id); }
+        const Member * member(snowflake guild_id, snowflake user_id) const noexcept
+        {
+            return members.find({ guild_id, user_id });
+        }
+        std::string_view name(StringPool::id id) const noexcept { return strings.get(id); }
+
+        Footprint   footprint() const noexcept;
+        std::string report() const;
+
+    private:
+        struct MemberKeyHash
+        {
+            size_t operator()(const MemberKey &key) const noexcept
+            {
+                return key.guild_id * 31 ^ key.user_id;
+            }
+        };
+
+        Retention retention;
+        size_t    dropped = 0;
+
+        FlatMap<snowflake, Guild>                  guilds;
+        FlatMap<snowflake, Channel>                channels;
+        FlatMap<MemberKey, Member, MemberKeyHash> members;
+        StringPool                                 strings;
+
+        // User ids of each guild's members, so a guild leaves without a walk over every member
+        std::unordered_map<snowflake, std::vector<snowflake>> guild_members;
+        snowflake                                             last_guild   = 0;
+        std::vector<snowflake>                               *last_members = nullptr;
+
+        std::vector<snowflake> &members_of(snowflake guild_id);
+
+        // The entry and whether it's new, or nullptr if it's over the limit
+        template<typename Map, typename Key>
+        auto reserve(Map &map, const Key &key, size_t limit);
+
+        void put_member(snowflake guild_id, const json &member);
+        void put_channel(snowflake guild_id, const json &channel);
+    };
+
+    template<typename F>
+    void Cache::stream_members_chunk(std::string_view raw, F &&visit)
+    {
+        snowflake        guild_id = 0;
+        std::string_view members;
+        scan::fields(
+          raw,
+          [&](std::string_view key, std::string_view value)
+          {
+              if (key == "guild_id")
+                  guild_id = scan::integer(value);
+              else if (key == "members")
+                  members = value;
+          });
+
+        // Only touched when a name has escapes in it
+        std::string username_scratch, nick_scratch;
+        scan::elements(
+          members,
+          [&](std::string_view member)
+          {
+              MemberView view {};
+              scan::fields(
+                member,
+                [&](std::string_view key, std::string_view value)
+                {
+                    if (key == "nick")
+                        view.nick = scan::string(value, nick_scratch);
+                    else if (key == "user")
+                        scan::fields(
+                          value,
+                          [&](std::string_view key, std::string_view value)
+                          {
+                              if (key == "id")
+                                  view.user_id = scan::integer(value);
+                              else if (key == "username")
+                                  view.username = scan::string(value, username_scratch);
+                              else if (key == "discriminator")
+                                  view.discriminator = scan::string(value);
+                          });
+                });
+
+              put_member(guild_id, view.user_id, view.username, view.discriminator, view.nick);
+              visit(view);
+          });
+    }
+}    // namespace discord
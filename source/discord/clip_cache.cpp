@@ -0,0 +1,90 @@
+#include "clip_cache.h"
+
+#include <cstring>
+
+#include "util/metrics.h"
+
+namespace
+{
+    constexpr size_t cache_capacity = 32 * 1024 * 1024;    // Over an hour at 64 kb/s
+
+    // fmix64 from MurmurHash3
+    inline u64 mix(u64 h) noexcept
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        return h ^ (h >> 33);
+    }
+}    // namespace
+
+u64 discord::ClipCache::hash(const u8 *data, size_t size) noexcept
+{
+    // A word at a time. Not meant to stand up to anyone crafting collisions, only to tell
+    // files apart
+    u64    h = mix(size);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        u64 word;
+        std::memcpy(&word, data + i, sizeof(word));
+        h = (h ^ mix(word)) * 0x9e3779b97f4a7c15ull;
+    }
+    u64 tail = 0;
+    std::memcpy(&tail, data + i, size - i);
+    return mix(h ^ mix(tail));
+}
+
+u64 discord::ClipCache::key(u64 content, float gain) noexcept
+{
+    u32 bits;
+    std::memcpy(&bits, &gain, sizeof(bits));
+    return mix(content ^ mix(bits));
+}
+
+std::shared_ptr<const discord::OpusClip> discord::ClipCache::find(u64 key)
+{
+    static auto &hits   = metrics::registry().counter("voice_clip_cache_hits_total");
+    static auto &misses = metrics::registry().counter("voice_clip_cache_misses_total");
+    metrics::registry().describe(
+      "voice_clip_cache_hits_total",
+      "Clips played from frames encoded on an earlier play");
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto                        it = index.find(key);
+    if (it == index.end())
+    {
+        misses.add();
+        return nullptr;
+    }
+    entries.splice(entries.begin(), entries, it->second);
+    hits.add();
+    return it->second->second;
+}
+
+void discord::ClipCache::insert(u64 key, std::shared_ptr<const OpusClip> clip)
+{
+    static auto &cached = metrics::registry().gauge("voice_clip_cache_bytes");
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (clip->bytes() > capacity || index.count(key)) return;
+
+    // Anyone still playing an evicted clip has a reference of their own
+    size += clip->bytes();
+    entries.emplace_front(key, std::move(clip));
+    index[key] = entries.begin();
+    while (size > capacity)
+    {
+        size -= entries.back().second->bytes();
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+    cached.set(size);
+}
+
+discord::ClipCache &discord::clip_cache()
+{
+    static ClipCache cache(cache_capacity);
+    return cache;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "util/types.h"
+
+namespace discord
+{
+    // A clip's 20 ms Opus frames back to back, as AudioPipeline encoded them on a play through
+    struct OpusClip
+    {
+        std::vector<u8>  data;
+        std::vector<u32> ends;    // Where each frame ends in 'data'
+
+        size_t frames() const noexcept { return ends.size(); }
+        size_t bytes() const noexcept { return data.size() + ends.size() * sizeof(u32); }
+
+        void add(const u8 *frame, size_t length)
+        {
+            data.insert(data.end(), frame, frame + length);
+            ends.push_back(data.size());
+        }
+        const u8 *frame(size_t index, size_t &length) const noexcept
+        {
+            size_t begin = index == 0 ? 0 : ends[index - 1];
+            length       = ends[index] - begin;
+            return data.data() + begin;
+        }
+    };
+
+    // Encoded clips by what they were encoded from, shared by every voice connection in the
+    // process. A sound effect played over and over is then encoded once, and each replay is
+    // only copying its frames out. Least recently played go first past 'capacity' bytes
+    class ClipCache
+    {
+    public:
+        static constexpr size_t max_file_size = 4 * 1024 * 1024;    // Larger is music
+
+        explicit ClipCache(size_t capacity) : capacity(capacity) { }
+
+        // What a clip is cached under: a hash of the file's bytes, then the gain it was
+        // encoded at
+        static u64 hash(const u8 *data, size_t size) noexcept;
+        static u64 key(u64 content, float gain) noexcept;
+
+        std::shared_ptr<const OpusClip> find(u64 key);
+        void                            insert(u64 key, std::shared_ptr<const OpusClip> clip);
+
+    private:
+        using Entry = std::pair<u64, std::shared_ptr<const OpusClip>>;
+
+        std::mutex                                          mutex;
+        std::list<Entry>                                    entries;    // Most recent first
+        std::unordered_map<u64, std::list<Entry>::iterator> index;
+        size_t                                              capacity;
+        size_t                                              size = 0;
+    };
+
+    // The one every connection shares
+    ClipCache &clip_cache();
+}    // namespace discord
@@ -0,0 +1,60 @@
+#include "events.h"
+
+#include <algorithm>
+#include <array>
+#include <utility>
+
+namespace
+{
+    using namespace discord;
+
+    constexpr std::array<std::string_view, (size_t) Event::count> names = {
+#define X(id, name, intents) name,
+        DISCORD_EVENTS(X)
+#undef X
+    };
+
+    constexpr std::array<u32, (size_t) Event::count> event_intents = {
+#define X(id, name, intents) intents,
+        DISCORD_EVENTS(X)
+#undef X
+    };
+
+    // By name, for a binary search. A handful of compares for each dispatch
+    const auto &by_name()
+    {
+        static const auto sorted = []
+        {
+            std::array<std::pair<std::string_view, Event>, (size_t) Event::count> table;
+            for (size_t i = 0; i < table.size(); i++) table[i] = { names[i], (Event) i };
+            std::sort(table.begin(), table.end());
+            return table;
+        }();
+        return sorted;
+    }
+}    // namespace
+
+std::optional<discord::Event> discord::event_of(std::string_view name) noexcept
+{
+    auto &table = by_name();
+    auto  it    = std::lower_bound(
+      table.begin(),
+      table.end(),
+      name,
+      [](const auto &entry, std::string_view name) { return entry.first < name; });
+    if (it == table.end() || it->first != name) return std::nullopt;
+    return it->second;
+}
+
+std::string_view discord::name_of(Event event) noexcept
+{
+    return names[(size_t) event];
+}
+
+u32 discord::EventMask::intents() const noexcept
+{
+    u32 wanted = 0;
+    for (size_t i = 0; i < names.size(); i++)
+        if (bits.test(i)) wanted |= event_intents[i];
+    return wanted & ~intents::privileged;
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <bitset>
+#include <initializer_list>
+#include <optional>
+#include <string_view>
+
+#include "util/types.h"
+
+// Gateway intents, which decide what Discord sends at all
+namespace discord::intents
+{
+    inline constexpr u32 none                     = 0;
+    inline constexpr u32 guilds                   = 1 << 0;
+    inline constexpr u32 guild_members            = 1 << 1;    // Privileged
+    inline constexpr u32 guild_moderation         = 1 << 2;
+    inline constexpr u32 guild_emojis             = 1 << 3;
+    inline constexpr u32 guild_integrations       = 1 << 4;
+    inline constexpr u32 guild_webhooks           = 1 << 5;
+    inline constexpr u32 guild_invites            = 1 << 6;
+    inline constexpr u32 guild_voice_states       = 1 << 7;
+    inline constexpr u32 guild_presences          = 1 << 8;    // Privileged
+    inline constexpr u32 guild_messages           = 1 << 9;
+    inline constexpr u32 guild_message_reactions  = 1 << 10;
+    inline constexpr u32 guild_message_typing     = 1 << 11;
+    inline constexpr u32 direct_messages          = 1 << 12;
+    inline constexpr u32 direct_message_reactions = 1 << 13;
+    inline constexpr u32 direct_message_typing    = 1 << 14;
+    inline constexpr u32 message_content          = 1 << 15;    // Privileged
+    inline constexpr u32 guild_scheduled_events   = 1 << 16;
+    inline constexpr u32 auto_moderation          = 1 << 20 | 1 << 21;
+
+    // Only granted to bots enabled for them in the developer portal; asked for without that,
+    // Identify is refused. So never derived, only ever configured
+    inline constexpr u32 privileged = guild_members | guild_presences | message_content;
+}    // namespace discord::intents
+
+// Dispatch types, and the intents any of which gets them sent. intents::none is sent regardless
+// X(id, name, intents)
+#define DISCORD_EVENTS(X)                                                                          \
+    X(ready, "READY", intents::none)                                                               \
+    X(resumed, "RESUMED", intents::none)                                                           \
+    X(user_update, "USER_UPDATE", intents::none)                                                   \
+    X(interaction_create, "INTERACTION_CREATE", intents::none)                                     \
+    X(voice_server_update, "VOICE_SERVER_UPDATE", intents::none)                                   \
+    X(guild_members_chunk, "GUILD_MEMBERS_CHUNK", intents::none)                                   \
+    X(guild_create, "GUILD_CREATE", intents::guilds)                                               \
+    X(guild_update, "GUILD_UPDATE", intents::guilds)                                               \
+    X(guild_delete, "GUILD_DELETE", intents::guilds)                                               \
+    X(guild_role_create, "GUILD_ROLE_CREATE", intents::guilds)                                     \
+    X(guild_role_update, "GUILD_ROLE_UPDATE", intents::guilds)                                     \
+    X(guild_role_delete, "GUILD_ROLE_DELETE", intents::guilds)                                     \
+    X(channel_create, "CHANNEL_CREATE", intents::guilds)                                           \
+    X(channel_update, "CHANNEL_UPDATE", intents::guilds)                                           \
+    X(channel_delete, "CHANNEL_DELETE", intents::guilds)                                           \
+    X(channel_pins_update, "CHANNEL_PINS_UPDATE", intents::guilds | intents::direct_messages)      \
+    X(thread_create, "THREAD_CREATE", intents::guilds)                                             \
+    X(thread_update, "THREAD_UPDATE", intents::guilds)                                             \
+    X(thread_delete, "THREAD_DELETE", intents::guilds)                                             \
+    X(thread_list_sync, "THREAD_LIST_SYNC", intents::guilds)                                       \
+    X(thread_member_update, "THREAD_MEMBER_UPDATE", intents::guilds)                               \
+    X(thread_members_update, "THREAD_MEMBERS_UPDATE", intents::guilds)                             \
+    X(stage_instance_create, "STAGE_INSTANCE_CREATE", intents::guilds)                             \
+    X(stage_instance_update, "STAGE_INSTANCE_UPDATE", intents::guilds)                             \
+    X(stage_instance_delete, "STAGE_INSTANCE_DELETE", intents::guilds)                             \
+    X(guild_member_add, "GUILD_MEMBER_ADD", intents::guild_members)                                \
+    X(guild_member_update, "GUILD_MEMBER_UPDATE", intents::guild_members)                          \
+    X(guild_member_remove, "GUILD_MEMBER_REMOVE", intents::guild_members)                          \
+    X(guild_ban_add, "GUILD_BAN_ADD", intents::guild_moderation)                                   \
+    X(guild_ban_remove, "GUILD_BAN_REMOVE", intents::guild_moderation)                             \
+    X(guild_emojis_update, "GUILD_EMOJIS_UPDATE", intents::guild_emojis)                           \
+    X(guild_stickers_update, "GUILD_STICKERS_UPDATE", intents::guild_emojis)                       \
+    X(guild_integrations_update, "GUILD_INTEGRATIONS_UPDATE", intents::guild_integrations)         \
+    X(integration_create, "INTEGRATION_CREATE", intents::guild_integrations)                       \
+    X(integration_update, "INTEGRATION_UPDATE", intents::guild_integrations)                       \
+    X(integration_delete, "INTEGRATION_DELETE", intents::guild_integrations)                       \
+    X(webhooks_update, "WEBHOOKS_UPDATE", intents::guild_webhooks)                                 \
+    X(invite_create, "INVITE_CREATE", intents::guild_invites)                                      \
+    X(invite_delete, "INVITE_DELETE", intents::guild_invites)                                      \
+    X(voice_state_update, "VOICE_STATE_UPDATE", intents::guild_voice_states)                       \
+    X(presence_update, "PRESENCE_UPDATE", intents::guild_presences)                                \
+    X(message_create, "MESSAGE_CREATE", intents::guild_messages | intents::direct_messages)        \
+    X(message_update, "MESSAGE_UPDATE", intents::guild_messages | intents::direct_messages)        \
+    X(message_delete, "MESSAGE_DELETE", intents::guild_messages | intents::direct_messages)        \
+    X(message_delete_bulk, "MESSAGE_DELETE_BULK", intents::guild_messages)                         \
+    X(message_reaction_add,                                                                        \
+      "MESSAGE_REACTION_ADD",                                                                      \
+      intents::guild_message_reactions | intents::direct_message_reactions)                        \
+    X(message_reaction_remove,                                                                     \
+      "MESSAGE_REACTION_REMOVE",                                                                   \
+      intents::guild_message_reactions | intents::direct_message_reactions)                        \
+    X(message_reaction_remove_all,                                                                 \
+      "MESSAGE_REACTION_REMOVE_ALL",                                                               \
+      intents::guild_message_reactions | intents::direct_message_reactions)                        \
+    X(message_reaction_remove_emoji,                                                               \
+      "MESSAGE_REACTION_REMOVE_EMOJI",                                                             \
+      intents::guild_message_reactions | intents::direct_message_reactions)                        \
+    X(typing_start,                                                                                \
+      "TYPING_START",                                                                              \
+      intents::guild_message_typing | intents::direct_message_typing)                              \
+    X(guild_scheduled_event_create,                                                                \
+      "GUILD_SCHEDULED_EVENT_CREATE",                                                              \
+      intents::guild_scheduled_events)                                                             \
+    X(guild_scheduled_event_update,                                                                \
+      "GUILD_SCHEDULED_EVENT_UPDATE",                                                              \
+      intents::guild_scheduled_events)                                                             \
+    X(guild_scheduled_event_delete,                                                                \
+      "GUILD_SCHEDULED_EVENT_DELETE",                                                              \
+      intents::guild_scheduled_events)                                                             \
+    X(auto_moderation_rule_create, "AUTO_MODERATION_RULE_CREATE", intents::auto_moderation)        \
+    X(auto_moderation_rule_update, "AUTO_MODERATION_RULE_UPDATE", intents::auto_moderation)        \
+    X(auto_moderation_rule_delete, "AUTO_MODERATION_RULE_DELETE", intents::auto_moderation)        \
+    X(auto_moderation_action_execution,                                                            \
+      "AUTO_MODERATION_ACTION_EXECUTION",                                                          \
+      intents::auto_moderation)
+
+namespace discord
+{
+    enum class Event : u8
+    {
+#define X(id, name, intents) id,
+        DISCORD_EVENTS(X)
+#undef X
+          count
+    };
+
+    // The Event named 'name', nullopt for one not listed above
+    std::optional<Event> event_of(std::string_view name) noexcept;
+    std::string_view     name_of(Event event) noexcept;
+
+    // A set of Events, for subscribing to
+    class EventMask
+    {
+    public:
+        EventMask() = default;
+        EventMask(std::initializer_list<Event> events)
+        {
+            for (auto event : events) add(event);
+        }
+
+        // Every listed event, and anything not listed too
+        static EventMask all()
+        {
+            EventMask mask;
+            mask.bits.set();
+            mask.unlisted = true;
+            return mask;
+        }
+
+        void add(Event event) noexcept { bits.set((size_t) event); }
+        bool contains(Event event) const noexcept { return bits.test((size_t) event); }
+        // An event type by name, as it comes in a dispatch's "t"
+        bool contains(std::string_view name) const noexcept
+        {
+            auto event = event_of(name);
+            return event ? contains(*event) : unlisted;
+        }
+
+        // What Identify needs to ask for to get these, privileged intents aside
+        u32 intents() const noexcept;
+
+    private:
+        std::bitset<(size_t) Event::count> bits;
+        bool                               unlisted = false;
+    };
+}    // namespace discord
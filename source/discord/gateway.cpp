@@ -1,4 +1,5 @@
 #include "gateway.h"
+#include "scan.h"
 #include "util/types.h"
 
 #include <chrono>
@@ -37,21 +38,49 @@ namespace
 
 bool discord::Gateway::connected()
 {
-    return ws.connected;
+    // A zombied or overflowed connection is as good as reconnecting
+    return ws.connected || zombie || ws.overflowed;
 }
 
-void discord::Gateway::close()
+void discord::Gateway::set_inbound_limit(WebSocket::InboundLimit limit)
 {
-    nlohmann::json json;
-    json["session_id"]   = session_id;
-    json["prev_seqnum"]  = prev_seqnum.load();
-    std::string json_str = json.dump(-1);
+    // Frequent, and of no use to the bot or the cache
+    static const EventMask low_priority { Event::typing_start,
+                                          Event::presence_update,
+                                          Event::message_reaction_add,
+                                          Event::message_reaction_remove };
+    limit.droppable = [](const WebSocket::IFrame &frame)
+    {
+        auto envelope = scan::envelope(
+          std::string_view((char *) frame.payload_data.get(), frame.payload_length));
+        return envelope.op == (i32) Opcodes::Dispatch && low_priority.contains(envelope.t);
+    };
+    ws.set_inbound_limit(std::move(limit));
+}
 
-    std::ofstream file;
-    file.open("./gcache.json");
-    file.write(json_str.data(), json_str.size());
-    file.flush();
-    file.close();
+discord::Gateway::~Gateway()
+{
+    // The registry outlives us, and scrapes come from its own thread
+    metrics::registry().remove_fn("websocket_inbound_queue_depth", this);
+    metrics::registry().remove_fn("websocket_outbound_queue_depth", this);
+}
+
+void discord::Gateway::close()
+{
+    if (!replaying)
+    {
+        nlohmann::json json;
+        json["session_id"]   = session_id;
+        json["prev_seqnum"]  = prev_seqnum.load();
+        std::string json_str = json.dump(-1);
+
+        std::ofstream file;
+        file.open("./gcache.json");
+        file.write(json_str.data(), json_str.size());
+        file.flush();
+        file.close();
+    }
+    if (recorder) recorder->flush();
 
     ws.close();
 
@@ -72,28 +101,51 @@ int discord::Gateway::connect(std::string_view bot_token)
     nlohmann::json json;
 
     this->bot_token = bot_token;
+
+    metrics::registry().describe(
+      "gateway_heartbeat_rtt_microseconds",
+      "Time from sending a heartbeat to its HeartbeatACK");
+    metrics::registry().describe(
+      "gateway_dispatch_latency_microseconds",
+      "Time from a frame arriving to its event being handed to the bot");
+    metrics::registry().gauge_fn(
+      "websocket_inbound_queue_depth",
+      [this] { return (i64) ws.iqueue_sizeapprox(); },
+      this);
+    metrics::registry().gauge_fn(
+      "websocket_outbound_queue_depth",
+      [this] { return (i64) ws.oqueue_sizeapprox(); },
+      this);
     {
-        auto res = cpr::Get(
-          cpr::Url { "https://discord.com/api/gateway/bot" },
-          cpr::Header { { "Authorization", std::string("Bot ") + bot_token.data() } },
-          cpr::VerifySsl(false));
-        if (res.error)
+        std::string ws_url = gateway_url;
+        if (ws_url.empty())
         {
-            std::cerr << "GetGatewayBot failed with error code " << (u16) res.error.code << ": "
-                      << res.error.message << "\n";
-            return -1;
-        }
-
-        if (res.header["content-type"] != "application/json")
-            std::__throw_runtime_error("content-type unknown");
+            static auto &latency = metrics::registry().histogram(
+              "rest_request_duration_microseconds",
+              "route=\"GET /gateway/bot\"");
+            metrics::Timer timer(latency);
+
+            auto res = cpr::Get(
+              cpr::Url { api_url + "/gateway/bot" },
+              cpr::Header { { "Authorization", std::string("Bot ") + bot_token.data() } },
+              cpr::VerifySsl(false));
+            if (res.error)
+            {
+                std::cerr << "GetGatewayBot failed with error code " << (u16) res.error.code
+                          << ": " << res.error.message << "\n";
+                return -1;
+            }
 
-        json = nlohmann::json::parse(res.text);
+            if (res.header["content-type"] != "application/json")
+                std::__throw_runtime_error("content-type unknown");
 
-        std::string ws_url = json["url"].get<std::string>();
+            json   = nlohmann::json::parse(res.text);
+            ws_url = json["url"].get<std::string>();
+        }
         if (ws_url.back() != '/') ws_url.push_back('/');
         ws_url.append("?v=9&encoding=json");    // &compress?=zlib-stream
 
-        ws = WebSocket(ws_url);
+        ws.connect(ws_url);
     }
 
     /* TODO: Zlib Compression
@@ -105,8 +157,6 @@ int discord::Gateway::connect(std::string_view bot_token)
     ACK         = true;
     resume      = false;
 
-    u64 interval;
-
     if (std::filesystem::exists("./gcache.json"))
     {
         resume = true;
@@ -125,16 +175,40 @@ int discord::Gateway::connect(std::string_view bot_token)
         prev_seqnum = json["prev_seqnum"];
     }
 
+    return handshake();
+}
+
+int discord::Gateway::replay(const std::string &path, bool realtime)
+{
+    replaying   = true;
+    prev_seqnum = (u64) -1;
+    ACK         = true;
+    resume      = false;
+
+    ws.replay(path, realtime);
+    return handshake();
+}
+
+bool discord::Gateway::record(const std::string &path)
+{
+    recorder = std::make_unique<Recorder>(path);
+    return recorder->is_open();
+}
+
+int discord::Gateway::handshake()
+{
+    u64 interval;
+
     while (ws.connected || ws.iqueue_sizeapprox() != 0)
     {
-        while (ws.iqueue_sizeapprox() == 0 && ws.connected)
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        auto inbound = ws.dump_iqueue();
+        while (ws.iqueue_sizeapprox() == 0 && ws.connected) ws.wait_iqueue(100);
+        size_t count = drain();
 
         bool gateway_success = false;
 
-        for (auto &frame : inbound)
+        for (size_t i = 0; i < count; i++)
         {
+            auto &frame = inbound[i];
             if (frame.opcode == WebSocket::Opcode::ping)
                 ws.send_frame(
                   WebSocket::Opcode::pong,
@@ -150,33 +224,43 @@ int discord::Gateway::connect(std::string_view bot_token)
 
             std::string_view str =
               std::string_view((char *) frame.payload_data.get(), frame.payload_length);
-            json = nlohmann::json::parse(str);
+            auto envelope = scan::envelope(str);
 
-            if (json.find("op") == json.end())
+            if (envelope.op < 0)
             {
                 std::cerr << "OP does not exist in JSON. Suspected failure\n";
                 ws.close();
                 break;
             }
-            u64 op = json["op"].get<u64>();
+            u64 op = envelope.op;
 
             switch (op)
             {
             case (u16) Opcodes::Dispatch:
             {
-                std::string    event_name = json["t"].get<std::string>();
-                nlohmann::json event_data = json["d"];
-                prev_seqnum               = json["s"].get<u64>();
-
-                next_events.push({ event_name, event_data });
-
-                if (event_name == "READY" || event_name == "RESUMED")
+                prev_seqnum = envelope.s;
+                if (envelope.t == "READY" || envelope.t == "RESUMED")
                 {
-                    if (event_name == "READY")
-                        session_id = event_data["session_id"].get<std::string>();
-                    std::thread(&discord::Gateway::heartbeat, this, interval).detach();
+                    if (envelope.t == "READY")
+                        session_id = scan::string(scan::field(envelope.d, "session_id"));
+                    if (!replaying)
+                        std::thread(
+                          &discord::Gateway::heartbeat,
+                          this,
+                          interval,
+                          ++heartbeat_generation)
+                          .detach();
                     gateway_success = true;
                 }
+                if (!wanted(envelope.t, envelope.d)) break;
+
+                event next;
+                next.name        = envelope.t;
+                next.raw         = envelope.d;
+                next.received_us = frame.received_us;
+                next.payload     = std::move(frame.payload_data);
+                count_event(next.name);
+                next_events.push(std::move(next));
             }
             break;
             case (u16) Opcodes::Heartbeat:
@@ -188,35 +272,23 @@ int discord::Gateway::connect(std::string_view bot_token)
                     send += std::to_string(prev_seqnum);
                 send += "}\n";
 
+                heartbeat_sent_us = metrics::now_us();
                 ws.send_frame(WebSocket::Opcode::text_frame, (u8 *) send.data(), send.size());
             }
             break;
             case (u16) Opcodes::Hello:
             {
-                if (json["d"].find("heartbeat_interval") == json["d"].end())
+                auto heartbeat_interval = scan::field(envelope.d, "heartbeat_interval");
+                if (heartbeat_interval.empty())
                 {
                     std::cerr << "Heartbeat_interval does not exist. Suspected failure\n";
                     ws.close();
                     break;
                 }
-                interval = json["d"]["heartbeat_interval"].get<u64>();
+                interval = scan::integer(heartbeat_interval);
 
                 if (!resume)
-                {
-                    // TODO: OS detection
-                    std::string identify = "{\"op\":2,\"d\":{\"token\":\"";
-                    identify += bot_token;
-                    identify +=
-                      "\",\"intents\":23041,\"compress\":false,\"properties\":{\"$os\":"
-                      "\"windows\",\"$browser\":\"GLSbot\",\"$device\":\"GLSbot\"}}}";
-
-                    ws.send_frame(
-                      WebSocket::Opcode::text_frame,
-                      (u8 *) identify.data(),
-                      identify.size());
-
-                    resume = true;
-                }
+                    identify();
                 else
                 {
                     std::string resume = "{\"op\":6,\"d\":{\"token\":\"";
@@ -239,7 +311,7 @@ int discord::Gateway::connect(std::string_view bot_token)
             break;
             case (u16) Opcodes::InvalidSession:
             {
-                if (json["d"].get<bool>())    // Unlikely
+                if (scan::boolean(envelope.d))    // Unlikely
                 {
                     std::string resume = "{\"op\":6,\"d\":{\"token\":\"";
                     resume += bot_token;
@@ -258,28 +330,14 @@ int discord::Gateway::connect(std::string_view bot_token)
                       resume.size());
                 }
                 else
-                {
-                    // TODO: OS detection
-                    std::string identify = "{\"op\":2,\"d\":{\"token\":\"";
-                    identify += bot_token;
-                    identify +=
-                      "\",\"intents\":23041,\"compress\":false,\"properties\":{\"$os\":"
-                      "\"windows\",\"$browser\":\"GLSbot\",\"$device\":\"GLSbot\"}}}";
-
-                    ws.send_frame(
-                      WebSocket::Opcode::text_frame,
-                      (u8 *) identify.data(),
-                      identify.size());
-
-                    resume = true;
-                }
+                    identify();
             }
             break;
-            case (u16) Opcodes::HeartbeatACK: ACK = true; break;
+            case (u16) Opcodes::HeartbeatACK: acknowledge(); break;
             default:
             {
                 std::cout << "Unimplemented opcode in connect: " << op << "\n";
-                std::cout << "json dump:" << json.dump(-1) << "\n";
+                std::cout << "json dump:" << str << "\n";
                 return -1;
             }
             break;
@@ -292,18 +350,45 @@ int discord::Gateway::connect(std::string_view bot_token)
 
 int discord::Gateway::get_incoming()
 {
-    nlohmann::json json;
-    int            incoming = 0;
+    // Once, as it takes the registry's lock and this is per event
+    [[maybe_unused]] static const bool described = []
+    {
+        metrics::registry().describe(
+          "gateway_events_filtered_total",
+          "Dispatches dropped unparsed for being of a type nothing subscribed to");
+        metrics::registry().describe(
+          "gateway_events_rejected_total",
+          "Dispatches dropped unparsed by the filter on their type, e.g. messages that aren't "
+          "commands");
+        return true;
+    }();
+
+    int incoming = 0;
 
     if (!next_events.empty()) return next_events.size();
 
     while (ws.iqueue_sizeapprox() == 0 && ws.connected)
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    if (!ws.connected) return 0;
-    auto inbound = ws.dump_iqueue();
+    {
+        // Back to the caller with nothing, for whatever they woke us for
+        if (!ws.wait_iqueue(100, true) && ws.take_wake()) return 0;
+    }
+    // What an overflow left queued is still good, and is that much less for the resume to replay
+    bool backlog = ws.overflowed && ws.iqueue_sizeapprox() > 0;
+    if (!ws.connected && !backlog)
+    {
+        // The heartbeat thread hangs up on a zombied connection and the reader on a full queue,
+        // but reconnecting happens here as this is the thread that owns 'inbound' and
+        // 'next_events'. It resumes, so whatever was left unread is sent again
+        bool lost = zombie.exchange(false);
+        lost |= ws.overflowed.exchange(false);
+        if (lost && reconnect()) return next_events.size();
+        return 0;
+    }
+    size_t count = drain();
 
-    for (auto &frame : inbound)
+    for (size_t i = 0; i < count; i++)
     {
+        auto &frame = inbound[i];
         if (frame.opcode == WebSocket::Opcode::ping)
             ws.send_frame(WebSocket::Opcode::pong, frame.payload_data.get(), frame.payload_length);
         if (frame.opcode == WebSocket::Opcode::connection_close)
@@ -311,21 +396,22 @@ int discord::Gateway::get_incoming()
             std::cout << "oh no\n";
             dump_buffer(frame.payload_length, frame.payload_data.get());
             close();
+            return 0;
         }
         if (frame.opcode != WebSocket::Opcode::text_frame) continue;
 
         std::string_view str =
           std::string_view((char *) frame.payload_data.get(), frame.payload_length);
         // std::cout << str << "\n";
-        json = nlohmann::json::parse(str);
+        auto envelope = scan::envelope(str);
 
-        if (json.find("op") == json.end())
+        if (envelope.op < 0)
         {
             std::cerr << "OP does not exist in JSON. Suspected failure\n";
             ws.close();
             break;
         }
-        u16 op = json["op"].get<u16>();
+        u16 op = envelope.op;
 
         switch (op)
         {
@@ -338,43 +424,43 @@ int discord::Gateway::get_incoming()
                 send += std::to_string(prev_seqnum);
             send += "}\n";
 
+            heartbeat_sent_us = metrics::now_us();
             ws.send_frame(WebSocket::Opcode::text_frame, (u8 *) send.data(), send.size());
         }
         break;
         case (u16) Opcodes::Dispatch:
         {
-            std::string    event_name = json["t"].get<std::string>();
-            nlohmann::json event_data = json["d"];
-            prev_seqnum               = json["s"].get<u64>();
-
-            if (event_name == "Reconnect")
+            // Counted in the sequence all the same, so a resume doesn't have them sent again
+            prev_seqnum = envelope.s;
+            if (!wanted(envelope.t, envelope.d)) break;
+
+            event next;
+            next.name        = envelope.t;
+            next.raw         = envelope.d;
+            next.received_us = frame.received_us;
+            next.payload     = std::move(frame.payload_data);
+            count_event(next.name);
+
+            if (next.name == "Reconnect")
             {
-                close();
-                connect(bot_token);
+                if (reconnect()) return next_events.size();
                 break;
             }
 
-            next_events.push({ event_name, event_data });
+            next_events.push(std::move(next));
             incoming++;
         }
         break;
+        case (u8) Opcodes::HeartbeatACK: acknowledge(); break;
         case (u16) Opcodes::InvalidSession:
-        {
-            close();
-            connect(bot_token);
-        }
-        break;
-        case (u8) Opcodes::HeartbeatACK: ACK = true; break;
         case (u8) Opcodes::Reconnect:
-        {
-            close();
-            connect(bot_token);
-        }
-        break;
+            // connect() refills 'inbound' and close() drops pending events, so this batch is over
+            if (reconnect()) return next_events.size();
+            break;
         default:
         {
             std::cout << "Unimplemented opcode in get_incoming: " << op << "\n";
-            std::cout << "json dump:" << json.dump(-1) << "\n";
+            std::cout << "json dump:" << str << "\n";
         }
         break;
         }
@@ -382,10 +468,101 @@ int discord::Gateway::get_incoming()
     return incoming;
 }
 
+bool discord::Gateway::wanted(std::string_view name, std::string_view raw)
+{
+    static auto &filtered = metrics::registry().counter("gateway_events_filtered_total");
+    static auto &rejected = metrics::registry().counter("gateway_events_rejected_total");
+
+    auto event = event_of(name);
+    if (event ? !subscriptions.contains(*event) : !subscriptions.contains(name))
+    {
+        filtered.add();
+        return false;
+    }
+    if (event && filters[(size_t) *event] && !filters[(size_t) *event](raw))
+    {
+        rejected.add();
+        return false;
+    }
+    return true;
+}
+
+u32 discord::Gateway::intents() const noexcept
+{
+    return configured_intents ? configured_intents : subscriptions.intents();
+}
+
+void discord::Gateway::identify()
+{
+    // TODO: OS detection
+    std::string identify = fmt::format(
+      "{{\"op\":2,\"d\":{{\"token\":\"{}\",\"intents\":{},\"compress\":false,"
+      "\"properties\":{{\"$os\":\"windows\",\"$browser\":\"GLSbot\",\"$device\":"
+      "\"GLSbot\"}}}}}}",
+      bot_token,
+      intents());
+
+    ws.send_frame(WebSocket::Opcode::text_frame, (u8 *) identify.data(), identify.size());
+    resume = true;
+}
+
+bool discord::Gateway::reconnect()
+{
+    // A recording just carries on with the next connection's frames
+    if (replaying) return false;
+
+    close();
+    connect(bot_token);
+    return true;
+}
+
+void discord::Gateway::acknowledge()
+{
+    static auto &rtt = metrics::registry().histogram("gateway_heartbeat_rtt_microseconds");
+
+    ACK      = true;
+    u64 sent = heartbeat_sent_us.exchange(0);
+    if (sent == 0) return;
+    heartbeat_rtt_us = metrics::now_us() - sent;
+    rtt.record(heartbeat_rtt_us);
+}
+
+void discord::Gateway::count_event(const std::string &name)
+{
+    auto it = event_counters.find(name);
+    if (it == event_counters.end())
+        it = event_counters
+               .emplace(
+                 name,
+                 &metrics::registry().counter(
+                   "gateway_events_total",
+                   fmt::format("type=\"{}\"", name)))
+               .first;
+    it->second->add();
+}
+
+size_t discord::Gateway::drain()
+{
+    // Let go of whatever the last batch didn't hand off to an event
+    for (auto &frame : inbound) frame.payload_data.reset();
+
+    size_t count = ws.dump_iqueue(inbound.data(), inbound.size());
+    if (recorder)
+        for (size_t i = 0; i < count; i++) recorder->write(inbound[i]);
+    return count;
+}
+
 discord::Gateway::event discord::Gateway::next_event()
 {
-    auto event = next_events.front();
+    static auto &dispatch_latency =
+      metrics::registry().histogram("gateway_dispatch_latency_microseconds");
+    static auto &pending = metrics::registry().gauge("gateway_pending_events");
+
+    auto event = std::move(next_events.front());
     next_events.pop();
+
+    dispatch_latency.record(metrics::now_us() - event.received_us);
+    pending.set(next_events.size());
     return event;
 }
 
@@ -395,21 +572,22 @@ void discord::Gateway::send_event(send_opcodes op, std::string_view json)
     ws.send_frame(WebSocket::Opcode::text_frame, (u8 *) send.data(), send.size());
 }
 
-void discord::Gateway::heartbeat(u64 interval)
+void discord::Gateway::heartbeat(u64 interval, u64 generation)
 {
     std::this_thread::sleep_for(
       std::chrono::milliseconds(u64(interval * (::rand() * 1.0 / RAND_MAX))));
     auto        sleep = std::chrono::high_resolution_clock::now();
     std::string send;
-    while (ws.connected)
+    // A reconnect starts a new heartbeat thread, which retires this one
+    while (ws.connected && generation == heartbeat_generation)
     {
         send.clear();
 
         if (!ACK)
         {
             std::cerr << "ACK not recieved. Reconnecting\n";
-            disconnect(4009);
-            connect(bot_token);
+            zombie = true;
+            ws.close();
             return;
         }
         ACK = false;
@@ -420,6 +598,7 @@ void discord::Gateway::heartbeat(u64 interval)
         else
             send += std::to_string(prev_seqnum);
         send += "}";
+        heartbeat_sent_us = metrics::now_us();
         ws.send_frame(WebSocket::Opcode::text_frame, (u8 *) send.data(), send.size());
 
         auto last = std::chrono::system_clock::now();
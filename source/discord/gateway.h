@@ -1,13 +1,21 @@
 #pragma once
 
+#include <array>
+#include <functional>
 #include <string_view>
 #include <queue>
 #include <atomic>
+#include <memory>
+#include <optional>
+#include <unordered_map>
 
 #include "util/types.h"
+#include "util/metrics.h"
 #include "websocket/ws.h"
-
-#include <json/json.hpp>
+#include "websocket/recording.h"
+#include "discord/events.h"
+#include "discord/json.h"
+#include "discord/views.h"
 
 namespace discord
 {
@@ -16,8 +24,29 @@ namespace discord
     public:
         struct event
         {
-            std::string    name;
-            nlohmann::json data;
+            std::string      name;
+            std::string_view raw;    // Unparsed 'd', points into the frame payload
+            u64              received_us;
+
+            // Parsed on first use, so events that are only scanned never build a DOM.
+            // Nodes come from the active Arena, so don't let this outlive its Scope
+            json &data()
+            {
+                if (!parsed) parsed = json::parse(raw.empty() ? "null" : raw);
+                return *parsed;
+            }
+            // A typed view of 'raw' (see views.h), e.g. as<MessageCreate>(). Nothing is parsed
+            template<typename View>
+            View as() const noexcept
+            {
+                return View(raw);
+            }
+
+        private:
+            friend class Gateway;
+
+            BufferPool::Buffer  payload;
+            std::optional<json> parsed;
         };
 
         enum send_opcodes : u8
@@ -28,23 +57,73 @@ namespace discord
         };
 
         Gateway() = default;
+        ~Gateway();
 
         int connect(std::string_view bot_token);
+        // Connect here instead of asking GET /gateway/bot, e.g. to use a mock gateway
+        void set_url(std::string url) { gateway_url = std::move(url); }
+        // Where GET /gateway/bot is asked, https://discord.com/api by default
+        void set_api_url(std::string url) { api_url = std::move(url); }
+        // How many frames may wait for get_incoming(), and what happens past that. Dropping
+        // only ever drops events nothing here reads; disconnecting resumes the session, so
+        // Discord replays the backlog once there is room for it. Before connect()
+        void set_inbound_limit(WebSocket::InboundLimit limit);
+        // Dispatches of any other type are dropped as soon as their type is known, before
+        // they're parsed or queued, and Identify asks only for the intents these need. All of
+        // them by default
+        void subscribe(EventMask events) { subscriptions = events; }
+        // Asked about each subscribed 'event' with its raw 'd', before it's parsed or queued.
+        // Those it returns false for are dropped there and then, e.g. messages that aren't
+        // commands. On the thread calling get_incoming()
+        void set_filter(Event event, std::function<bool(std::string_view raw)> filter)
+        {
+            filters[(size_t) event] = std::move(filter);
+        }
+        // In place of the intents the subscriptions need, e.g. for privileged ones. 0 to
+        // derive them again
+        void set_intents(u32 intents) { configured_intents = intents; }
+        u32  intents() const noexcept;
+
+        // Plays a recording in place of a connection. No heartbeats, reconnects or session
+        // file, so the bot can be run offline against captured traffic
+        int replay(const std::string &path, bool realtime);
+        // Appends every inbound frame, from here on and across reconnects, to 'path'
+        bool record(const std::string &path);
 
+        // Waits for frames, and returns how many events came of them. 0 once disconnected,
+        // or when woken
         int   get_incoming();
         event next_event();
         void  send_event(send_opcodes op, std::string_view json);
 
+        // Ends a wait in get_incoming() early, from any thread
+        void wake() { ws.wake(); }
+
         bool connected();
         void close();
         void disconnect(u16 op = 1001);
 
+        // Round trip of the last acknowledged heartbeat. 0 until the first ACK
+        u64 latency_us() const noexcept { return heartbeat_rtt_us; }
+
     private:
         WebSocket ws;
         bool      resume;
+        bool      replaying = false;
+
+        std::unique_ptr<Recorder> recorder;
+
+        EventMask subscriptions      = EventMask::all();
+        u32       configured_intents = 0;
+
+        std::array<std::function<bool(std::string_view)>, (size_t) Event::count> filters;
+        // Whether a dispatch gets queued, by subscription and filter
+        bool wanted(std::string_view name, std::string_view raw);
 
         std::string_view bot_token;
         std::string      session_id;
+        std::string      gateway_url;
+        std::string      api_url = "https://discord.com/api";
 
         enum class Opcodes : u8
         {
@@ -61,9 +140,25 @@ namespace discord
 
         std::atomic_uint64_t prev_seqnum;
         std::atomic_bool     ACK;
+        std::atomic_bool     zombie { false };    // No ACK came, reconnect on the next poll
+        std::atomic_uint64_t heartbeat_generation { 0 };
+
+        std::atomic_uint64_t heartbeat_sent_us { 0 };
+        std::atomic_uint64_t heartbeat_rtt_us { 0 };
+        void                 acknowledge();
+
+        std::unordered_map<std::string, metrics::Counter *> event_counters;
+        void                                                count_event(const std::string &name);
 
         std::queue<event> next_events;
 
-        void heartbeat(u64 interval);
+        // Reused for every drain of the WebSocket's queue
+        std::array<WebSocket::IFrame, 64> inbound;
+        size_t                            drain();
+
+        int  handshake();
+        void identify();
+        bool reconnect();    // False when there is nothing to reconnect to
+        void heartbeat(u64 interval, u64 generation);
     };
 }    // namespace discord
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "util/arena.h"
+#include "util/types.h"
+
+#include <json/json.hpp>
+
+namespace discord
+{
+    // nlohmann::json whose nodes and strings come from the thread's active Arena,
+    // so a parsed event is one bump-pointer run instead of hundreds of mallocs
+    using json = nlohmann::basic_json<
+      std::map,
+      std::vector,
+      std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>,
+      bool,
+      i64,
+      u64,
+      double,
+      ArenaAllocator>;
+}    // namespace discord
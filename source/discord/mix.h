@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// Kernels for mixing float PCM, 8 or 4 samples at a time where the target has AVX or SSE.
+// -march=native picks the widest there is; the scalar loops finish off the tails.
+namespace discord::mix
+{
+    // out = in * gain
+    inline void scale(float *out, const float *in, float gain, size_t n) noexcept
+    {
+        size_t i = 0;
+#if defined(__AVX__)
+        __m256 g8 = _mm256_set1_ps(gain);
+        for (; i < (n & ~size_t(7)); i += 8)
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(in + i), g8));
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+        __m128 g4 = _mm_set1_ps(gain);
+        for (; i < (n & ~size_t(3)); i += 4)
+            _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i), g4));
+#endif
+        for (; i < n; i++) out[i] = in[i] * gain;
+    }
+
+    // out += in * gain
+    inline void accumulate(float *out, const float *in, float gain, size_t n) noexcept
+    {
+        size_t i = 0;
+#if defined(__AVX__)
+        __m256 g8 = _mm256_set1_ps(gain);
+        for (; i < (n & ~size_t(7)); i += 8)
+        {
+            __m256 sum = _mm256_add_ps(
+              _mm256_loadu_ps(out + i),
+              _mm256_mul_ps(_mm256_loadu_ps(in + i), g8));
+            _mm256_storeu_ps(out + i, sum);
+        }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+        __m128 g4 = _mm_set1_ps(gain);
+        for (; i < (n & ~size_t(3)); i += 4)
+        {
+            __m128 sum = _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), g4));
+            _mm_storeu_ps(out + i, sum);
+        }
+#endif
+        for (; i < n; i++) out[i] += in[i] * gain;
+    }
+
+    // Clamps to [-1, 1], where a sum of sources can overshoot. Opus would take it, but
+    // whoever decodes to 16 bit would wrap
+    inline void saturate(float *samples, size_t n) noexcept
+    {
+        size_t i = 0;
+#if defined(__AVX__)
+        __m256 hi8 = _mm256_set1_ps(1.0f), lo8 = _mm256_set1_ps(-1.0f);
+        for (; i < (n & ~size_t(7)); i += 8)
+        {
+            __m256 x = _mm256_loadu_ps(samples + i);
+            _mm256_storeu_ps(samples + i, _mm256_max_ps(lo8, _mm256_min_ps(hi8, x)));
+        }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+        __m128 hi4 = _mm_set1_ps(1.0f), lo4 = _mm_set1_ps(-1.0f);
+        for (; i < (n & ~size_t(3)); i += 4)
+        {
+            __m128 x = _mm_loadu_ps(samples + i);
+            _mm_storeu_ps(samples + i, _mm_max_ps(lo4, _mm_min_ps(hi4, x)));
+        }
+#endif
+        for (; i < n; i++)
+            samples[i] = samples[i] > 1.0f ? 1.0f : samples[i] < -1.0f ? -1.0f : samples[i];
+    }
+}    // namespace discord::mix
@@ -0,0 +1,80 @@
+#include "prefixes.h"
+
+#include <fmt/format.h>
+
+#include "discord/scan.h"
+
+namespace
+{
+    inline bool valid(std::string_view prefix) noexcept
+    {
+        return !prefix.empty() && prefix.find_first_of("\"\\") == std::string_view::npos;
+    }
+
+    inline bool starts_with(std::string_view str, std::string_view prefix) noexcept
+    {
+        return str.size() >= prefix.size() && str.compare(0, prefix.size(), prefix) == 0;
+    }
+}    // namespace
+
+bool discord::CommandPrefixes::set_default(std::string_view prefix)
+{
+    if (!valid(prefix)) return false;
+    default_prefix = prefix;
+    update_first();
+    return true;
+}
+
+bool discord::CommandPrefixes::set_guild(snowflake guild_id, std::string_view prefix)
+{
+    if (!valid(prefix)) return false;
+    guild_prefixes[guild_id] = prefix;
+    update_first();
+    return true;
+}
+
+void discord::CommandPrefixes::set_mention(snowflake user_id)
+{
+    mention      = user_id ? fmt::format("<@{}>", user_id) : "";
+    nick_mention = user_id ? fmt::format("<@!{}>", user_id) : "";
+    update_first();
+}
+
+size_t discord::CommandPrefixes::match(snowflake guild_id, std::string_view content) const noexcept
+{
+    if (content.empty() || !first.test((u8) content[0])) return 0;
+
+    if (!mention.empty())
+        for (auto &prefix : { std::string_view(mention), std::string_view(nick_mention) })
+            if (starts_with(content, prefix))
+            {
+                size_t end = content.find_first_not_of(' ', prefix.size());
+                // A mention with nothing after it is only a mention
+                return end == std::string_view::npos ? 0 : end;
+            }
+
+    std::string_view prefix = default_prefix;
+    if (guild_id != 0 && !guild_prefixes.empty())
+        if (auto it = guild_prefixes.find(guild_id); it != guild_prefixes.end())
+            prefix = it->second;
+    return starts_with(content, prefix) ? prefix.size() : 0;
+}
+
+size_t discord::CommandPrefixes::match(std::string_view message) const noexcept
+{
+    auto content = scan::string(scan::field(message, "content"));
+    if (content.empty() || !first.test((u8) content[0])) return 0;
+
+    // Only worth the scan for it if a guild has a prefix of its own
+    snowflake guild_id = 0;
+    if (!guild_prefixes.empty()) guild_id = scan::integer(scan::field(message, "guild_id"));
+    return match(guild_id, content);
+}
+
+void discord::CommandPrefixes::update_first()
+{
+    first.reset();
+    first.set((u8) default_prefix[0]);
+    for (auto &[_, prefix] : guild_prefixes) first.set((u8) prefix[0]);
+    if (!mention.empty()) first.set('<');
+}
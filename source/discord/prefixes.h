@@ -0,0 +1,46 @@
+#pragma once
+
+#include <bitset>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "discord/snowflake.h"
+#include "util/types.h"
+
+namespace discord
+{
+    // Tells commands from everything else by the start of a message's content, straight off
+    // the raw MESSAGE_CREATE: nothing is parsed or allocated, and most messages are turned away
+    // on their first byte. Prefixes are compared with content as Discord sends it, escapes and
+    // all, so they can't have quotes or backslashes in them
+    class CommandPrefixes
+    {
+    public:
+        CommandPrefixes() { set_default("!"); }
+
+        // Setters return false for a prefix that can't be one
+        bool set_default(std::string_view prefix);
+        // In place of the default, in that guild
+        bool set_guild(snowflake guild_id, std::string_view prefix);
+        // A mention of this user (the bot) then works as a prefix everywhere too. 0 for none
+        void set_mention(snowflake user_id);
+
+        // Length of the prefix 'content' starts with, spaces after a mention included. 0 if it
+        // isn't a command. 'guild_id' is 0 in DMs
+        size_t match(snowflake guild_id, std::string_view content) const noexcept;
+        // The same, for the raw 'd' of a MESSAGE_CREATE
+        size_t match(std::string_view message) const noexcept;
+
+    private:
+        std::string                               default_prefix;
+        std::unordered_map<snowflake, std::string> guild_prefixes;
+        std::string                               mention;         // <@id>
+        std::string                               nick_mention;    // <@!id>, the older form
+
+        // First bytes of every prefix, for turning most messages away without a lookup
+        std::bitset<256> first;
+
+        void update_first();
+    };
+}    // namespace discord
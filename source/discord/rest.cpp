@@ -0,0 +1,268 @@
+#include "rest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+#include <fmt/format.h>
+
+#include "discord/scan.h"
+#include "util/metrics.h"
+
+namespace
+{
+    constexpr int max_attempts = 5;    // 429s in a row before a request is given up on
+
+    // Discord gives rate limit durations in seconds, with a fraction
+    inline u64 seconds_to_us(std::string_view seconds)
+    {
+        if (seconds.empty()) return 0;
+        return (u64) (std::strtod(std::string(seconds).c_str(), nullptr) * 1e6);
+    }
+
+    inline std::string_view header(const cpr::Response &response, const char *name)
+    {
+        auto it = response.header.find(name);
+        return it == response.header.end() ? std::string_view {} : it->second;
+    }
+
+    inline metrics::Histogram &waited(std::string_view route)
+    {
+        return metrics::registry().histogram(
+          "rest_rate_limit_wait_microseconds",
+          fmt::format("route=\"{}\"", route));
+    }
+}    // namespace
+
+discord::Rest::~Rest()
+{
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        stopping = true;
+    }
+    jobs_cv.notify_one();
+    // Whoever is still waiting on a queued request is left waiting; this is shutdown
+    if (worker.joinable()) worker.join();
+}
+
+void discord::Rest::authorize(std::string_view bot_token)
+{
+    std::lock_guard<std::mutex> lock(session_mutex);
+    session.SetHeader(cpr::Header { { "Authorization", fmt::format("Bot {}", bot_token) },
+                                    { "Content-Type", "application/json" } });
+    session.SetVerifySsl(cpr::VerifySsl(false));
+}
+
+discord::Rest::Response discord::Rest::get(std::string_view route, std::string_view path)
+{
+    return send(false, route, path, {});
+}
+
+discord::Rest::Response
+  discord::Rest::post(std::string_view route, std::string_view path, std::string_view body)
+{
+    return send(true, route, path, body);
+}
+
+discord::Rest::Request discord::Rest::async_get(std::string_view route, std::string_view path)
+{
+    Request request;
+    request.rest  = this;
+    request.post  = false;
+    request.route = route;
+    request.path  = path;
+    return request;
+}
+
+discord::Rest::Request
+  discord::Rest::async_post(std::string_view route, std::string_view path, std::string_view body)
+{
+    Request request;
+    request.rest  = this;
+    request.post  = true;
+    request.route = route;
+    request.path  = path;
+    request.body  = body;
+    return request;
+}
+
+void discord::Rest::Request::await_suspend(std::coroutine_handle<> handle)
+{
+    // The Request lives in the awaiting coroutine's frame until it resumes
+    this->handle = handle;
+    loop         = EventLoop::current();
+    rest->queue([this] { step(); });
+}
+
+void discord::Rest::Request::step()
+{
+    if (u64 wait = rest->limited_for(path); wait > 0)
+    {
+        waited(route).record(wait);
+        if (loop)
+        {
+            loop->after(wait, [this] { rest->queue([this] { step(); }); });
+            return;
+        }
+        // Outside of a loop there's nothing to come back on
+        std::this_thread::sleep_for(std::chrono::microseconds(wait));
+    }
+
+    if (!rest->attempt(post, route, path, body, response))
+    {
+        // Back of the queue, where it finds its bucket reset and waits that out
+        if (++attempts < max_attempts)
+        {
+            rest->queue([this] { step(); });
+            return;
+        }
+        std::cerr << route << " still rate limited after " << max_attempts << " attempts\n";
+        response = { 429, "" };
+    }
+
+    if (loop)
+        loop->post(handle);
+    else
+        handle.resume();
+}
+
+void discord::Rest::queue(std::function<void()> job)
+{
+    static auto &queued = metrics::registry().gauge("rest_requests_queued");
+    [[maybe_unused]] static const bool described = []
+    {
+        metrics::registry().describe(
+          "rest_requests_queued",
+          "Awaited requests waiting for the ones ahead of them");
+        return true;
+    }();
+
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        if (stopping) return;
+        jobs.push_back(std::move(job));
+        queued.set(jobs.size());
+        if (!worker.joinable()) worker = std::thread(&Rest::work, this);
+    }
+    jobs_cv.notify_one();
+}
+
+void discord::Rest::work()
+{
+    static auto &queued = metrics::registry().gauge("rest_requests_queued");
+
+    std::unique_lock<std::mutex> lock(jobs_mutex);
+    while (true)
+    {
+        jobs_cv.wait(lock, [&] { return stopping || !jobs.empty(); });
+        if (stopping) return;
+
+        auto job = std::move(jobs.front());
+        jobs.pop_front();
+        queued.set(jobs.size());
+
+        lock.unlock();
+        job();
+        lock.lock();
+    }
+}
+
+discord::Rest::Response discord::Rest::send(
+  bool             post,
+  std::string_view route,
+  std::string_view path,
+  std::string_view body)
+{
+    auto &wait_latency = waited(route);
+
+    std::string key(path);
+    Response    response;
+    for (int i = 0; i < max_attempts; i++)
+    {
+        // Slept with no lock held, so other routes carry on meanwhile
+        if (u64 wait = limited_for(key); wait > 0)
+        {
+            wait_latency.record(wait);
+            std::this_thread::sleep_for(std::chrono::microseconds(wait));
+        }
+        if (attempt(post, route, key, body, response)) return response;
+    }
+
+    std::cerr << route << " still rate limited after " << max_attempts << " attempts\n";
+    return { 429, "" };
+}
+
+bool discord::Rest::attempt(
+  bool               post,
+  std::string_view   route,
+  const std::string &path,
+  std::string_view   body,
+  Response          &response)
+{
+    auto &registry = metrics::registry();
+    auto  labels   = fmt::format("route=\"{}\"", route);
+    auto &latency  = registry.histogram("rest_request_duration_microseconds", labels);
+    auto &limited  = registry.counter("rest_rate_limited_total", labels);
+
+    cpr::Response answer;
+    {
+        std::lock_guard<std::mutex> lock(session_mutex);
+        session.SetUrl(cpr::Url(base_url + path));
+        if (post) session.SetBody(cpr::Body(std::string(body)));
+
+        metrics::Timer timer(latency);
+        answer = post ? session.Post() : session.Get();
+    }
+    if (answer.error)
+    {
+        std::cerr << route << " failed with error code " << (u16) answer.error.code << ": "
+                  << answer.error.message << "\n";
+        response = {};
+        return true;
+    }
+
+    if (update_limits(path, answer))
+    {
+        limited.add();
+        return false;
+    }
+    response = { answer.status_code, std::move(answer.text) };
+    return true;
+}
+
+u64 discord::Rest::limited_for(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(limits_mutex);
+
+    u64 now   = metrics::now_us();
+    u64 until = global_reset_us;
+    if (auto it = reset_us.find(path); it != reset_us.end())
+    {
+        until = std::max(until, it->second);
+        if (it->second <= now) reset_us.erase(it);
+    }
+    return until > now ? until - now : 0;
+}
+
+bool discord::Rest::update_limits(const std::string &path, const cpr::Response &response)
+{
+    std::lock_guard<std::mutex> lock(limits_mutex);
+
+    u64 now = metrics::now_us();
+    if (header(response, "x-ratelimit-remaining") == "0")
+        reset_us[path] = now + seconds_to_us(header(response, "x-ratelimit-reset-after"));
+    if (response.status_code != 429) return false;
+
+    // The body has retry_after with more precision than the Retry-After header
+    auto retry_after = scan::field(response.text, "retry_after");
+    u64  retry_us    = seconds_to_us(
+      retry_after.empty() ? header(response, "retry-after") : retry_after);
+    bool global = scan::boolean(scan::field(response.text, "global")) ||
+                  header(response, "x-ratelimit-global") == "true";
+
+    u64 &reset = global ? global_reset_us : reset_us[path];
+    reset      = std::max(reset, now + retry_us);
+    return true;
+}
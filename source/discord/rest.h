@@ -0,0 +1,122 @@
+#pragma once
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include <cpr/cpr.h>
+
+#include "util/event_loop.h"
+#include "util/types.h"
+
+namespace discord
+{
+    // Discord's HTTP API. Requests share one kept-alive connection and stay inside the rate
+    // limits Discord announces: a bucket with nothing remaining holds its requests until it
+    // resets, and a 429 is retried once 'retry_after' has passed.
+    // Safe to share between threads. Only the connection's use is serialised, so a request
+    // waiting out its bucket holds up nobody else's.
+    // The async_ ones are awaited from a coroutine instead of blocking its thread: they're made
+    // on a thread of the Rest's own, and the coroutine is resumed on the EventLoop it awaited
+    // from (or on that thread, outside of one). One that's rate limited waits on that loop's
+    // timers rather than on the Rest's thread, which carries on with the others
+    class Rest
+    {
+    public:
+        struct Response
+        {
+            long        status = 0;    // 0 if there was no answer at all
+            std::string body;
+
+            bool ok() const noexcept { return status >= 200 && status < 300; }
+        };
+
+        // What co_await async_get()/async_post() gives, with the Response
+        class Request
+        {
+        public:
+            bool     await_ready() const noexcept { return false; }
+            void     await_suspend(std::coroutine_handle<> handle);
+            Response await_resume() noexcept { return std::move(response); }
+
+        private:
+            friend class Rest;
+
+            Rest       *rest;
+            bool        post;
+            std::string route;
+            std::string path;
+            std::string body;
+            Response    response;
+
+            EventLoop              *loop = nullptr;
+            std::coroutine_handle<> handle;
+            int                     attempts = 0;
+
+            // One go at it on the Rest's thread, re-armed until there's a response
+            void step();
+        };
+
+        Rest() = default;
+        ~Rest();
+
+        Rest(const Rest &) = delete;
+        Rest &operator=(const Rest &) = delete;
+
+        // Defaults to https://discord.com/api
+        void               set_url(std::string url) { base_url = std::move(url); }
+        const std::string &url() const noexcept { return base_url; }
+
+        void authorize(std::string_view bot_token);
+
+        // 'path' goes after the base URL, e.g. /channels/1234/messages. 'route' is the same
+        // with its ids as placeholders and labels the request's metrics
+        Response get(std::string_view route, std::string_view path);
+        Response post(std::string_view route, std::string_view path, std::string_view body);
+
+        Request async_get(std::string_view route, std::string_view path);
+        Request async_post(std::string_view route, std::string_view path, std::string_view body);
+
+    private:
+        std::string  base_url = "https://discord.com/api";
+        std::mutex   session_mutex;
+        cpr::Session session;
+
+        // When each path, and every path for a global limit, may be requested again
+        std::mutex                           limits_mutex;
+        std::unordered_map<std::string, u64> reset_us;
+        u64                                  global_reset_us = 0;
+
+        // Awaited requests waiting for 'worker', which is started with the first of them
+        std::thread                       worker;
+        std::mutex                        jobs_mutex;
+        std::condition_variable           jobs_cv;
+        std::deque<std::function<void()>> jobs;
+        bool                              stopping = false;
+
+        Response send(
+          bool             post,
+          std::string_view route,
+          std::string_view path,
+          std::string_view body);
+        // Microseconds until 'path' may be requested, 0 if it may be now
+        u64  limited_for(const std::string &path);
+        // One go at a request, without waiting. False for a 429, which is to be retried
+        bool attempt(
+          bool               post,
+          std::string_view   route,
+          const std::string &path,
+          std::string_view   body,
+          Response          &response);
+        // Takes in the rate limit headers. True for a 429
+        bool update_limits(const std::string &path, const cpr::Response &response);
+        void queue(std::function<void()> job);
+        void work();
+    };
+}    // namespace discord
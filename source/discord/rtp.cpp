@@ -0,0 +1,109 @@
+#include "rtp.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    // The counter fills the first 4 bytes of GCM's 12 byte IV, the rest are zero
+    inline void make_iv(u8 *iv, const u8 *nonce)
+    {
+        std::memset(iv, 0, 12);
+        std::memcpy(iv, nonce, discord::rtp::Cipher::nonce_size);
+    }
+}    // namespace
+
+void discord::rtp::discovery::encode(
+  u8 *               out,
+  u16                type,
+  u32                ssrc,
+  const std::string &address,
+  u16                port)
+{
+    std::memset(out, 0, size);
+    out[0] = type >> 8;
+    out[1] = type;
+    out[3] = size - 4;    // Length of what follows
+    for (int i = 0; i < 4; i++) out[4 + i] = ssrc >> (24 - i * 8);
+    std::memcpy(out + 8, address.data(), std::min<size_t>(address.size(), 63));
+    out[72] = port >> 8;
+    out[73] = port;
+}
+
+u16 discord::rtp::discovery::decode(
+  const u8 *   in,
+  size_t       length,
+  u32 &        ssrc,
+  std::string &address,
+  u16 &        port)
+{
+    if (length < size) return 0;
+    u16 type = in[0] << 8 | in[1];
+    if (type != request && type != response) return 0;
+
+    ssrc    = (u32) in[4] << 24 | in[5] << 16 | in[6] << 8 | in[7];
+    address = std::string((const char *) in + 8, strnlen((const char *) in + 8, 64));
+    port    = in[72] << 8 | in[73];
+    return type;
+}
+
+discord::rtp::Cipher::Cipher() : encrypt(EVP_CIPHER_CTX_new()), decrypt(EVP_CIPHER_CTX_new())
+{
+    EVP_EncryptInit_ex(encrypt, EVP_aes_256_gcm(), nullptr, nullptr, nullptr);
+    EVP_DecryptInit_ex(decrypt, EVP_aes_256_gcm(), nullptr, nullptr, nullptr);
+}
+
+discord::rtp::Cipher::~Cipher()
+{
+    EVP_CIPHER_CTX_free(encrypt);
+    EVP_CIPHER_CTX_free(decrypt);
+}
+
+void discord::rtp::Cipher::set_key(const std::array<u8, 32> &key)
+{
+    // The key schedule is done once here; each packet only sets a new IV
+    EVP_EncryptInit_ex(encrypt, nullptr, nullptr, key.data(), nullptr);
+    EVP_DecryptInit_ex(decrypt, nullptr, nullptr, key.data(), nullptr);
+    keyed = true;
+}
+
+size_t discord::rtp::Cipher::seal(
+  u8 *      packet,
+  size_t    header_size,
+  const u8 *payload,
+  size_t    length,
+  u32       nonce)
+{
+    u8 *sealed = packet + header_size;
+    u8 *tag    = sealed + length;
+    u8 *suffix = tag + tag_size;
+    for (size_t i = 0; i < nonce_size; i++) suffix[i] = nonce >> (24 - i * 8);
+
+    u8  iv[12];
+    int written;
+    make_iv(iv, suffix);
+    EVP_EncryptInit_ex(encrypt, nullptr, nullptr, nullptr, iv);
+    EVP_EncryptUpdate(encrypt, nullptr, &written, packet, header_size);
+    EVP_EncryptUpdate(encrypt, sealed, &written, payload, length);
+    EVP_EncryptFinal_ex(encrypt, sealed + length, &written);
+    EVP_CIPHER_CTX_ctrl(encrypt, EVP_CTRL_GCM_GET_TAG, tag_size, tag);
+    return header_size + length + overhead;
+}
+
+i64 discord::rtp::Cipher::open(u8 *packet, size_t length, size_t header_size)
+{
+    if (length < header_size + overhead) return -1;
+    size_t payload_length = length - header_size - overhead;
+    u8 *   payload        = packet + header_size;
+    u8 *   tag            = payload + payload_length;
+
+    u8  iv[12];
+    int written;
+    make_iv(iv, tag + tag_size);
+    EVP_DecryptInit_ex(decrypt, nullptr, nullptr, nullptr, iv);
+    EVP_DecryptUpdate(decrypt, nullptr, &written, packet, header_size);
+    EVP_DecryptUpdate(decrypt, payload, &written, payload, payload_length);
+    EVP_CIPHER_CTX_ctrl(decrypt, EVP_CTRL_GCM_SET_TAG, tag_size, tag);
+    if (EVP_DecryptFinal_ex(decrypt, payload + payload_length, &written) <= 0) return -1;
+    return payload_length;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <string>
+
+#include <openssl/evp.h>
+
+#include "util/types.h"
+
+// What goes over a voice connection's UDP socket: IP discovery first, then RTP packets of
+// Opus audio, encrypted with the key from the Session Description.
+namespace discord::rtp
+{
+    inline constexpr u32 sample_rate   = 48000;
+    inline constexpr u32 frame_ms      = 20;
+    inline constexpr u32 frame_samples = sample_rate / 1000 * frame_ms;
+    // The largest Opus packet there is
+    inline constexpr size_t max_frame_size = 1275;
+
+    // Discord's Opus silence, sent a few times after audio stops so receivers don't
+    // interpolate into the gap
+    inline constexpr u8 silence_frame[] = { 0xF8, 0xFF, 0xFE };
+
+    // Fixed 12 byte header, no CSRCs or extension
+    struct Header
+    {
+        static constexpr size_t size         = 12;
+        static constexpr u8     payload_type = 0x78;    // Opus, as Discord numbers it
+
+        u16 sequence;
+        u32 timestamp;
+        u32 ssrc;
+
+        void encode(u8 *out) const noexcept
+        {
+            out[0] = 0x80;    // Version 2
+            out[1] = payload_type;
+            out[2] = sequence >> 8;
+            out[3] = sequence;
+            for (int i = 0; i < 4; i++)
+            {
+                out[4 + i] = timestamp >> (24 - i * 8);
+                out[8 + i] = ssrc >> (24 - i * 8);
+            }
+        }
+
+        static Header decode(const u8 *in) noexcept
+        {
+            Header header;
+            header.sequence  = (u16) (in[2] << 8 | in[3]);
+            header.timestamp = (u32) in[4] << 24 | in[5] << 16 | in[6] << 8 | in[7];
+            header.ssrc      = (u32) in[8] << 24 | in[9] << 16 | in[10] << 8 | in[11];
+            return header;
+        }
+
+        // Bytes of a received packet that travel in the clear: the fixed header, CSRCs and, as
+        // the rtpsize modes have it, the 4 byte preamble of an extension but not its body
+        static size_t size_of(const u8 *in) noexcept
+        {
+            return size + (in[0] & 0x0F) * 4 + (in[0] & 0x10 ? 4 : 0);
+        }
+
+        // The extension body that starts the decrypted payload, 0 without one
+        static size_t extension_size(const u8 *in) noexcept
+        {
+            if (!(in[0] & 0x10)) return 0;
+            const u8 *preamble = in + size + (in[0] & 0x0F) * 4;
+            return (preamble[2] << 8 | preamble[3]) * 4;
+        }
+    };
+
+    // IP discovery, the same 74 bytes both ways: type, length, SSRC, a NUL-terminated address
+    // and a port, all big-endian
+    namespace discovery
+    {
+        inline constexpr size_t size     = 74;
+        inline constexpr u16    request  = 1;
+        inline constexpr u16    response = 2;
+
+        void   encode(u8 *out, u16 type, u32 ssrc, const std::string &address = {}, u16 port = 0);
+        // The packet's type, 0 if it isn't one
+        u16    decode(const u8 *in, size_t length, u32 &ssrc, std::string &address, u16 &port);
+    }    // namespace discovery
+
+    // aead_aes256_gcm_rtpsize: the header travels in the clear but authenticated, the payload
+    // is sealed with AES-256-GCM, and a 32-bit counter at the very end makes the nonce
+    class Cipher
+    {
+    public:
+        static constexpr const char *mode       = "aead_aes256_gcm_rtpsize";
+        static constexpr size_t      tag_size   = 16;
+        static constexpr size_t      nonce_size = 4;
+        static constexpr size_t      overhead   = tag_size + nonce_size;
+
+        Cipher();
+        ~Cipher();
+
+        Cipher(const Cipher &) = delete;
+        Cipher &operator=(const Cipher &) = delete;
+
+        void set_key(const std::array<u8, 32> &key);
+        bool has_key() const noexcept { return keyed; }
+
+        // 'packet' starts with a 'header_size' byte header. The sealed 'payload', the tag and
+        // 'nonce' go after it; returns the packet's full length
+        size_t seal(u8 *packet, size_t header_size, const u8 *payload, size_t length, u32 nonce);
+        // Opens a received packet in place. The payload's length, or -1 if the packet doesn't
+        // authenticate
+        i64 open(u8 *packet, size_t length, size_t header_size);
+
+    private:
+        EVP_CIPHER_CTX *encrypt;
+        EVP_CIPHER_CTX *decrypt;
+        bool            keyed = false;
+    };
+}    // namespace discord::rtp
@@ -0,0 +1,189 @@
+#include "scan.h"
+
+#include <charconv>
+#include <cstring>
+
+namespace
+{
+    // Index one past the closing quote of the string whose opening quote is at 'pos'
+    inline size_t skip_string(std::string_view json, size_t pos) noexcept
+    {
+        for (pos++; pos < json.size();)
+        {
+            auto *quote = (const char *) std::memchr(json.data() + pos, '"', json.size() - pos);
+            if (!quote) return discord::scan::npos;
+            size_t end = quote - json.data();
+
+            size_t slashes = 0;
+            while (end - slashes > pos && json[end - slashes - 1] == '\\') slashes++;
+            if ((slashes & 1) == 0) return end + 1;
+            pos = end + 1;
+        }
+        return discord::scan::npos;
+    }
+
+    inline void append_utf8(std::string &out, u32 cp)
+    {
+        if (cp < 0x80)
+            out.push_back((char) cp);
+        else if (cp < 0x800)
+        {
+            out.push_back((char) (0xC0 | (cp >> 6)));
+            out.push_back((char) (0x80 | (cp & 0x3F)));
+        }
+        else if (cp < 0x10000)
+        {
+            out.push_back((char) (0xE0 | (cp >> 12)));
+            out.push_back((char) (0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back((char) (0x80 | (cp & 0x3F)));
+        }
+        else
+        {
+            out.push_back((char) (0xF0 | (cp >> 18)));
+            out.push_back((char) (0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back((char) (0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back((char) (0x80 | (cp & 0x3F)));
+        }
+    }
+
+    inline u32 hex4(std::string_view str, size_t pos) noexcept
+    {
+        u32 value = 0;
+        if (pos + 4 > str.size()) return 0xFFFD;
+        std::from_chars(str.data() + pos, str.data() + pos + 4, value, 16);
+        return value;
+    }
+}    // namespace
+
+size_t discord::scan::skip(std::string_view json, size_t pos) noexcept
+{
+    pos = skip_ws(json, pos);
+    if (pos >= json.size()) return npos;
+
+    switch (json[pos])
+    {
+    case '"': return skip_string(json, pos);
+    case '{':
+    case '[':
+    {
+        size_t depth = 0;
+        while (pos < json.size())
+        {
+            char c = json[pos];
+            if (c == '"')
+            {
+                pos = skip_string(json, pos);
+                if (pos == npos) return npos;
+                continue;
+            }
+            if (c == '{' || c == '[')
+                depth++;
+            else if ((c == '}' || c == ']') && --depth == 0)
+                return pos + 1;
+            pos++;
+        }
+        return npos;
+    }
+    default:
+    {
+        // Number or literal
+        size_t start = pos;
+        while (pos < json.size() && json[pos] != ',' && json[pos] != '}' && json[pos] != ']' &&
+               json[pos] != ' ' && json[pos] != '\n' && json[pos] != '\r' && json[pos] != '\t')
+            pos++;
+        return pos == start ? npos : pos;
+    }
+    }
+}
+
+std::string_view discord::scan::field(std::string_view object, std::string_view key) noexcept
+{
+    std::string_view value;
+    fields(
+      object,
+      [&](std::string_view name, std::string_view raw)
+      {
+          if (name != key) return true;
+          value = raw;
+          return false;    // The first one is the one, no need to walk the rest
+      });
+    return value;
+}
+
+std::string_view discord::scan::string(std::string_view raw) noexcept
+{
+    if (raw.size() < 2 || raw.front() != '"' || raw.back() != '"') return {};
+    return raw.substr(1, raw.size() - 2);
+}
+
+std::string_view discord::scan::string(std::string_view raw, std::string &scratch)
+{
+    auto str = string(raw);
+    if (str.find('\\') == std::string_view::npos) return str;
+
+    scratch.clear();
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        if (str[i] != '\\' || i + 1 >= str.size())
+        {
+            scratch.push_back(str[i]);
+            continue;
+        }
+
+        switch (str[++i])
+        {
+        case 'b': scratch.push_back('\b'); break;
+        case 'f': scratch.push_back('\f'); break;
+        case 'n': scratch.push_back('\n'); break;
+        case 'r': scratch.push_back('\r'); break;
+        case 't': scratch.push_back('\t'); break;
+        case 'u':
+        {
+            u32 cp = hex4(str, i + 1);
+            i += 4;
+            if (cp >= 0xD800 && cp < 0xDC00 && i + 6 < str.size() && str[i + 1] == '\\' &&
+                str[i + 2] == 'u')
+            {
+                u32 low = hex4(str, i + 3);
+                cp      = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                i += 6;
+            }
+            append_utf8(scratch, cp);
+        }
+        break;
+        default: scratch.push_back(str[i]); break;    // \" \\ \/
+        }
+    }
+    return scratch;
+}
+
+u64 discord::scan::integer(std::string_view raw) noexcept
+{
+    if (raw.size() >= 2 && raw.front() == '"') raw = raw.substr(1, raw.size() - 2);
+
+    u64 value = 0;
+    std::from_chars(raw.data(), raw.data() + raw.size(), value);
+    return value;
+}
+
+discord::scan::Envelope discord::scan::envelope(std::string_view payload) noexcept
+{
+    Envelope env;
+    bool     valid = fields(
+      payload,
+      [&](std::string_view key, std::string_view raw)
+      {
+          if (key == "op")
+              std::from_chars(raw.data(), raw.data() + raw.size(), env.op);
+          else if (key == "s")
+          {
+              if (!is_null(raw)) env.s = integer(raw);
+          }
+          else if (key == "t")
+              env.t = string(raw);
+          else if (key == "d")
+              env.d = raw;
+      });
+    if (!valid) env.op = -1;
+    return env;
+}
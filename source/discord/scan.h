@@ -0,0 +1,116 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "util/types.h"
+
+// Pull-style scanning of raw JSON text. Nothing here builds a DOM or allocates;
+// values are handed out as string_views into the original buffer.
+// Assumes well-formed input (it's from Discord), but never reads out of bounds on bad input.
+namespace discord::scan
+{
+    inline constexpr size_t npos = std::string_view::npos;
+
+    inline size_t skip_ws(std::string_view json, size_t pos) noexcept
+    {
+        while (pos < json.size() &&
+               (json[pos] == ' ' || json[pos] == '\n' || json[pos] == '\r' || json[pos] == '\t'))
+            pos++;
+        return pos;
+    }
+
+    // Index one past the value starting at 'pos', or npos if it is malformed
+    size_t skip(std::string_view json, size_t pos) noexcept;
+
+    // Raw text of 'key's value in 'object', or empty if absent
+    std::string_view field(std::string_view object, std::string_view key) noexcept;
+
+    // Contents of a raw string value without the quotes. Escapes are left as-is
+    std::string_view string(std::string_view raw) noexcept;
+    // Same, but unescapes into 'scratch' when the string has escapes in it
+    std::string_view string(std::string_view raw, std::string &scratch);
+
+    // Integer value, quoted or not (snowflakes are quoted). 0 if not a number
+    u64 integer(std::string_view raw) noexcept;
+
+    inline bool is_null(std::string_view raw) noexcept { return raw.empty() || raw == "null"; }
+    inline bool boolean(std::string_view raw) noexcept { return raw == "true"; }
+
+    // Calls func(key, raw_value) for each member of 'object'. Returns false if malformed.
+    // A func returning bool stops the walk by returning false, and the rest goes unchecked
+    template<typename F>
+    bool fields(std::string_view object, F &&func)
+    {
+        size_t pos = skip_ws(object, 0);
+        if (pos >= object.size() || object[pos] != '{') return false;
+        pos = skip_ws(object, pos + 1);
+        if (pos < object.size() && object[pos] == '}') return true;
+
+        while (pos < object.size())
+        {
+            size_t key_end = skip(object, pos);
+            if (key_end == npos || object[pos] != '"') return false;
+            auto key = object.substr(pos + 1, key_end - pos - 2);
+
+            pos = skip_ws(object, key_end);
+            if (pos >= object.size() || object[pos] != ':') return false;
+            pos        = skip_ws(object, pos + 1);
+            size_t end = skip(object, pos);
+            if (end == npos) return false;
+
+            if constexpr (std::is_same_v<
+                            std::invoke_result_t<F &, std::string_view, std::string_view>,
+                            bool>)
+            {
+                if (!func(key, object.substr(pos, end - pos))) return true;
+            }
+            else
+                func(key, object.substr(pos, end - pos));
+
+            pos = skip_ws(object, end);
+            if (pos >= object.size()) return false;
+            if (object[pos] == '}') return true;
+            if (object[pos] != ',') return false;
+            pos = skip_ws(object, pos + 1);
+        }
+        return false;
+    }
+
+    // Calls func(raw_element) for each element of 'array'. Returns false if malformed
+    template<typename F>
+    bool elements(std::string_view array, F &&func)
+    {
+        size_t pos = skip_ws(array, 0);
+        if (pos >= array.size() || array[pos] != '[') return false;
+        pos = skip_ws(array, pos + 1);
+        if (pos < array.size() && array[pos] == ']') return true;
+
+        while (pos < array.size())
+        {
+            size_t end = skip(array, pos);
+            if (end == npos) return false;
+
+            func(array.substr(pos, end - pos));
+
+            pos = skip_ws(array, end);
+            if (pos >= array.size()) return false;
+            if (array[pos] == ']') return true;
+            if (array[pos] != ',') return false;
+            pos = skip_ws(array, pos + 1);
+        }
+        return false;
+    }
+
+    // The outer {"op","d","s","t"} object of a gateway payload
+    struct Envelope
+    {
+        i32              op = -1;    // -1 if missing
+        u64              s  = -1;    // -1 if null/missing
+        std::string_view t;
+        std::string_view d;
+    };
+
+    Envelope envelope(std::string_view payload) noexcept;
+}    // namespace discord::scan
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <charconv>
+#include <string_view>
+
+#include "util/types.h"
+
+namespace discord
+{
+    using snowflake = u64;
+
+    // Discord sends snowflakes as strings. Returns 0 if 'str' isn't one, all of it digits
+    inline snowflake to_snowflake(std::string_view str) noexcept
+    {
+        snowflake id     = 0;
+        auto      end    = str.data() + str.size();
+        auto      result = std::from_chars(str.data(), end, id);
+        if (result.ec != std::errc() || result.ptr != end) return 0;
+        return id;
+    }
+}    // namespace discord
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "discord/scan.h"
+#include "discord/snowflake.h"
+#include "util/types.h"
+
+// Typed views over dispatch payloads, generated from the schemas below. A view is only the raw
+// JSON; each field is scanned out of it when asked for, so reading 'content' and 'channel_id'
+// off a MESSAGE_CREATE never touches the rest of it, and nothing is allocated or parsed into a
+// DOM. A field is scanned for on every call, so keep a value that's used more than once.
+// Views point into the frame's payload, so don't keep them past the event either
+//
+// X(kind, type, name), with 'name' the JSON key too, and 'type' only for object and list:
+//   string     std::string_view, escapes left as-is, or unescaped into a scratch string
+//   snowflake  snowflake, 0 if absent
+//   integer    u64, 0 if absent
+//   boolean    bool, false if absent
+//   object     The nested 'type' view
+//   list       A List of 'type' views
+//   raw        The value's JSON, as-is
+#define DISCORD_VIEW_USER(X)                                                                       \
+    X(snowflake, _, id)                                                                            \
+    X(string, _, username)                                                                         \
+    X(string, _, discriminator)                                                                    \
+    X(string, _, global_name)                                                                      \
+    X(boolean, _, bot)
+
+#define DISCORD_VIEW_MEMBER(X)                                                                     \
+    X(object, User, user)                                                                          \
+    X(string, _, nick)                                                                             \
+    X(raw, _, roles)                                                                               \
+    X(string, _, joined_at)
+
+#define DISCORD_VIEW_CHANNEL(X)                                                                    \
+    X(snowflake, _, id)                                                                            \
+    X(snowflake, _, guild_id)                                                                      \
+    X(integer, _, type)                                                                            \
+    X(string, _, name)                                                                             \
+    X(integer, _, position)                                                                        \
+    X(snowflake, _, parent_id)
+
+#define DISCORD_VIEW_VOICE_STATE(X)                                                                \
+    X(snowflake, _, guild_id)                                                                      \
+    X(snowflake, _, channel_id)                                                                    \
+    X(snowflake, _, user_id)                                                                       \
+    X(string, _, session_id)                                                                       \
+    X(boolean, _, self_mute)                                                                       \
+    X(boolean, _, self_deaf)
+
+#define DISCORD_VIEW_READY(X)                                                                      \
+    X(integer, _, v)                                                                               \
+    X(object, User, user)                                                                          \
+    X(raw, _, guilds)                                                                              \
+    X(string, _, session_id)                                                                       \
+    X(string, _, resume_gateway_url)
+
+#define DISCORD_VIEW_GUILD_CREATE(X)                                                               \
+    X(snowflake, _, id)                                                                            \
+    X(string, _, name)                                                                             \
+    X(snowflake, _, owner_id)                                                                      \
+    X(integer, _, member_count)                                                                    \
+    X(boolean, _, unavailable)                                                                     \
+    X(list, Channel, channels)                                                                     \
+    X(list, Member, members)                                                                       \
+    X(list, VoiceState, voice_states)
+
+#define DISCORD_VIEW_GUILD_MEMBERS_CHUNK(X)                                                        \
+    X(snowflake, _, guild_id)                                                                      \
+    X(list, Member, members)                                                                       \
+    X(integer, _, chunk_index)                                                                     \
+    X(integer, _, chunk_count)
+
+#define DISCORD_VIEW_VOICE_SERVER_UPDATE(X)                                                        \
+    X(snowflake, _, guild_id)                                                                      \
+    X(string, _, token)                                                                            \
+    X(string, _, endpoint)
+
+#define DISCORD_VIEW_MESSAGE_CREATE(X)                                                             \
+    X(snowflake, _, id)                                                                            \
+    X(snowflake, _, channel_id)                                                                    \
+    X(snowflake, _, guild_id)                                                                      \
+    X(object, User, author)                                                                        \
+    X(object, Member, member)                                                                      \
+    X(string, _, content)                                                                          \
+    X(string, _, timestamp)                                                                        \
+    X(integer, _, type)                                                                            \
+    X(list, User, mentions)                                                                        \
+    X(raw, _, attachments)                                                                         \
+    X(raw, _, embeds)
+
+// The views, in the order they're defined in, so a view comes before those holding it
+#define DISCORD_VIEWS(X)                                                                           \
+    X(User, DISCORD_VIEW_USER)                                                                     \
+    X(Member, DISCORD_VIEW_MEMBER)                                                                 \
+    X(Channel, DISCORD_VIEW_CHANNEL)                                                               \
+    X(VoiceState, DISCORD_VIEW_VOICE_STATE)                                                        \
+    X(Ready, DISCORD_VIEW_READY)                                                                   \
+    X(GuildCreate, DISCORD_VIEW_GUILD_CREATE)                                                      \
+    X(GuildMembersChunk, DISCORD_VIEW_GUILD_MEMBERS_CHUNK)                                         \
+    X(VoiceServerUpdate, DISCORD_VIEW_VOICE_SERVER_UPDATE)                                         \
+    X(MessageCreate, DISCORD_VIEW_MESSAGE_CREATE)
+
+namespace discord
+{
+    // What every view is: the raw JSON of an object
+    class View
+    {
+    public:
+        View() = default;
+        explicit View(std::string_view raw) noexcept : json(raw) { }
+
+        std::string_view raw() const noexcept { return json; }
+        // Present, and not null
+        bool has(std::string_view key) const noexcept { return !scan::is_null(get(key)); }
+
+    protected:
+        std::string_view get(std::string_view key) const noexcept
+        {
+            return scan::field(json, key);
+        }
+
+    private:
+        std::string_view json;
+    };
+
+    // An array of views, walked without copying any of it
+    template<typename T>
+    class List
+    {
+    public:
+        List() = default;
+        explicit List(std::string_view raw) noexcept : json(raw) { }
+
+        std::string_view raw() const noexcept { return json; }
+
+        // Calls func(const T &) on each element. False if the array is malformed
+        template<typename F>
+        bool each(F &&func) const
+        {
+            return scan::elements(json, [&](std::string_view element) { func(T(element)); });
+        }
+
+    private:
+        std::string_view json;
+    };
+
+#define DISCORD_VIEW_ACCESSOR(kind, type, name) DISCORD_VIEW_##kind(type, name)
+#define DISCORD_VIEW_string(type, name)                                                            \
+    std::string_view name() const noexcept { return scan::string(get(#name)); }                    \
+    std::string_view name(std::string &scratch) const { return scan::string(get(#name), scratch); }
+#define DISCORD_VIEW_snowflake(type, name)                                                         \
+    snowflake name() const noexcept { return scan::integer(get(#name)); }
+#define DISCORD_VIEW_integer(type, name)                                                           \
+    u64 name() const noexcept { return scan::integer(get(#name)); }
+#define DISCORD_VIEW_boolean(type, name)                                                           \
+    bool name() const noexcept { return scan::boolean(get(#name)); }
+#define DISCORD_VIEW_object(type, name)                                                            \
+    type name() const noexcept { return type(get(#name)); }
+#define DISCORD_VIEW_list(type, name)                                                              \
+    List<type> name() const noexcept { return List<type>(get(#name)); }
+#define DISCORD_VIEW_raw(type, name)                                                               \
+    std::string_view name() const noexcept { return get(#name); }
+
+#define X(view, FIELDS)                                                                            \
+    class view : public View                                                                       \
+    {                                                                                              \
+    public:                                                                                        \
+        using View::View;                                                                          \
+        FIELDS(DISCORD_VIEW_ACCESSOR)                                                              \
+    };
+    DISCORD_VIEWS(X)
+#undef X
+
+#undef DISCORD_VIEW_ACCESSOR
+#undef DISCORD_VIEW_string
+#undef DISCORD_VIEW_snowflake
+#undef DISCORD_VIEW_integer
+#undef DISCORD_VIEW_boolean
+#undef DISCORD_VIEW_object
+#undef DISCORD_VIEW_list
+#undef DISCORD_VIEW_raw
+}    // namespace discord
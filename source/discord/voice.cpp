@@ -0,0 +1,385 @@
+#include "voice.h"
+
+#include <chrono>
+#include <iostream>
+
+#include <fmt/format.h>
+
+#include "discord/scan.h"
+#include "util/metrics.h"
+
+namespace
+{
+    constexpr u32 max_failures = 5;    // Connections in a row that never got going
+
+    // Close codes after which resuming is pointless: bad token, session gone, kicked or the
+    // channel deleted. Rejoining takes a new VoiceStateUpdate
+    inline bool is_final(u16 code)
+    {
+        return code == 4004 || code == 4006 || code == 4009 || code == 4011 || code == 4014;
+    }
+}    // namespace
+
+discord::Voice::~Voice()
+{
+    close();
+}
+
+std::string discord::Voice::state_update(
+  snowflake guild_id,
+  snowflake channel_id,
+  bool      mute,
+  bool      deaf)
+{
+    return fmt::format(
+      "{{\"guild_id\":\"{}\",\"channel_id\":{},\"self_mute\":{},\"self_deaf\":{}}}",
+      guild_id,
+      channel_id == 0 ? "null" : fmt::format("\"{}\"", channel_id),
+      mute,
+      deaf);
+}
+
+void discord::Voice::set_user(std::string_view id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    user_id = id;
+}
+
+bool discord::Voice::update(std::string_view event_name, std::string_view raw)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (event_name == "VOICE_STATE_UPDATE")
+    {
+        if (scan::string(scan::field(raw, "user_id")) != user_id) return false;
+        if (scan::is_null(scan::field(raw, "channel_id")))
+        {
+            // We left, or were moved out. Joining again starts from scratch
+            lock.unlock();
+            close();
+            lock.lock();
+            session_id.clear();
+            token.clear();
+            return false;
+        }
+
+        guild_id   = scan::string(scan::field(raw, "guild_id"));
+        session_id = scan::string(scan::field(raw, "session_id"));
+        // Also sent on mutes and such while connected, which changes nothing
+        return !token.empty() && finished;
+    }
+    if (event_name == "VOICE_SERVER_UPDATE")
+    {
+        // A null endpoint means the server is going away; another update follows
+        auto server_endpoint = scan::field(raw, "endpoint");
+        if (scan::is_null(server_endpoint)) return false;
+
+        guild_id = scan::string(scan::field(raw, "guild_id"));
+        token    = scan::string(scan::field(raw, "token"));
+        endpoint = scan::string(server_endpoint);
+        return !session_id.empty();
+    }
+    return false;
+}
+
+void discord::Voice::connect()
+{
+    close();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = false;
+    finished = false;
+    thread   = std::thread(&Voice::run, this);
+}
+
+void discord::Voice::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    state_cv.notify_all();
+    ws.close();
+    if (thread.joinable()) thread.join();
+    udp.close();
+}
+
+bool discord::Voice::wait_for(State state, u32 timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    state_cv.wait_for(
+      lock,
+      std::chrono::milliseconds(timeout_ms),
+      [&] { return current >= state || finished; });
+    return current >= state;
+}
+
+discord::Voice::Server discord::Voice::server() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return server_info;
+}
+
+discord::Voice::Session discord::Voice::session() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return description;
+}
+
+void discord::Voice::select_protocol(std::string_view address, u16 port, std::string_view mode)
+{
+    send(
+      Opcodes::SelectProtocol,
+      fmt::format(
+        "{{\"protocol\":\"udp\",\"data\":{{\"address\":\"{}\",\"port\":{},\"mode\":\"{}\"}}}}",
+        address,
+        port,
+        mode));
+}
+
+void discord::Voice::speaking(bool microphone)
+{
+    send(
+      Opcodes::Speaking,
+      fmt::format(
+        "{{\"speaking\":{},\"delay\":0,\"ssrc\":{}}}",
+        microphone ? 1 : 0,
+        server().ssrc));
+}
+
+void discord::Voice::run()
+{
+    static auto &reconnects = metrics::registry().counter("voice_reconnects_total");
+
+    bool resuming = false;
+    u32  failures = 0;
+    while (!stopping)
+    {
+        std::string url;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            url = fmt::format("wss://{}/?v=4", endpoint);
+        }
+        set_state(State::connecting);
+        ws.connect(url);
+        u16  code    = ws.connected ? service(resuming) : 0;
+        bool reached = current >= State::ready;
+        if (stopping) break;
+
+        if (is_final(code))
+        {
+            std::cerr << "Voice connection closed with " << code << "\n";
+            break;
+        }
+        failures = reached ? 0 : failures + 1;
+        if (failures >= max_failures)
+        {
+            std::cerr << "Voice connection failed " << failures << " times, giving up\n";
+            break;
+        }
+        // Only a session that got as far as Ready has anything to resume
+        resuming = resuming || reached;
+        reconnects.add();
+        set_state(State::connecting);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        state_cv.wait_for(lock, std::chrono::seconds(failures), [&] { return stopping.load(); });
+    }
+
+    ws.close();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // Given up on, so the token is spent. The next VOICE_SERVER_UPDATE brings another
+        if (!stopping) token.clear();
+        finished = true;
+    }
+    set_state(State::disconnected);
+}
+
+u16 discord::Voice::service(bool resuming)
+{
+    static auto &lateness = metrics::registry().histogram("voice_heartbeat_lateness_microseconds");
+    metrics::registry().describe(
+      "voice_heartbeat_lateness_microseconds",
+      "How far past schedule each voice heartbeat went out");
+
+    heartbeat_interval_us = 0;
+    acknowledged          = true;
+    u16 close_code        = 0;
+    while (ws.connected && !stopping && close_code == 0)
+    {
+        u64 now = metrics::now_us();
+        if (heartbeat_interval_us > 0 && now >= next_heartbeat_us)
+        {
+            if (!acknowledged)
+            {
+                std::cerr << "Voice heartbeat not acknowledged, reconnecting\n";
+                break;
+            }
+            lateness.record(now - next_heartbeat_us);
+            heartbeat();
+
+            // Kept on the original schedule, so one late wakeup doesn't delay every later beat
+            next_heartbeat_us += heartbeat_interval_us;
+            if (next_heartbeat_us <= now) next_heartbeat_us = now + heartbeat_interval_us;
+            continue;
+        }
+
+        if (ws.iqueue_sizeapprox() == 0)
+        {
+            // wait_iqueue() counts whole milliseconds, so the last one is slept precisely
+            u64 wait_us = heartbeat_interval_us > 0 ? next_heartbeat_us - now : 100000;
+            if (wait_us >= 1000)
+                ws.wait_iqueue(std::min<u64>(wait_us / 1000, 100));
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds(wait_us));
+            continue;
+        }
+
+        for (auto &frame : inbound) frame.payload_data.reset();
+        size_t count = ws.dump_iqueue(inbound.data(), inbound.size());
+        for (size_t i = 0; i < count && close_code == 0 && ws.connected; i++)
+        {
+            auto &frame = inbound[i];
+            auto *data  = frame.payload_data.get() + frame.app_data_offset;
+            if (frame.opcode == WebSocket::Opcode::connection_close)
+                close_code = frame.payload_length >= 2 ? (data[0] << 8 | data[1]) : 1005;
+            else if (frame.opcode == WebSocket::Opcode::ping)
+                ws.send_frame(WebSocket::Opcode::pong, data, frame.payload_length);
+            else if (frame.opcode == WebSocket::Opcode::text_frame)
+                handle(std::string_view((char *) data, frame.payload_length), resuming);
+        }
+    }
+    ws.close();
+    return close_code;
+}
+
+void discord::Voice::handle(std::string_view payload, bool resuming)
+{
+    static auto &rtt = metrics::registry().histogram("voice_heartbeat_rtt_microseconds");
+
+    auto envelope = scan::envelope(payload);
+    auto d        = envelope.d;
+    switch ((Opcodes) envelope.op)
+    {
+    case Opcodes::Hello:
+    {
+        // A float in milliseconds, the fraction isn't worth keeping
+        heartbeat_interval_us = scan::integer(scan::field(d, "heartbeat_interval")) * 1000;
+        next_heartbeat_us     = metrics::now_us() + heartbeat_interval_us;
+
+        std::string body;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (resuming)
+                body = fmt::format(
+                  "{{\"server_id\":\"{}\",\"session_id\":\"{}\",\"token\":\"{}\"}}",
+                  guild_id,
+                  session_id,
+                  token);
+            else
+                body = fmt::format(
+                  "{{\"server_id\":\"{}\",\"user_id\":\"{}\",\"session_id\":\"{}\","
+                  "\"token\":\"{}\"}}",
+                  guild_id,
+                  user_id,
+                  session_id,
+                  token);
+        }
+        send(resuming ? Opcodes::Resume : Opcodes::Identify, body);
+    }
+    break;
+    case Opcodes::Ready:
+    {
+        Server server;
+        server.ssrc = scan::integer(scan::field(d, "ssrc"));
+        server.ip   = scan::string(scan::field(d, "ip"));
+        server.port = scan::integer(scan::field(d, "port"));
+        scan::elements(
+          scan::field(d, "modes"),
+          [&](std::string_view mode) { server.modes.emplace_back(scan::string(mode)); });
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            server_info = server;
+        }
+
+        // Straight on to the UDP side: where we are, then which mode to encrypt with
+        bool        offered = false;
+        std::string address;
+        u16         port;
+        for (auto &mode : server.modes) offered |= mode == rtp::Cipher::mode;
+        if (!offered)
+            std::cerr << "Voice server doesn't offer " << rtp::Cipher::mode << "\n";
+        else if (udp.connect(server.ip, server.port, server.ssrc) && udp.discover(address, port))
+        {
+            select_protocol(address, port, rtp::Cipher::mode);
+            set_state(State::ready);
+            break;
+        }
+        // No Session Description is coming, so this connection counts as one that failed
+        ws.close();
+    }
+    break;
+    case Opcodes::SessionDescription:
+    {
+        Session session;
+        size_t  i = 0;
+        session.mode = scan::string(scan::field(d, "mode"));
+        scan::elements(
+          scan::field(d, "secret_key"),
+          [&](std::string_view byte)
+          {
+              if (i < session.secret_key.size()) session.secret_key[i++] = scan::integer(byte);
+          });
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            description = session;
+        }
+        if (udp.set_session(session.mode, session.secret_key)) set_state(State::session);
+    }
+    break;
+    case Opcodes::HeartbeatACK:
+        if (scan::integer(d) == heartbeat_nonce)
+        {
+            acknowledged     = true;
+            heartbeat_rtt_us = metrics::now_us() - heartbeat_nonce;
+            rtt.record(heartbeat_rtt_us);
+        }
+        break;
+    case Opcodes::Resumed: set_state(udp.ready() ? State::session : State::ready); break;
+    case Opcodes::Speaking:
+        // Someone else's SSRC, for telling who is who in what comes in
+        if (auto *receiver = udp.receiver())
+            receiver->identify(
+              scan::integer(scan::field(d, "ssrc")),
+              scan::string(scan::field(d, "user_id")));
+        break;
+    case Opcodes::ClientDisconnect:
+        if (auto *receiver = udp.receiver())
+            receiver->forget(scan::string(scan::field(d, "user_id")));
+        break;
+    default: break;    // Client connects and the like
+    }
+}
+
+void discord::Voice::heartbeat()
+{
+    // The send time doubles as the nonce, so the ACK carries what the round trip needs
+    heartbeat_nonce = metrics::now_us();
+    acknowledged    = false;
+    send(Opcodes::Heartbeat, std::to_string(heartbeat_nonce));
+}
+
+void discord::Voice::send(Opcodes op, std::string_view d)
+{
+    std::string send = fmt::format("{{\"op\":{},\"d\":{}}}", (u8) op, d);
+    ws.send_frame(WebSocket::Opcode::text_frame, (u8 *) send.data(), send.size());
+}
+
+void discord::Voice::set_state(State state)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current = state;
+    }
+    state_cv.notify_all();
+}
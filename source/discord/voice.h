@@ -1,5 +1,153 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "util/types.h"
+#include "websocket/ws.h"
+#include "discord/snowflake.h"
+#include "discord/voice_udp.h"
+
 namespace discord
 {
-}
\ No newline at end of file
+    // One voice connection. The voice gateway (v4) says where to send audio and how to encrypt
+    // it, and VoiceUdp sends it. Discord says where to connect through the main gateway. After a
+    // VoiceStateUpdate it dispatches VOICE_STATE_UPDATE with our session id and
+    // VOICE_SERVER_UPDATE with an endpoint and token; both go to update(), then connect().
+    //
+    // The voice WebSocket has a thread of its own, woken by inbound frames or the next
+    // heartbeat, whichever is first. Heartbeats keep to schedule however busy the main event
+    // loop is, and dropped connections are resumed from there too.
+    class Voice
+    {
+    public:
+        // Ready (op 2): where the UDP side goes, and the encryption modes it takes
+        struct Server
+        {
+            u32                      ssrc = 0;
+            std::string              ip;
+            u16                      port = 0;
+            std::vector<std::string> modes;
+        };
+
+        // Session Description (op 4), in answer to select_protocol()
+        struct Session
+        {
+            std::string        mode;
+            std::array<u8, 32> secret_key {};
+        };
+
+        enum class State : u8
+        {
+            disconnected,
+            connecting,    // Up to Ready
+            ready,         // UDP is set up, waiting for the Session Description
+            session        // Audio can flow through transport()
+        };
+
+        Voice() = default;
+        ~Voice();
+
+        Voice(const Voice &) = delete;
+        Voice &operator=(const Voice &) = delete;
+
+        // 'd' of a VoiceStateUpdate (Gateway::VoiceStateUpdate) joining 'channel_id', or
+        // leaving the guild's voice channel when it is 0
+        static std::string state_update(
+          snowflake guild_id,
+          snowflake channel_id,
+          bool      mute = false,
+          bool      deaf = false);
+
+        // Our user id, from READY. Everyone else's voice states are ignored
+        void set_user(std::string_view user_id);
+        // Takes VOICE_STATE_UPDATE and VOICE_SERVER_UPDATE. True once both are in for a server
+        // we aren't connected to, so connect() is due. Leaving the channel closes the connection
+        bool update(std::string_view event_name, std::string_view raw);
+
+        // Connects and identifies from the voice thread, so it returns right away. Closes any
+        // previous connection first
+        void connect();
+        void close();
+
+        State state() const noexcept { return current; }
+        // Blocks up to 'timeout_ms' for 'state' or a later one. False on timeout, or once the
+        // connection has given up
+        bool wait_for(State state, u32 timeout_ms);
+
+        // Valid from State::ready
+        Server server() const;
+        // Valid from State::session
+        Session session() const;
+
+        // Where the audio goes, from State::session
+        VoiceUdp &transport() noexcept { return udp; }
+        // Speaking (op 5), due before any audio is sent
+        void speaking(bool microphone);
+
+        // Round trip of the last acknowledged heartbeat. 0 until the first ACK
+        u64 latency_us() const noexcept { return heartbeat_rtt_us; }
+
+    private:
+        enum class Opcodes : u8
+        {
+            Identify = 0,
+            SelectProtocol,
+            Ready,
+            Heartbeat,
+            SessionDescription,
+            Speaking,
+            HeartbeatACK,
+            Resume,
+            Hello,
+            Resumed,
+            ClientDisconnect = 13
+        };
+
+        WebSocket        ws;
+        VoiceUdp         udp;
+        std::thread      thread;
+        std::atomic_bool stopping { false };
+
+        // update() runs on the event loop and the rest on the voice thread
+        mutable std::mutex      mutex;
+        std::condition_variable state_cv;
+        std::string             user_id;
+        std::string             guild_id;
+        std::string             session_id;
+        std::string             token;
+        std::string             endpoint;
+        Server                  server_info;
+        Session                 description;
+        bool                    finished = true;    // The voice thread has nothing left to do
+
+        std::atomic<State>   current { State::disconnected };
+        std::atomic_uint64_t heartbeat_rtt_us { 0 };
+
+        // Voice thread only
+        u64  heartbeat_interval_us = 0;
+        u64  next_heartbeat_us     = 0;
+        u64  heartbeat_nonce       = 0;
+        bool acknowledged          = true;
+
+        std::array<WebSocket::IFrame, 16> inbound;
+
+        // Select Protocol (op 1): our address as seen from outside, from IP discovery, and one
+        // of Server::modes. Answered with a Session Description
+        void select_protocol(std::string_view address, u16 port, std::string_view mode);
+
+        void run();
+        // One connection, until it drops. Returns the close code, 0 without one
+        u16  service(bool resuming);
+        void handle(std::string_view payload, bool resuming);
+        void heartbeat();
+        void send(Opcodes op, std::string_view d);
+        void set_state(State state);
+    };
+}    // namespace discord
@@ -0,0 +1,306 @@
+#include "voice_receive.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <opus.h>
+
+#include "util/metrics.h"
+
+namespace
+{
+    constexpr u64 idle_us = 30'000'000;    // A speaker quiet this long is dropped
+}    // namespace
+
+discord::JitterBuffer::Push discord::JitterBuffer::push(
+  u16       sequence,
+  const u8 *payload,
+  size_t    length,
+  u64       now_us)
+{
+    Push result = Push::queued;
+    if (!started)
+    {
+        started = true;
+        next    = sequence;
+    }
+
+    i16 ahead = sequence - next;
+    if (ahead < 0) return Push::late;
+    if ((size_t) ahead >= capacity)
+    {
+        // Whatever was missing isn't coming back, start over from here
+        for (auto &slot : slots) slot.filled = false;
+        queued = 0;
+        next   = sequence;
+        result = Push::resync;
+    }
+
+    // Everything queued is within 'capacity' of 'next', so a filled slot is this sequence
+    Slot &into = slot(sequence);
+    if (into.filled) return Push::duplicate;
+    into.filled     = true;
+    into.sequence   = sequence;
+    into.length     = std::min(length, rtp::max_frame_size);
+    into.arrival_us = now_us;
+    std::memcpy(into.data, payload, into.length);
+    queued++;
+    return result;
+}
+
+bool discord::JitterBuffer::ready(u64 now_us) const
+{
+    if (queued == 0) return false;
+    if (slot(next).filled) return true;
+
+    // 'next' is missing. It gets the delay from when the first packet after it arrived
+    for (u16 sequence = next + 1; sequence != (u16) (next + capacity); sequence++)
+        if (slot(sequence).filled) return now_us - slot(sequence).arrival_us >= delay_us;
+    return false;
+}
+
+bool discord::JitterBuffer::pop(Popped &popped, u8 *out, u64 now_us)
+{
+    if (!ready(now_us)) return false;
+
+    Slot &current = slot(next);
+    if (current.filled)
+    {
+        popped = { next, false, current.length };
+        std::memcpy(out, current.data, current.length);
+        current.filled = false;
+        queued--;
+    }
+    else
+    {
+        // Given up on. The packet after it may have it again in its forward error correction
+        Slot &following = slot(next + 1);
+        popped          = { next, true, 0 };
+        if (following.filled)
+        {
+            popped.length = following.length;
+            std::memcpy(out, following.data, following.length);
+        }
+    }
+    next++;
+    return true;
+}
+
+discord::VoiceReceiver::Speaker::Speaker(u32 ssrc, u32 delay_ms) : ssrc(ssrc), buffer(delay_ms)
+{
+    int error;
+    decoder = opus_decoder_create(rtp::sample_rate, 2, &error);
+    if (error != OPUS_OK) std::__throw_runtime_error(opus_strerror(error));
+}
+
+discord::VoiceReceiver::Speaker::~Speaker()
+{
+    opus_decoder_destroy(decoder);
+}
+
+discord::VoiceReceiver::VoiceReceiver(Sink sink, size_t worker_count, u32 delay_ms) :
+    sink(std::move(sink)), delay_ms(delay_ms)
+{
+    for (size_t i = 0; i < worker_count; i++) workers.emplace_back(&VoiceReceiver::work, this);
+}
+
+discord::VoiceReceiver::~VoiceReceiver()
+{
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_cv.notify_all();
+    for (auto &worker : workers) worker.join();
+}
+
+void discord::VoiceReceiver::identify(u32 ssrc, std::string_view user_id)
+{
+    std::lock_guard<std::mutex> lock(speakers_mutex);
+    users[ssrc] = user_id;
+    if (auto it = speakers.find(ssrc); it != speakers.end())
+    {
+        std::lock_guard<std::mutex> speaker_lock(it->second->mutex);
+        it->second->user_id = user_id;
+    }
+}
+
+void discord::VoiceReceiver::forget(std::string_view user_id)
+{
+    std::lock_guard<std::mutex> lock(speakers_mutex);
+    for (auto it = users.begin(); it != users.end();)
+    {
+        if (it->second != user_id)
+        {
+            ++it;
+            continue;
+        }
+        // A worker may still hold it; the last reference frees it
+        speakers.erase(it->first);
+        it = users.erase(it);
+    }
+}
+
+void discord::VoiceReceiver::push(u32 ssrc, u16 sequence, const u8 *opus, size_t length)
+{
+    static auto &packets = metrics::registry().counter("voice_received_packets_total");
+    static auto &late    = metrics::registry().counter("voice_received_late_total");
+    static auto &ignored = metrics::registry().counter("voice_received_ignored_total");
+    // Once: it takes the registry's lock, and this is per packet on the receive thread
+    [[maybe_unused]] static const bool described = []
+    {
+        metrics::registry().describe(
+          "voice_received_late_total",
+          "Voice packets that arrived after they were played or given up on");
+        metrics::registry().describe(
+          "voice_received_ignored_total",
+          "Voice packets dropped for coming from more speakers than are kept");
+        return true;
+    }();
+
+    u64                      now = metrics::now_us();
+    std::shared_ptr<Speaker> speaker;
+    {
+        std::lock_guard<std::mutex> lock(speakers_mutex);
+        auto                        it = speakers.find(ssrc);
+        if (it == speakers.end())
+        {
+            if (speakers.size() >= max_speakers)
+            {
+                ignored.add();
+                return;
+            }
+            it = speakers.emplace(ssrc, std::make_shared<Speaker>(ssrc, delay_ms)).first;
+            if (auto user = users.find(ssrc); user != users.end())
+                it->second->user_id = user->second;
+        }
+        speaker = it->second;
+    }
+
+    bool ready;
+    {
+        std::lock_guard<std::mutex> lock(speaker->mutex);
+        if (speaker->buffer.push(sequence, opus, length, now) == JitterBuffer::Push::late)
+            late.add();
+        speaker->last_heard_us = now;
+        ready                  = speaker->buffer.ready(now);
+    }
+    packets.add();
+    if (ready) schedule(speaker);
+}
+
+void discord::VoiceReceiver::tick()
+{
+    static auto &speaking = metrics::registry().gauge("voice_speakers");
+
+    u64                                   now = metrics::now_us();
+    std::vector<std::shared_ptr<Speaker>> due;
+    {
+        std::lock_guard<std::mutex> lock(speakers_mutex);
+        bool                        sweep = now - last_sweep_us > 1'000'000;
+        for (auto it = speakers.begin(); it != speakers.end();)
+        {
+            bool idle, ready;
+            {
+                std::lock_guard<std::mutex> speaker_lock(it->second->mutex);
+                idle  = sweep && now - it->second->last_heard_us > idle_us;
+                ready = !idle && it->second->buffer.ready(now);
+            }
+            // Not under its lock: this may be the last reference, which takes the mutex with it
+            if (idle)
+            {
+                it = speakers.erase(it);
+                continue;
+            }
+            if (ready) due.push_back(it->second);
+            ++it;
+        }
+        if (sweep) last_sweep_us = now;
+        speaking.set(speakers.size());
+    }
+    for (auto &speaker : due) schedule(speaker);
+}
+
+void discord::VoiceReceiver::schedule(const std::shared_ptr<Speaker> &speaker)
+{
+    if (speaker->scheduled.exchange(true)) return;
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue.push_back(speaker);
+    }
+    queue_cv.notify_one();
+}
+
+void discord::VoiceReceiver::work()
+{
+    while (true)
+    {
+        std::shared_ptr<Speaker> speaker;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (stopping) return;
+            speaker = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        drain(*speaker);
+        speaker->scheduled = false;
+
+        // A push that landed after the last pop found it still scheduled and left it be
+        bool again;
+        {
+            std::lock_guard<std::mutex> lock(speaker->mutex);
+            again = speaker->buffer.ready(metrics::now_us());
+        }
+        if (again) schedule(speaker);
+    }
+}
+
+void discord::VoiceReceiver::drain(Speaker &speaker)
+{
+    static auto &decode_time = metrics::registry().histogram("voice_decode_microseconds");
+    static auto &lost        = metrics::registry().counter("voice_received_lost_total");
+    static auto &corrupt     = metrics::registry().counter("voice_decode_errors_total");
+    [[maybe_unused]] static const bool described = []
+    {
+        metrics::registry().describe(
+          "voice_received_lost_total",
+          "Voice packets given up on and concealed by the decoder");
+        return true;
+    }();
+
+    std::array<u8, rtp::max_frame_size>       packet;
+    std::array<float, rtp::frame_samples * 2> pcm;
+    std::string                               user_id;
+    JitterBuffer::Popped                      popped;
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(speaker.mutex);
+            if (!speaker.buffer.pop(popped, packet.data(), metrics::now_us())) break;
+            if (user_id.empty()) user_id = speaker.user_id;
+        }
+
+        // A lost packet is decoded from the next one's FEC data, or from nothing for plain
+        // concealment
+        int samples;
+        {
+            metrics::Timer timed(decode_time);
+            samples = opus_decode_float(
+              speaker.decoder,
+              popped.length > 0 ? packet.data() : nullptr,
+              popped.length,
+              pcm.data(),
+              rtp::frame_samples,
+              popped.lost && popped.length > 0);
+        }
+        if (popped.lost) lost.add();
+        if (samples < 0)
+        {
+            corrupt.add();
+            continue;
+        }
+        sink(Frame { speaker.ssrc, user_id, popped.sequence, popped.lost, pcm.data() });
+    }
+}
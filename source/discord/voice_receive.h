@@ -0,0 +1,151 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "util/types.h"
+#include "discord/rtp.h"
+
+struct OpusDecoder;
+
+namespace discord
+{
+    // One speaker's packets, put back in sequence order. A missing packet is waited on for
+    // 'delay_ms' from when a later one shows up, then given up as lost. Fixed size, so a
+    // speaker never holds more than 'capacity' frames however the network behaves
+    class JitterBuffer
+    {
+    public:
+        static constexpr size_t capacity = 64;    // 1.28 s of 20 ms frames
+
+        enum class Push : u8
+        {
+            queued,
+            late,         // Behind what was already played or given up on
+            duplicate,
+            resync        // Too far ahead to hold, so everything queued was dropped for it
+        };
+
+        struct Popped
+        {
+            u16  sequence;
+            bool lost;
+            // Bytes written to pop()'s 'out'. For a lost packet, the one after it if that is
+            // here, for its forward error correction; 0 if not
+            u16 length;
+        };
+
+        explicit JitterBuffer(u32 delay_ms = 60) : delay_us(delay_ms * 1000ull) { }
+
+        Push push(u16 sequence, const u8 *payload, size_t length, u64 now_us);
+        // The next packet in order into 'out', rtp::max_frame_size bytes, once it's here or
+        // has been given up on
+        bool pop(Popped &popped, u8 *out, u64 now_us);
+        bool ready(u64 now_us) const;
+
+        size_t size() const noexcept { return queued; }
+
+    private:
+        struct Slot
+        {
+            bool filled = false;
+            u16  sequence;
+            u16  length;
+            u64  arrival_us;
+            u8   data[rtp::max_frame_size];
+        };
+
+        std::array<Slot, capacity> slots;
+        u64                        delay_us;
+        bool                       started = false;
+        u16                        next    = 0;    // What plays next
+        size_t                     queued  = 0;
+
+        Slot &      slot(u16 sequence) noexcept { return slots[sequence % capacity]; }
+        const Slot &slot(u16 sequence) const noexcept { return slots[sequence % capacity]; }
+    };
+
+    // Inbound voice: a JitterBuffer and an Opus decoder per SSRC, fed by VoiceUdp's receive
+    // thread and decoded on a small pool of workers, so one slow sink doesn't hold up the
+    // socket. Each speaker is drained by one worker at a time, in order.
+    class VoiceReceiver
+    {
+    public:
+        static constexpr size_t max_speakers = 100;    // Past that, new SSRCs are ignored
+
+        struct Frame
+        {
+            u32              ssrc;
+            std::string_view user_id;    // From Speaking, empty until that arrives
+            u16              sequence;
+            // Lost, and made up by the decoder: from the next packet's forward error
+            // correction where it had some, packet loss concealment otherwise
+            bool         concealed;
+            const float *pcm;    // 20 ms of 48 kHz stereo
+        };
+        // Called from the workers; one frame at a time for any one speaker
+        using Sink = std::function<void(const Frame &frame)>;
+
+        explicit VoiceReceiver(Sink sink, size_t worker_count = 2, u32 delay_ms = 60);
+        ~VoiceReceiver();
+
+        VoiceReceiver(const VoiceReceiver &) = delete;
+        VoiceReceiver &operator=(const VoiceReceiver &) = delete;
+
+        // Who an SSRC is, from Speaking (op 5), and who left, from Client Disconnect (op 13)
+        void identify(u32 ssrc, std::string_view user_id);
+        void forget(std::string_view user_id);
+
+        // A decrypted Opus packet, from the receive thread
+        void push(u32 ssrc, u16 sequence, const u8 *opus, size_t length);
+        // Hands the workers whatever has waited out the delay, and drops speakers gone quiet.
+        // Every few milliseconds, from the receive thread
+        void tick();
+
+    private:
+        struct Speaker
+        {
+            Speaker(u32 ssrc, u32 delay_ms);
+            ~Speaker();
+
+            const u32 ssrc;
+
+            std::mutex   mutex;
+            std::string  user_id;
+            JitterBuffer buffer;
+            u64          last_heard_us = 0;
+
+            // Queued for or held by a worker, which alone uses 'decoder'
+            std::atomic_bool scheduled { false };
+            OpusDecoder *    decoder = nullptr;
+        };
+
+        Sink sink;
+        u32  delay_ms;
+
+        std::mutex                                        speakers_mutex;
+        std::unordered_map<u32, std::shared_ptr<Speaker>> speakers;
+        std::unordered_map<u32, std::string>              users;
+        u64                                               last_sweep_us = 0;
+
+        std::mutex                           queue_mutex;
+        std::condition_variable              queue_cv;
+        std::deque<std::shared_ptr<Speaker>> queue;
+        bool                                 stopping = false;
+        std::vector<std::thread>             workers;
+
+        void schedule(const std::shared_ptr<Speaker> &speaker);
+        void work();
+        void drain(Speaker &speaker);
+    };
+}    // namespace discord
@@ -0,0 +1,95 @@
+#include "voice_record.h"
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <iostream>
+
+#include <fmt/format.h>
+
+namespace
+{
+    constexpr u32 channels        = 2;
+    constexpr u32 bytes_per_frame = discord::rtp::frame_samples * channels * sizeof(i16);
+
+    void put16(u8 *out, u16 value)
+    {
+        out[0] = value;
+        out[1] = value >> 8;
+    }
+
+    void put32(u8 *out, u32 value)
+    {
+        put16(out, value);
+        put16(out + 2, value >> 16);
+    }
+
+    // A canonical 44 byte header for 'data_size' bytes of 16-bit PCM
+    void header(u8 *out, u32 data_size)
+    {
+        std::copy_n("RIFF", 4, out);
+        put32(out + 4, 36 + data_size);
+        std::copy_n("WAVEfmt ", 8, out + 8);
+        put32(out + 16, 16);
+        put16(out + 20, 1);    // PCM
+        put16(out + 22, channels);
+        put32(out + 24, discord::rtp::sample_rate);
+        put32(out + 28, discord::rtp::sample_rate * channels * sizeof(i16));
+        put16(out + 32, channels * sizeof(i16));
+        put16(out + 34, 16);
+        std::copy_n("data", 4, out + 36);
+        put32(out + 40, data_size);
+    }
+}    // namespace
+
+void discord::VoiceRecorder::write(const VoiceReceiver::Frame &frame)
+{
+    u8 pcm[bytes_per_frame];
+    for (size_t i = 0; i < rtp::frame_samples * channels; i++)
+    {
+        float sample = std::clamp(frame.pcm[i], -1.0f, 1.0f) * 32767.0f;
+        put16(pcm + i * sizeof(i16), (u16) (i16) std::lround(sample));
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto [it, added] = tracks.try_emplace(frame.ssrc);
+    auto &track      = it->second;
+    if (added)
+    {
+        auto path = fmt::format(
+          "{}/{}-{}.wav",
+          directory,
+          frame.user_id.empty() ? std::to_string(frame.ssrc) : std::string(frame.user_id),
+          std::time(nullptr));
+        track.file.open(path, std::ios::binary | std::ios::trunc);
+        if (!track.file)
+            std::cerr << "Could not open " << path << " to record voice into\n";
+
+        // Sizes are filled in once it's finished
+        u8 placeholder[44];
+        header(placeholder, 0);
+        track.file.write((const char *) placeholder, sizeof(placeholder));
+    }
+    if (!track.file) return;
+
+    track.file.write((const char *) pcm, sizeof(pcm));
+    track.frames++;
+}
+
+void discord::VoiceRecorder::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &[ssrc, track] : tracks) finish(track);
+    tracks.clear();
+}
+
+void discord::VoiceRecorder::finish(Track &track)
+{
+    if (!track.file) return;
+
+    u8 done[44];
+    header(done, track.frames * bytes_per_frame);
+    track.file.seekp(0);
+    track.file.write((const char *) done, sizeof(done));
+    track.file.close();
+}
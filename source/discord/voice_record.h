@@ -0,0 +1,45 @@
+#pragma once
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "util/types.h"
+#include "discord/voice_receive.h"
+
+namespace discord
+{
+    // A VoiceReceiver sink that writes each speaker to a WAV file of their own in 'directory',
+    // 48 kHz stereo 16-bit, named after their user id (their SSRC until Speaking says who they
+    // are) and when they were first heard. Only what was sent is kept: a speaker's silences
+    // aren't in their file, as Discord sends nothing for them
+    class VoiceRecorder
+    {
+    public:
+        explicit VoiceRecorder(std::string directory) : directory(std::move(directory)) { }
+        ~VoiceRecorder() { close(); }
+
+        VoiceRecorder(const VoiceRecorder &) = delete;
+        VoiceRecorder &operator=(const VoiceRecorder &) = delete;
+
+        // From the receiver's workers
+        void write(const VoiceReceiver::Frame &frame);
+        // Finishes every file. Frames after it start new ones
+        void close();
+
+    private:
+        struct Track
+        {
+            std::ofstream file;
+            u32           frames = 0;
+        };
+
+        std::string directory;
+
+        std::mutex                     mutex;
+        std::unordered_map<u32, Track> tracks;    // By SSRC
+
+        static void finish(Track &track);
+    };
+}    // namespace discord
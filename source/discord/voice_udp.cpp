@@ -0,0 +1,235 @@
+#include "voice_udp.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#if defined(__linux__)
+#include <sys/prctl.h>
+#endif
+
+#include "util/metrics.h"
+
+namespace
+{
+    constexpr u32 silence_frames  = 5;    // Sent after audio stops, as Discord asks
+    constexpr u32 discovery_tries = 3;    // It's UDP, the first one can get lost
+    constexpr u32 receive_tick_ms = 5;    // How often the jitter buffers are looked at
+}    // namespace
+
+discord::VoiceUdp::~VoiceUdp()
+{
+    close();
+}
+
+bool discord::VoiceUdp::connect(const std::string &ip, u16 port, u32 server_ssrc)
+{
+    close();
+
+    auto connected = ClientSocket::connect(ip, std::to_string(port), false, true);
+    if (!connected.is_valid()) return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    socket = std::move(connected);
+    keyed  = false;
+
+    // Random starting points, as RTP asks
+    std::random_device random;
+    ssrc      = server_ssrc;
+    sequence  = random();
+    timestamp = random();
+    nonce     = 0;
+    return true;
+}
+
+void discord::VoiceUdp::close()
+{
+    stop();
+    stop_listening();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (socket.is_valid()) socket.close();
+    keyed = false;
+}
+
+bool discord::VoiceUdp::discover(std::string &address, u16 &port, u32 timeout_ms)
+{
+    u8 request[rtp::discovery::size], response[rtp::discovery::size];
+    rtp::discovery::encode(request, rtp::discovery::request, ssrc);
+
+    for (u32 i = 0; i < discovery_tries; i++)
+    {
+        if (socket.send_bytes(request, sizeof(request)) != sizeof(request)) return false;
+        if (!socket.wait_readable(timeout_ms / discovery_tries)) continue;
+
+        i32 length = socket.read_bytes(response, sizeof(response));
+        u32 answered_ssrc;
+        if (length > 0 &&
+            rtp::discovery::decode(response, length, answered_ssrc, address, port) ==
+              rtp::discovery::response &&
+            answered_ssrc == ssrc)
+            return true;
+    }
+    std::cerr << "Voice IP discovery got no answer\n";
+    return false;
+}
+
+bool discord::VoiceUdp::set_session(std::string_view mode, const std::array<u8, 32> &key)
+{
+    if (mode != rtp::Cipher::mode)
+    {
+        std::cerr << "Voice encryption mode " << mode << " isn't supported\n";
+        return false;
+    }
+
+    // The listener opens packets with the same cipher, so not while rekeying
+    stop_listening();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cipher.set_key(key);
+        keyed = true;
+    }
+    if (auto *receiver = inbound.load())
+    {
+        listening = true;
+        listener  = std::thread(&VoiceUdp::listen, this, receiver);
+    }
+    return true;
+}
+
+bool discord::VoiceUdp::ready() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return keyed && socket.is_valid();
+}
+
+bool discord::VoiceUdp::send(const u8 *frame, size_t length)
+{
+    static auto &packets = metrics::registry().counter("voice_packets_sent_total");
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!keyed || !socket.is_valid() || length > rtp::max_frame_size) return false;
+
+    rtp::Header { sequence, timestamp, ssrc }.encode(packet.data());
+    size_t size = cipher.seal(packet.data(), rtp::Header::size, frame, length, nonce++);
+    sequence++;
+    timestamp += rtp::frame_samples;
+
+    packets.add();
+    return socket.send_bytes(packet.data(), size) == (i32) size;
+}
+
+void discord::VoiceUdp::skip()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    timestamp += rtp::frame_samples;
+}
+
+void discord::VoiceUdp::play(Source source)
+{
+    stop();
+    pacing = true;
+    pacer  = std::thread(&VoiceUdp::pace, this, std::move(source));
+}
+
+void discord::VoiceUdp::stop()
+{
+    pacing = false;
+    if (pacer.joinable()) pacer.join();
+}
+
+void discord::VoiceUdp::pace(Source source)
+{
+    using clock = std::chrono::steady_clock;
+
+    static auto &lateness = metrics::registry().histogram("voice_send_lateness_microseconds");
+    metrics::registry().describe(
+      "voice_send_lateness_microseconds",
+      "How far past its 20 ms deadline each voice frame went out");
+
+#if defined(__linux__)
+    // Sleeps overshoot by up to the timer slack, 50 us by default
+    prctl(PR_SET_TIMERSLACK, 1);
+#endif
+
+    std::array<u8, rtp::max_frame_size> frame;
+    u32                                 silence  = 0;
+    auto                                deadline = clock::now();
+    while (pacing)
+    {
+        std::this_thread::sleep_until(deadline);
+        auto now = clock::now();
+        lateness.record(std::chrono::duration_cast<std::chrono::microseconds>(now - deadline)
+                          .count());
+
+        size_t length = source(frame.data(), frame.size());
+        if (length > 0)
+        {
+            send(frame.data(), length);
+            silence = silence_frames;
+        }
+        else if (silence > 0)
+        {
+            send(rtp::silence_frame, sizeof(rtp::silence_frame));
+            silence--;
+        }
+        else
+            skip();
+
+        // Absolute deadlines, so lateness doesn't add up. After a long stall it starts over
+        // from now instead of bursting to catch up
+        deadline += std::chrono::milliseconds(rtp::frame_ms);
+        if (now - deadline > std::chrono::milliseconds(rtp::frame_ms * 5))
+            deadline = now + std::chrono::milliseconds(rtp::frame_ms);
+    }
+}
+
+void discord::VoiceUdp::stop_listening()
+{
+    listening = false;
+    if (listener.joinable()) listener.join();
+}
+
+void discord::VoiceUdp::listen(VoiceReceiver *receiver)
+{
+    static auto &rejected = metrics::registry().counter("voice_received_rejected_total");
+    metrics::registry().describe(
+      "voice_received_rejected_total",
+      "Inbound voice packets that didn't authenticate");
+
+    // Seals only touch the cipher's encrypting half, so opening needs no lock
+    std::array<u8, 2048> packet;
+    while (listening)
+    {
+        // Waking up regularly also gives the receiver its ticks
+        if (!socket.wait_readable(receive_tick_ms))
+        {
+            receiver->tick();
+            continue;
+        }
+        i32 length = socket.read_bytes(packet.data(), packet.size());
+        receiver->tick();
+        if (length < (i32) rtp::Header::size || (packet[0] & 0xC0) != 0x80) continue;
+
+        // RTCP shares the socket: payload types 72 to 76 once the marker bit is off
+        u8 type = packet[1] & 0x7F;
+        if (type >= 72 && type <= 76) continue;
+
+        size_t header_size = rtp::Header::size_of(packet.data());
+        i64    payload     = cipher.open(packet.data(), length, header_size);
+        if (payload < 0)
+        {
+            rejected.add();
+            continue;
+        }
+        size_t extension = rtp::Header::extension_size(packet.data());
+        if (extension > (size_t) payload) continue;
+
+        auto header = rtp::Header::decode(packet.data());
+        receiver->push(
+          header.ssrc,
+          header.sequence,
+          packet.data() + header_size + extension,
+          payload - extension);
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "util/types.h"
+#include "websocket/socket.h"
+#include "discord/rtp.h"
+#include "discord/voice_receive.h"
+
+namespace discord
+{
+    // The UDP half of a voice connection: IP discovery, then Opus frames sent as encrypted RTP
+    // packets on a 20 ms clock, and with a VoiceReceiver, everyone else's packets taken in on
+    // a thread of their own. Voice sets it up from Ready and the Session Description.
+    class VoiceUdp
+    {
+    public:
+        // Writes the next Opus frame into 'frame' and returns its length, 0 if there is nothing
+        // to play this tick. Called from the pacing thread, so it must not block
+        using Source = std::function<size_t(u8 *frame, size_t capacity)>;
+
+        VoiceUdp() = default;
+        ~VoiceUdp();
+
+        VoiceUdp(const VoiceUdp &) = delete;
+        VoiceUdp &operator=(const VoiceUdp &) = delete;
+
+        // To the voice server from Ready. Stops playing and resets the RTP stream
+        bool connect(const std::string &ip, u16 port, u32 ssrc);
+        void close();
+
+        // Our address and port as the voice server sees them, for Voice::select_protocol()
+        bool discover(std::string &address, u16 &port, u32 timeout_ms = 1000);
+
+        // Key from the Session Description. False if 'mode' isn't one we can encrypt
+        bool set_session(std::string_view mode, const std::array<u8, 32> &key);
+        bool ready() const;
+
+        // Seals 'frame' into the next packet and sends it, a frame's worth of samples on
+        bool send(const u8 *frame, size_t length);
+
+        // Asks 'source' for a frame every 20 ms from a thread of its own and sends it, against
+        // absolute deadlines so the pace doesn't drift. The RTP clock moves on whether or not
+        // there is audio, and the first few silent ticks after audio send Opus silence
+        void play(Source source);
+        void stop();
+        bool playing() const noexcept { return pacing; }
+
+        // Where inbound audio goes, from the next set_session() on. Without one nothing is
+        // read off the socket
+        void           set_receiver(VoiceReceiver *receiver) noexcept { inbound = receiver; }
+        VoiceReceiver *receiver() const noexcept { return inbound; }
+
+    private:
+        ClientSocket socket;
+        rtp::Cipher  cipher;
+
+        // send() can be called from anywhere while the pacing thread runs
+        mutable std::mutex mutex;
+        u32                ssrc      = 0;
+        u16                sequence  = 0;
+        u32                timestamp = 0;
+        u32                nonce     = 0;
+        bool               keyed     = false;    // A session for this connection
+
+        std::array<u8, rtp::Header::size + rtp::max_frame_size + rtp::Cipher::overhead> packet;
+
+        std::thread      pacer;
+        std::atomic_bool pacing { false };
+
+        std::atomic<VoiceReceiver *> inbound { nullptr };
+        std::thread                  listener;
+        std::atomic_bool             listening { false };
+
+        void pace(Source source);
+        void listen(VoiceReceiver *receiver);
+        void stop_listening();
+        // A tick with nothing sent, so receivers see the gap in the timestamps
+        void skip();
+    };
+}    // namespace discord
@@ -0,0 +1,64 @@
+#include "waiters.h"
+
+#include <algorithm>
+
+discord::EventWaiters::Next
+  discord::EventWaiters::next(Event event, Filter filter, u64 timeout_us)
+{
+    Next next;
+    next.waiters    = this;
+    next.event      = event;
+    next.filter     = std::move(filter);
+    next.timeout_us = timeout_us;
+    return next;
+}
+
+void discord::EventWaiters::Next::await_suspend(std::coroutine_handle<> handle)
+{
+    // Lives in the waiting coroutine's frame until it resumes
+    this->handle = handle;
+    id           = waiters->next_id++;
+    waiters->waiting.push_back(this);
+    if (timeout_us == 0) return;
+
+    // By id, as the event may have come first, and this be gone by the time it fires
+    timer = waiters->loop.after(
+      timeout_us,
+      [waiters = waiters, id = id]
+      {
+          auto &waiting = waiters->waiting;
+          auto  it      = std::find_if(
+            waiting.begin(),
+            waiting.end(),
+            [&](const Next *next) { return next->id == id; });
+          if (it != waiting.end()) waiters->resume(it - waiting.begin(), std::nullopt);
+      });
+}
+
+bool discord::EventWaiters::dispatch(Event event, std::string_view raw)
+{
+    for (size_t i = 0; i < waiting.size(); i++)
+    {
+        auto *next = waiting[i];
+        if (next->event != event || (next->filter && !next->filter(raw))) continue;
+        resume(i, std::string(raw));
+        return true;
+    }
+    return false;
+}
+
+void discord::EventWaiters::cancel_all()
+{
+    while (!waiting.empty()) resume(0, std::nullopt);
+}
+
+void discord::EventWaiters::resume(size_t index, std::optional<std::string> raw)
+{
+    auto *next = waiting[index];
+    waiting.erase(waiting.begin() + index);
+    if (next->timer) loop.cancel(next->timer);
+
+    // After whatever is being handled now, rather than in the middle of it
+    next->raw = std::move(raw);
+    loop.post(next->handle);
+}
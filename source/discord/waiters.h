@@ -0,0 +1,79 @@
+#pragma once
+
+#include <coroutine>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "discord/events.h"
+#include "util/event_loop.h"
+#include "util/types.h"
+
+namespace discord
+{
+    // Coroutines waiting on gateway events, e.g. a command waiting for the user's answer.
+    // Whoever handles events hands each to dispatch(), and the first waiter on its type whose
+    // filter takes it resumes with a copy of its 'd'. Only sees what the Gateway subscribed to.
+    // All on the EventLoop's thread
+    class EventWaiters
+    {
+    public:
+        using Filter = std::function<bool(std::string_view raw)>;
+
+        // What co_await next() gives
+        class Next
+        {
+        public:
+            bool                       await_ready() const noexcept { return false; }
+            void                       await_suspend(std::coroutine_handle<> handle);
+            std::optional<std::string> await_resume() noexcept { return std::move(raw); }
+
+        private:
+            friend class EventWaiters;
+
+            EventWaiters           *waiters;
+            Event                   event;
+            Filter                  filter;
+            u64                     timeout_us;
+            u64                     id    = 0;
+            u64                     timer = 0;
+            std::coroutine_handle<> handle;
+
+            std::optional<std::string> raw;
+        };
+
+        explicit EventWaiters(EventLoop &loop) : loop(loop) { }
+
+        // The next 'event' that 'filter' takes (any, without one). nullopt if none came within
+        // 'timeout_us', or cancel_all() came first. A 'timeout_us' of 0 waits indefinitely
+        Next next(Event event, Filter filter = {}, u64 timeout_us = 0);
+
+        // True if a waiter took it, so it needn't be handled as usual
+        bool dispatch(Event event, std::string_view raw);
+        // By the name in a dispatch's "t"
+        bool dispatch(std::string_view name, std::string_view raw)
+        {
+            auto event = event_of(name);
+            return event && dispatch(*event, raw);
+        }
+        // Everyone resumes with nullopt, e.g. to let their coroutines finish on shutdown
+        void cancel_all();
+
+        size_t size() const noexcept { return waiting.size(); }
+        bool   waiting_for(Event event) const noexcept
+        {
+            for (auto *next : waiting)
+                if (next->event == event) return true;
+            return false;
+        }
+
+    private:
+        EventLoop          &loop;
+        std::vector<Next *> waiting;    // Longest waiting first
+        u64                 next_id = 1;
+
+        void resume(size_t index, std::optional<std::string> raw);
+    };
+}    // namespace discord
@@ -5,6 +5,7 @@
 #include <filesystem>
 
 #include "GLSbot.h"
+#include "util/metrics.h"
 
 #include <json/json.hpp>
 
@@ -15,12 +16,33 @@ void sigint_callback(int signal)
     bot.close();
 }
 
-int main()
+int main(int argc, char **argv)
 {
     ::srand((u32) time(NULL));
 
+    std::string record_path;
+    std::string replay_path;
+    bool        realtime = true;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--record" && i + 1 < argc)
+            record_path = argv[++i];
+        else if (arg == "--replay" && i + 1 < argc)
+            replay_path = argv[++i];
+        else if (arg == "--fast")
+            realtime = false;
+        else
+        {
+            std::cout << "Usage: " << argv[0] << " [--record <file>] [--replay <file> [--fast]]\n";
+            return -1;
+        }
+    }
+
     std::string token;
     std::string user;
+    // A replay doesn't talk to Discord, so it can go without a config
+    if (replay_path.empty() || std::filesystem::exists("./config.json"))
     {
         std::string json;
         if (!std::filesystem::exists("./config.json"))
@@ -36,18 +58,92 @@ int main()
         auth.close();
 
         auto parsed = nlohmann::json::parse(json);
-        if (parsed.find("token") == parsed.end())
+        if (parsed.find("token") != parsed.end())
+            token = parsed["token"].get<std::string>();
+        else if (replay_path.empty())
         {
             std::cout << "Bot token non-existant!\n";
             return -1;
         }
-        token = parsed["token"].get<std::string>();
 
         if (parsed.find("owner_user") != parsed.end())
             user = parsed["owner_user"].get<std::string>();
+
+        if (parsed.find("gateway_url") != parsed.end())
+            bot.set_gateway_url(parsed["gateway_url"].get<std::string>());
+        if (parsed.find("api_url") != parsed.end())
+            bot.set_api_url(parsed["api_url"].get<std::string>());
+
+        if (parsed.find("metrics_port") != parsed.end())
+            metrics::serve(parsed["metrics_port"].get<u16>());
+
+        if (parsed.find("cache") != parsed.end())
+        {
+            auto &cache = parsed["cache"];
+
+            discord::Cache::Retention retention;
+            retention.guilds   = cache.value("guilds", retention.guilds);
+            retention.channels = cache.value("channels", retention.channels);
+            retention.members  = cache.value("members", retention.members);
+            bot.set_cache_retention(retention);
+        }
+
+        if (parsed.find("intents") != parsed.end())
+            bot.set_intents(parsed["intents"].get<u32>());
+
+        // "prefix": "!", "guild_prefixes": { "<guild id>": "?" }, "mention_prefix": true
+        bool prefixes_valid = true;
+        if (parsed.find("prefix") != parsed.end())
+            prefixes_valid &= bot.set_prefix(parsed["prefix"].get<std::string>());
+        if (parsed.find("guild_prefixes") != parsed.end())
+            for (auto &[guild, prefix] : parsed["guild_prefixes"].items())
+                prefixes_valid &= bot.set_guild_prefix(
+                  discord::to_snowflake(guild),
+                  prefix.get<std::string>());
+        if (!prefixes_valid)
+        {
+            std::cout << "Command prefixes can't be empty, or have quotes or backslashes\n";
+            return -1;
+        }
+        bot.set_mention_prefix(parsed.value("mention_prefix", false));
+
+        // Nothing is heard in a replay
+        if (parsed.find("voice_recordings") != parsed.end() && replay_path.empty() &&
+            !bot.set_voice_recordings(parsed["voice_recordings"].get<std::string>()))
+            return -1;
+
+        if (parsed.find("inbound_queue") != parsed.end())
+        {
+            auto &queue = parsed["inbound_queue"];
+
+            WebSocket::InboundLimit limit;
+            limit.frames  = queue.value("limit", limit.frames);
+            auto overflow = queue.value("overflow", std::string("block"));
+            if (overflow == "block")
+                limit.policy = WebSocket::Overflow::block;
+            else if (overflow == "drop")
+                limit.policy = WebSocket::Overflow::drop;
+            else if (overflow == "resume")
+                limit.policy = WebSocket::Overflow::disconnect;
+            else
+            {
+                std::cout << "inbound_queue.overflow must be block, drop or resume\n";
+                return -1;
+            }
+            bot.set_inbound_limit(std::move(limit));
+        }
     }
 
     signal(SIGINT, sigint_callback);
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN);    // Writes to a dropped connection fail instead of killing us
+#endif
+    if (!replay_path.empty())
+    {
+        bot.replay(replay_path, realtime, user);
+        return 0;
+    }
+    if (!record_path.empty() && !bot.record(record_path)) return -1;
     bot.start(token, user);
 
     return 0;
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "util/types.h"
+
+// Monotonic bump allocator. Individual frees are no-ops; everything is released at once
+// by reset(), which keeps the chunks around so a warmed-up arena never touches malloc.
+class Arena
+{
+public:
+    struct Stats
+    {
+        u64 allocations;          // Requests served, i.e. mallocs that didn't happen
+        u64 bytes;                // Bytes handed out
+        u64 chunk_allocations;    // Actual mallocs
+        u64 resets;
+    };
+
+    explicit Arena(size_t chunk_size = 64 * 1024) : chunk_size(chunk_size), stats_ {} { }
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(size_t size, size_t align = alignof(std::max_align_t))
+    {
+        stats_.allocations++;
+        stats_.bytes += size;
+
+        while (current < chunks.size())
+        {
+            auto & chunk = chunks[current];
+            size_t start = (offset + align - 1) & ~(align - 1);
+            if (start + size <= chunk.size)
+            {
+                offset = start + size;
+                return chunk.data.get() + start;
+            }
+            current++;
+            offset = 0;
+        }
+
+        // Oversized requests get a chunk of their own
+        size_t size_needed = std::max(chunk_size, size + align);
+        chunks.push_back({ std::make_unique<std::byte[]>(size_needed), size_needed });
+        stats_.chunk_allocations++;
+
+        current      = chunks.size() - 1;
+        auto * data  = chunks.back().data.get();
+        size_t start = (((uintptr_t) data + align - 1) & ~(uintptr_t) (align - 1)) - (uintptr_t) data;
+        offset       = start + size;
+        return data + start;
+    }
+
+    void reset() noexcept
+    {
+        // Oversized chunks (a huge GUILD_CREATE) aren't worth keeping around
+        chunks.erase(
+          std::remove_if(
+            chunks.begin(),
+            chunks.end(),
+            [&](const Chunk &chunk) { return chunk.size > chunk_size; }),
+          chunks.end());
+        current = 0;
+        offset  = 0;
+        stats_.resets++;
+    }
+
+    const Stats &stats() const noexcept { return stats_; }
+    size_t       capacity() const noexcept
+    {
+        size_t total = 0;
+        for (auto &chunk : chunks) total += chunk.size;
+        return total;
+    }
+
+    // Makes 'arena' the one ArenaAllocator uses on this thread, and resets it on exit
+    class Scope
+    {
+    public:
+        explicit Scope(Arena &arena) : arena(arena), previous(active_arena())
+        {
+            active_arena() = &arena;
+        }
+        ~Scope()
+        {
+            active_arena() = previous;
+            arena.reset();
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Arena &arena;
+        Arena *previous;
+    };
+
+    // Arena allocations go to, or nullptr outside of a Scope
+    static Arena *active() noexcept { return active_arena(); }
+
+private:
+    struct Chunk
+    {
+        std::unique_ptr<std::byte[]> data;
+        size_t                       size;
+    };
+
+    size_t             chunk_size;
+    std::vector<Chunk> chunks;
+    size_t             current = 0;
+    size_t             offset  = 0;
+    Stats              stats_;
+
+    static Arena *&active_arena() noexcept
+    {
+        thread_local Arena *arena = nullptr;
+        return arena;
+    }
+};
+
+// Stateless allocator over the thread's active Arena, falling back to the heap outside of one.
+// Stateless because nlohmann::basic_json default-constructs its allocators, so whichever one
+// frees a node can't know where it came from. Every allocation carries that in the byte just
+// before it instead, in a header of alignof(T) bytes, and a free is a single load
+template<typename T>
+struct ArenaAllocator
+{
+    using value_type = T;
+
+    ArenaAllocator() noexcept = default;
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U> &) noexcept
+    { }
+
+    T *allocate(size_t n)
+    {
+        static_assert(alignof(T) <= alignof(std::max_align_t), "Over-aligned types unsupported");
+        constexpr size_t header = alignof(T);
+        if (n > (SIZE_MAX - header) / sizeof(T)) throw std::bad_array_new_length();
+
+        std::byte *data;
+        std::byte  source;
+        if (Arena *arena = Arena::active())
+        {
+            data   = static_cast<std::byte *>(arena->allocate(header + n * sizeof(T), alignof(T)));
+            source = from_arena;
+        }
+        else
+        {
+            data   = static_cast<std::byte *>(::operator new(header + n * sizeof(T)));
+            source = from_heap;
+        }
+        data[header - 1] = source;
+        return reinterpret_cast<T *>(data + header);
+    }
+
+    void deallocate(T *ptr, size_t) noexcept
+    {
+        constexpr size_t header = alignof(T);
+        auto            *data = reinterpret_cast<std::byte *>(ptr) - header;
+        if (data[header - 1] == from_arena) return;    // Goes with the arena's next reset()
+        ::operator delete(data);
+    }
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U> &) const noexcept
+    {
+        return true;
+    }
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U> &) const noexcept
+    {
+        return false;
+    }
+
+private:
+    static constexpr std::byte from_heap  = std::byte { 0 };
+    static constexpr std::byte from_arena = std::byte { 1 };
+};
@@ -0,0 +1,167 @@
+#include "event_loop.h"
+
+#include <chrono>
+#include <iostream>
+
+#include "util/metrics.h"
+
+namespace
+{
+    thread_local EventLoop *running = nullptr;
+
+    // Owns itself: starts straight away and frees its frame once done, unlike Task
+    struct Detached
+    {
+        struct promise_type
+        {
+            Detached           get_return_object() const noexcept { return {}; }
+            std::suspend_never initial_suspend() const noexcept { return {}; }
+            std::suspend_never final_suspend() const noexcept { return {}; }
+            void               return_void() const noexcept { }
+            void               unhandled_exception() const noexcept { std::terminate(); }
+        };
+    };
+
+    Detached run_detached(Task<> task, size_t &tasks)
+    {
+        static auto &in_flight = metrics::registry().gauge("event_loop_tasks_in_flight");
+        [[maybe_unused]] static const bool described = []
+        {
+            metrics::registry().describe(
+              "event_loop_tasks_in_flight",
+              "Spawned coroutines, e.g. command handlers, that haven't finished yet");
+            return true;
+        }();
+
+        tasks++;
+        in_flight.add(1);
+        try
+        {
+            co_await std::move(task);
+        }
+        catch (const std::exception &e)
+        {
+            // One handler falling over is no reason to take the rest with it
+            std::cerr << "Task failed: " << e.what() << "\n";
+        }
+        catch (...)
+        {
+            std::cerr << "Task failed with an unknown exception\n";
+        }
+        tasks--;
+        in_flight.add(-1);
+    }
+}    // namespace
+
+EventLoop::~EventLoop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    timer_cv.notify_one();
+    if (timer_thread.joinable()) timer_thread.join();
+}
+
+EventLoop *EventLoop::current() noexcept
+{
+    return running;
+}
+
+void EventLoop::post(std::function<void()> work)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready.push_back(std::move(work));
+    }
+    posted.notify_one();
+    if (wake) wake();
+}
+
+u64 EventLoop::after(u64 delay_us, std::function<void()> work)
+{
+    u64 id;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        id = next_timer++;
+        timers.push({ metrics::now_us() + delay_us, id });
+        timer_work.emplace(id, std::move(work));
+        if (!timer_thread.joinable()) timer_thread = std::thread(&EventLoop::run_timers, this);
+    }
+    timer_cv.notify_one();
+    return id;
+}
+
+bool EventLoop::cancel(u64 timer)
+{
+    // Its entry in 'timers' stays, and is skipped once due
+    std::lock_guard<std::mutex> lock(mutex);
+    return timer_work.erase(timer) > 0;
+}
+
+size_t EventLoop::poll()
+{
+    EventLoop *outer = std::exchange(running, this);
+
+    size_t                             ran = 0;
+    std::vector<std::function<void()>> batch;
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (ready.empty()) break;
+            batch.swap(ready);
+        }
+        for (auto &work : batch) work();
+        ran += batch.size();
+        batch.clear();
+    }
+
+    running = outer;
+    return ran;
+}
+
+void EventLoop::wait(u64 timeout_us)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    posted.wait_for(lock, std::chrono::microseconds(timeout_us), [&] { return !ready.empty(); });
+}
+
+void EventLoop::spawn(Task<> task)
+{
+    EventLoop *outer = std::exchange(running, this);
+    run_detached(std::move(task), tasks);
+    running = outer;
+}
+
+void EventLoop::run_timers()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping)
+    {
+        if (timers.empty())
+        {
+            timer_cv.wait(lock);
+            continue;
+        }
+
+        u64 now = metrics::now_us();
+        if (timers.top().due_us > now)
+        {
+            timer_cv.wait_for(lock, std::chrono::microseconds(timers.top().due_us - now));
+            continue;
+        }
+
+        u64 id = timers.top().id;
+        timers.pop();
+        auto it = timer_work.find(id);
+        if (it == timer_work.end()) continue;    // Cancelled
+        ready.push_back(std::move(it->second));
+        timer_work.erase(it);
+
+        lock.unlock();
+        posted.notify_one();
+        if (wake) wake();
+        lock.lock();
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <condition_variable>
+#include <coroutine>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "util/task.h"
+#include "util/types.h"
+
+// Runs coroutines on whichever thread calls poll(), one at a time, so they can share that
+// thread's state without locks. Anything that would block (a request, a timer) resumes them
+// by posting back here from elsewhere; meanwhile they hold no thread at all, so any number
+// can be waiting at once.
+// The owner's thread usually sleeps on something else, so set_wake() to be interrupted when
+// there's work
+class EventLoop
+{
+public:
+    EventLoop() = default;
+    ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    // The loop that is running on this thread, if any
+    static EventLoop *current() noexcept;
+
+    // Called from whichever thread posts, whenever there's something new to run
+    void set_wake(std::function<void()> wake) { this->wake = std::move(wake); }
+
+    // From any thread. Runs on the next poll()
+    void post(std::function<void()> work);
+    void post(std::coroutine_handle<> handle)
+    {
+        post([handle] { handle.resume(); });
+    }
+
+    // Runs 'work' here once 'delay_us' has passed, unless cancel()ed first. From any thread
+    u64  after(u64 delay_us, std::function<void()> work);
+    bool cancel(u64 timer);
+
+    // Runs whatever is ready, including anything that posts while it runs. Returns how much
+    size_t poll();
+    // Sleeps until something is posted, for up to 'timeout_us'. For an owner with nothing
+    // else to wait on
+    void wait(u64 timeout_us);
+
+    // Starts 'task' on this thread and now, up to its first suspension, then leaves it to
+    // finish on its own. Whatever it throws is logged
+    void   spawn(Task<> task);
+    size_t in_flight() const noexcept { return tasks; }
+
+    // co_await loop.sleep_for(us): resumes on this loop once 'us' has passed
+    auto sleep_for(u64 us)
+    {
+        struct Awaiter
+        {
+            EventLoop &loop;
+            u64        us;
+
+            bool await_ready() const noexcept { return us == 0; }
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                loop.after(us, [handle] { handle.resume(); });
+            }
+            void await_resume() const noexcept { }
+        };
+        return Awaiter { *this, us };
+    }
+
+private:
+    struct Timer
+    {
+        u64 due_us;
+        u64 id;
+
+        bool operator>(const Timer &other) const noexcept { return due_us > other.due_us; }
+    };
+
+    std::function<void()> wake;
+    size_t                tasks = 0;    // Spawned and not finished. Only touched by poll()ing
+
+    std::mutex                         mutex;
+    std::condition_variable            posted;
+    std::vector<std::function<void()>> ready;
+
+    // Due ones are posted by a thread of their own, started with the first timer
+    std::thread                                                    timer_thread;
+    std::condition_variable                                        timer_cv;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<>> timers;
+    std::unordered_map<u64, std::function<void()>>                 timer_work;
+    u64                                                            next_timer = 1;
+    bool                                                           stopping   = false;
+
+    void run_timers();
+};
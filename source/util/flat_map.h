@@ -0,0 +1,137 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <functional>
+
+#include "util/types.h"
+
+// Open-addressing hash map with linear probing, for small trivially movable values.
+// A default-constructed Key marks an empty slot, so it can never be inserted
+// (snowflakes are never 0, so this is fine for everything we key on).
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class FlatMap
+{
+public:
+    FlatMap() = default;
+
+    Value *find(const Key &key) noexcept
+    {
+        if (_size == 0) return nullptr;
+        for (size_t i = slot(key);; i = (i + 1) & mask())
+        {
+            if (keys[i] == key) return &values[i];
+            if (keys[i] == Key {}) return nullptr;
+        }
+    }
+    const Value *find(const Key &key) const noexcept
+    {
+        return const_cast<FlatMap *>(this)->find(key);
+    }
+
+    // Returns the slot for 'key' and whether it was newly created
+    std::pair<Value *, bool> insert(const Key &key)
+    {
+        if ((_size + 1) * 4 > keys.size() * 3) rehash(keys.empty() ? 16 : keys.size() * 2);
+
+        size_t i = slot(key);
+        for (; keys[i] != Key {}; i = (i + 1) & mask())
+            if (keys[i] == key) return { &values[i], false };
+
+        keys[i]   = key;
+        values[i] = Value {};
+        _size++;
+        return { &values[i], true };
+    }
+
+    bool erase(const Key &key) noexcept
+    {
+        if (_size == 0) return false;
+
+        size_t i = slot(key);
+        for (; keys[i] != key; i = (i + 1) & mask())
+            if (keys[i] == Key {}) return false;
+
+        // Backward-shift deletion, so lookups never need tombstones
+        for (size_t j = (i + 1) & mask(); keys[j] != Key {}; j = (j + 1) & mask())
+        {
+            size_t home = slot(keys[j]);
+            if (((j - home) & mask()) >= ((j - i) & mask()))
+            {
+                keys[i]   = keys[j];
+                values[i] = std::move(values[j]);
+                i         = j;
+            }
+        }
+        keys[i]   = Key {};
+        values[i] = Value {};
+        _size--;
+        return true;
+    }
+
+    template<typename F>
+    void for_each(F &&func) const
+    {
+        for (size_t i = 0; i < keys.size(); i++)
+            if (keys[i] != Key {}) func(keys[i], values[i]);
+    }
+
+    // Erases every entry 'pred' returns true for
+    template<typename F>
+    void erase_if(F &&pred)
+    {
+        std::vector<Key> doomed;
+        for_each(
+          [&](const Key &key, const Value &value)
+          {
+              if (pred(key, value)) doomed.push_back(key);
+          });
+        for (auto &key : doomed) erase(key);
+    }
+
+    void clear()
+    {
+        keys.clear();
+        values.clear();
+        _size = 0;
+    }
+
+    size_t size() const noexcept { return _size; }
+    size_t capacity() const noexcept { return keys.size(); }
+    size_t memory_usage() const noexcept
+    {
+        return keys.capacity() * sizeof(Key) + values.capacity() * sizeof(Value);
+    }
+
+private:
+    // Keys and values are kept apart so probing only touches the key array
+    std::vector<Key>   keys;
+    std::vector<Value> values;
+    size_t             _size = 0;
+
+    size_t mask() const noexcept { return keys.size() - 1; }
+    size_t slot(const Key &key) const noexcept
+    {
+        // fmix64 from MurmurHash3. Snowflakes have most of their entropy in the high bits
+        u64 h = Hash {}(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h & mask();
+    }
+
+    void rehash(size_t new_capacity)
+    {
+        std::vector<Key>   old_keys   = std::move(keys);
+        std::vector<Value> old_values = std::move(values);
+
+        keys.assign(new_capacity, Key {});
+        values.assign(new_capacity, Value {});
+        _size = 0;
+
+        for (size_t i = 0; i < old_keys.size(); i++)
+            if (old_keys[i] != Key {}) *insert(old_keys[i]).first = std::move(old_values[i]);
+    }
+};
@@ -0,0 +1,160 @@
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <utility>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    size_t page_size() noexcept
+    {
+#if defined(_WIN32)
+        static const size_t size = [] {
+            SYSTEM_INFO info;
+            GetSystemInfo(&info);
+            return (size_t) info.dwPageSize;
+        }();
+#else
+        static const size_t size = sysconf(_SC_PAGESIZE);
+#endif
+        return size;
+    }
+}    // namespace
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+{
+    *this = std::move(other);
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept
+{
+    if (this == &other) return *this;
+    close();
+    _data      = std::exchange(other._data, nullptr);
+    _size      = std::exchange(other._size, 0);
+    prefetched = std::exchange(other.prefetched, 0);
+    released   = std::exchange(other.released, 0);
+    return *this;
+}
+
+bool MappedFile::open(const std::string &path)
+{
+    close();
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(
+      path.c_str(),
+      GENERIC_READ,
+      FILE_SHARE_READ,
+      nullptr,
+      OPEN_EXISTING,
+      FILE_FLAG_SEQUENTIAL_SCAN,
+      nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    HANDLE        mapping = nullptr;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping)
+    {
+        // The view keeps both alive
+        _data = (const u8 *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        _size = _data ? (size_t) size.QuadPart : 0;
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            _data = (const u8 *) mapping;
+            _size = info.st_size;
+            // Bigger readahead, and pages behind go first when memory is short
+            madvise(mapping, _size, MADV_SEQUENTIAL);
+        }
+    }
+    ::close(fd);    // The mapping keeps it alive
+#endif
+    if (!_data) return false;
+    advance(0);
+    return true;
+}
+
+void MappedFile::close() noexcept
+{
+    if (!_data) return;
+#if defined(_WIN32)
+    UnmapViewOfFile(_data);
+#else
+    munmap((void *) _data, _size);
+#endif
+    _data      = nullptr;
+    _size      = 0;
+    prefetched = 0;
+    released   = 0;
+}
+
+void MappedFile::advance(size_t offset) noexcept
+{
+    if (!_data) return;
+    offset = std::min(offset, _size);
+
+    // Half a window before running out, so the next one is in by the time it's read
+    if (prefetched < _size && offset + window / 2 >= prefetched)
+    {
+        size_t from  = std::max(prefetched, offset);
+        size_t until = std::min(_size, offset + window);
+        prefetch(from, until - from);
+        prefetched = until;
+    }
+
+    // A window at a time, rather than a syscall every read
+    if (offset >= released + window * 2)
+    {
+        size_t until = (offset - window) & ~(page_size() - 1);
+        release(released, until - released);
+        released = until;
+    }
+}
+
+void MappedFile::prefetch(size_t from, size_t length) noexcept
+{
+    size_t start = from & ~(page_size() - 1);
+    length += from - start;
+#if defined(_WIN32)
+    WIN32_MEMORY_RANGE_ENTRY range { (void *) (_data + start), length };
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+    madvise((void *) (_data + start), length, MADV_WILLNEED);
+#endif
+}
+
+void MappedFile::release(size_t from, size_t length) noexcept
+{
+    // Only unmaps them from us. The file is unchanged and the page cache keeps them for
+    // anyone else playing it
+#if defined(_WIN32)
+    VirtualUnlock((void *) (_data + from), length);    // Unlocked pages leave the working set
+#else
+    madvise((void *) (_data + from), length, MADV_DONTNEED);
+#endif
+}
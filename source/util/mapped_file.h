@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "util/types.h"
+
+// A file mapped read-only, for reading front to back without holding it all in memory. The
+// kernel pages it in on demand; advance() asks for the next stretch ahead of time and lets go
+// of what is well behind, so a long file costs a window's worth of resident memory however
+// far in it is, and any number of readers of one file share the page cache.
+class MappedFile
+{
+public:
+    static constexpr size_t window = 256 * 1024;    // Read ahead, and kept behind
+
+    MappedFile() noexcept = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    MappedFile(MappedFile &&) noexcept;
+    MappedFile &operator=(MappedFile &&) noexcept;
+
+    bool open(const std::string &path);
+    void close() noexcept;
+
+    const u8 *data() const noexcept { return _data; }
+    size_t    size() const noexcept { return _size; }
+    bool      is_open() const noexcept { return _data != nullptr; }
+
+    // The reader is at 'offset'. Cheap enough to call on every read
+    void advance(size_t offset) noexcept;
+
+private:
+    const u8 *_data = nullptr;
+    size_t    _size = 0;
+
+    size_t prefetched = 0;    // Asked for up to here
+    size_t released   = 0;    // Let go of up to here
+
+    void prefetch(size_t from, size_t length) noexcept;
+    void release(size_t from, size_t length) noexcept;
+};
@@ -0,0 +1,196 @@
+#include "metrics.h"
+
+#include <iostream>
+#include <thread>
+
+#include "websocket/socket.h"
+
+#include <fmt/format.h>
+
+u64 metrics::Histogram::quantile(double q) const noexcept
+{
+    u64 n = count();
+    if (n == 0) return 0;
+
+    u64 rank = std::max(u64(1), u64(q * n + 0.5));
+    u64 seen = 0;
+    for (size_t i = 0; i < bucket_count; i++)
+    {
+        seen += bucket(i);
+        if (seen >= rank) return upper_bound(i);
+    }
+    return upper_bound(bucket_count - 1);
+}
+
+metrics::Registry::Family &metrics::Registry::family(std::string_view name, Type type)
+{
+    auto it = families.find(name);
+    if (it == families.end()) it = families.emplace(std::string(name), Family {}).first;
+    it->second.type = type;
+    return it->second;
+}
+
+metrics::Counter &metrics::Registry::counter(std::string_view name, std::string_view labels)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &series = family(name, Type::counter).counters[std::string(labels)];
+    if (!series) series = std::make_unique<Counter>();
+    return *series;
+}
+
+metrics::Gauge &metrics::Registry::gauge(std::string_view name, std::string_view labels)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &series = family(name, Type::gauge).gauges[std::string(labels)];
+    if (!series) series = std::make_unique<Gauge>();
+    return *series;
+}
+
+metrics::Histogram &metrics::Registry::histogram(std::string_view name, std::string_view labels)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &series = family(name, Type::histogram).histograms[std::string(labels)];
+    if (!series) series = std::make_unique<Histogram>();
+    return *series;
+}
+
+void metrics::Registry::gauge_fn(
+  std::string_view     name,
+  std::function<i64()> read,
+  const void *         owner)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &                      gauge = family(name, Type::gauge);
+    gauge.read                        = std::move(read);
+    gauge.read_owner                  = owner;
+}
+
+void metrics::Registry::remove_fn(std::string_view name, const void *owner)
+{
+    // prometheus() calls it under the same lock, so it's done with it once this has the lock
+    std::lock_guard<std::mutex> lock(mutex);
+    auto                        it = families.find(name);
+    if (it == families.end() || it->second.read_owner != owner) return;
+    it->second.read       = nullptr;
+    it->second.read_owner = nullptr;
+}
+
+void metrics::Registry::describe(std::string_view name, std::string_view help)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = families.find(name);
+    if (it == families.end()) it = families.emplace(std::string(name), Family {}).first;
+    it->second.help = help;
+}
+
+std::string metrics::Registry::prometheus() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string                 out;
+
+    auto series = [](std::string_view name, std::string_view labels)
+    {
+        if (labels.empty()) return std::string(name);
+        return fmt::format("{}{{{}}}", name, labels);
+    };
+
+    for (auto &[name, family] : families)
+    {
+        if (!family.help.empty()) out += fmt::format("# HELP {} {}\n", name, family.help);
+
+        switch (family.type)
+        {
+        case Type::counter:
+        {
+            out += fmt::format("# TYPE {} counter\n", name);
+            for (auto &[labels, counter] : family.counters)
+                out += fmt::format("{} {}\n", series(name, labels), counter->value());
+        }
+        break;
+        case Type::gauge:
+        {
+            out += fmt::format("# TYPE {} gauge\n", name);
+            for (auto &[labels, gauge] : family.gauges)
+                out += fmt::format("{} {}\n", series(name, labels), gauge->value());
+            if (family.read) out += fmt::format("{} {}\n", name, family.read());
+        }
+        break;
+        case Type::histogram:
+        {
+            out += fmt::format("# TYPE {} histogram\n", name);
+            for (auto &[labels, histogram] : family.histograms)
+            {
+                // Exported at power-of-two boundaries; the fine buckets are for quantile()
+                std::string prefix = labels.empty() ? "" : labels + ",";
+                u64         total  = histogram->count();
+                u64         seen   = 0;
+                for (size_t i = 0; i < Histogram::bucket_count && seen < total; i++)
+                {
+                    seen += histogram->bucket(i);
+                    if (i >= 16 && (i - 16) % 8 != 7) continue;
+                    out += fmt::format(
+                      "{}_bucket{{{}le=\"{}\"}} {}\n",
+                      name,
+                      prefix,
+                      Histogram::upper_bound(i),
+                      seen);
+                }
+                out += fmt::format("{}_bucket{{{}le=\"+Inf\"}} {}\n", name, prefix, total);
+                out += fmt::format("{} {}\n", series(name + "_sum", labels), histogram->sum());
+                out += fmt::format("{} {}\n", series(name + "_count", labels), total);
+            }
+        }
+        break;
+        }
+    }
+    return out;
+}
+
+metrics::Registry &metrics::registry()
+{
+    // Never destroyed, as detached threads may still be recording while the process exits
+    static Registry *registry = new Registry();
+    return *registry;
+}
+
+bool metrics::serve(u16 port)
+{
+    auto server =
+      std::make_shared<ServerSocket>(ServerSocket::listen("127.0.0.1", std::to_string(port)));
+    if (!server->is_valid()) return false;
+
+    std::thread(
+      [server]()
+      {
+          std::string request(4096, '\0');
+          while (server->is_valid())
+          {
+              ClientSocket client = server->accept();
+              if (!client.is_valid()) continue;
+
+              i32 len = client.read_bytes((u8 *) request.data(), request.size());
+              if (len <= 0) continue;
+
+              std::string_view line(request.data(), len);
+              std::string      response;
+              if (line.substr(0, 13) == "GET /metrics " || line.substr(0, 6) == "GET / ")
+              {
+                  std::string body = registry().prometheus();
+                  response         = fmt::format(
+                    "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                    "Content-Length: {}\r\nConnection: close\r\n\r\n{}",
+                    body.size(),
+                    body);
+              }
+              else
+                  response =
+                    "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+              client.send_bytes((u8 *) response.data(), response.size());
+          }
+      })
+      .detach();
+
+    std::cout << "Serving metrics on 127.0.0.1:" << port << "\n";
+    return true;
+}
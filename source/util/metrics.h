@@ -0,0 +1,164 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "util/types.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Process-wide counters, gauges and histograms. Recording is a relaxed atomic add, so they
+// can sit on hot paths. Scraped as Prometheus text from a local port (see serve()).
+namespace metrics
+{
+    inline u64 now_us() noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                 std::chrono::steady_clock::now().time_since_epoch())
+          .count();
+    }
+
+    class Counter
+    {
+    public:
+        void add(u64 n = 1) noexcept { count.fetch_add(n, std::memory_order_relaxed); }
+        u64  value() const noexcept { return count.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<u64> count { 0 };
+    };
+
+    class Gauge
+    {
+    public:
+        void set(i64 n) noexcept { current.store(n, std::memory_order_relaxed); }
+        void add(i64 n) noexcept { current.fetch_add(n, std::memory_order_relaxed); }
+        i64  value() const noexcept { return current.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<i64> current { 0 };
+    };
+
+    // Log-linear buckets, HDR style: exact below 16, then 8 sub-buckets per power of two,
+    // so any recorded value is off by at most 12.5%
+    class Histogram
+    {
+    public:
+        static constexpr size_t bucket_count = 16 + 60 * 8;
+
+        void record(u64 value) noexcept
+        {
+            buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+            total.fetch_add(1, std::memory_order_relaxed);
+            sum_.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        u64 count() const noexcept { return total.load(std::memory_order_relaxed); }
+        u64 sum() const noexcept { return sum_.load(std::memory_order_relaxed); }
+        u64 bucket(size_t index) const noexcept
+        {
+            return buckets[index].load(std::memory_order_relaxed);
+        }
+
+        // Upper bound of the bucket the q-th quantile falls in. 0 if empty
+        u64 quantile(double q) const noexcept;
+
+        static size_t bucket_of(u64 value) noexcept
+        {
+            if (value < 16) return value;
+#if defined(_MSC_VER)
+            unsigned long exponent;
+            _BitScanReverse64(&exponent, value);
+#else
+            u32 exponent = 63 - __builtin_clzll(value);
+#endif
+            return 16 + (exponent - 4) * 8 + ((value >> (exponent - 3)) & 7);
+        }
+        // Largest value that lands in 'index'
+        static u64 upper_bound(size_t index) noexcept
+        {
+            if (index < 16) return index;
+            u32 exponent = (index - 16) / 8 + 4;
+            u64 sub      = (index - 16) % 8;
+            return ((8 + sub + 1) << (exponent - 3)) - 1;
+        }
+
+    private:
+        std::array<std::atomic<u64>, bucket_count> buckets {};
+        std::atomic<u64>                           total { 0 };
+        std::atomic<u64>                           sum_ { 0 };
+    };
+
+    // Records the microseconds between construction, or 'start' if it happened earlier, and
+    // destruction
+    class Timer
+    {
+    public:
+        explicit Timer(Histogram &histogram, u64 start = now_us()) noexcept :
+            histogram(histogram), start(start)
+        { }
+        ~Timer() { histogram.record(now_us() - start); }
+
+    private:
+        Histogram &histogram;
+        u64        start;
+    };
+
+    // Metrics live as long as the process, so returned references never dangle.
+    // 'labels' is the preformatted inside of the braces, e.g. type="READY"
+    class Registry
+    {
+    public:
+        Counter &  counter(std::string_view name, std::string_view labels = {});
+        Gauge &    gauge(std::string_view name, std::string_view labels = {});
+        Histogram &histogram(std::string_view name, std::string_view labels = {});
+
+        // Gauge read at scrape time. Registering the same name again replaces it. 'owner' is
+        // whatever 'read' reads from, which removes it with remove_fn() before it goes away
+        void gauge_fn(std::string_view name, std::function<i64()> read, const void *owner = {});
+        // Only if 'owner' is who registered it last. No scrape calls it once this returns
+        void remove_fn(std::string_view name, const void *owner);
+
+        void describe(std::string_view name, std::string_view help);
+
+        std::string prometheus() const;
+
+    private:
+        enum class Type
+        {
+            counter,
+            gauge,
+            histogram
+        };
+
+        struct Family
+        {
+            Type                                               type;
+            std::string                                        help;
+            std::map<std::string, std::unique_ptr<Counter>>   counters;
+            std::map<std::string, std::unique_ptr<Gauge>>     gauges;
+            std::map<std::string, std::unique_ptr<Histogram>> histograms;
+            std::function<i64()>                               read;
+            const void *                                       read_owner = nullptr;
+        };
+
+        mutable std::mutex                           mutex;
+        std::map<std::string, Family, std::less<>> families;
+
+        Family &family(std::string_view name, Type type);
+    };
+
+    Registry &registry();
+
+    // Serves registry().prometheus() over HTTP on 127.0.0.1:'port' from a background thread
+    bool serve(u16 port);
+}    // namespace metrics
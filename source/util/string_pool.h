@@ -0,0 +1,139 @@
+#pragma once
+
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#include "util/types.h"
+
+// Interns strings into large blocks and hands out 32-bit ids, so repeated names
+// (usernames, channel names like "general") are stored once.
+// Ids are refcounted: each intern() is paired with a release() once its holder is done with it.
+// A string nobody holds gives its id back, and once dead strings make up most of the blocks the
+// live ones are packed into new blocks. Ids stay the same across that
+class StringPool
+{
+public:
+    using id                = u32;
+    static constexpr id none = 0;    // Reserved for the empty string
+
+    StringPool()
+    {
+        strings.emplace_back();
+        refs.push_back(0);
+    }
+
+    StringPool(const StringPool &) = delete;
+    StringPool &operator=(const StringPool &) = delete;
+
+    id intern(std::string_view str)
+    {
+        if (str.empty()) return none;
+
+        auto it = lookup.find(str);
+        if (it != lookup.end())
+        {
+            refs[it->second]++;
+            return it->second;
+        }
+
+        std::string_view stored = store(str);
+
+        id index;
+        if (!free_ids.empty())
+        {
+            index = free_ids.back();
+            free_ids.pop_back();
+            strings[index] = stored;
+            refs[index]    = 1;
+        }
+        else
+        {
+            index = (id) strings.size();
+            strings.push_back(stored);
+            refs.push_back(1);
+        }
+        lookup.emplace(stored, index);
+        return index;
+    }
+
+    void release(id index)
+    {
+        if (index == none || index >= strings.size() || refs[index] == 0) return;
+        if (--refs[index] > 0) return;
+
+        lookup.erase(strings[index]);
+        dead += strings[index].size();
+        strings[index] = {};
+        free_ids.push_back(index);
+
+        if (dead >= block_size && dead * 2 >= allocated) compact();
+    }
+
+    std::string_view get(id index) const noexcept
+    {
+        return index < strings.size() ? strings[index] : std::string_view();
+    }
+
+    size_t size() const noexcept { return strings.size() - 1 - free_ids.size(); }
+    size_t compactions() const noexcept { return compactions_; }
+    size_t memory_usage() const noexcept
+    {
+        // Rough: node-based map overhead is estimated at 4 pointers per entry
+        return allocated + strings.capacity() * sizeof(std::string_view) +
+          refs.capacity() * sizeof(u32) + free_ids.capacity() * sizeof(id) +
+          lookup.size() * (sizeof(std::string_view) + sizeof(id) + 4 * sizeof(void *)) +
+          lookup.bucket_count() * sizeof(void *);
+    }
+
+private:
+    static constexpr size_t block_size = 64 * 1024;
+
+    std::vector<std::unique_ptr<char[]>>     blocks;
+    size_t                                   block_used   = 0;
+    size_t                                   allocated    = 0;
+    size_t                                   dead         = 0;    // Bytes of released strings
+    size_t                                   compactions_ = 0;
+    std::vector<std::string_view>            strings;
+    std::vector<u32>                         refs;
+    std::vector<id>                          free_ids;
+    std::unordered_map<std::string_view, id> lookup;
+
+    std::string_view store(std::string_view str)
+    {
+        if (blocks.empty() || block_used + str.size() > block_size)
+        {
+            size_t size = std::max(block_size, str.size());
+            blocks.push_back(std::make_unique<char[]>(size));
+            block_used = 0;
+            allocated += size;
+        }
+
+        char *dst = blocks.back().get() + block_used;
+        std::memcpy(dst, str.data(), str.size());
+        block_used += str.size();
+        return { dst, str.size() };
+    }
+
+    void compact()
+    {
+        // The old blocks hold what's being copied, so they go once it's all moved
+        auto old = std::move(blocks);
+        blocks.clear();
+        block_used = 0;
+        allocated  = 0;
+        dead       = 0;
+        compactions_++;
+
+        lookup.clear();
+        for (id index = 1; index < strings.size(); index++)
+        {
+            if (refs[index] == 0) continue;
+            strings[index] = store(strings[index]);
+            lookup.emplace(strings[index], index);
+        }
+    }
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+// A coroutine that runs when awaited, and resumes its awaiter once it's done. Its result, or
+// what it threw, comes out of the co_await. Lazy, so nothing runs until someone awaits it or
+// EventLoop::spawn() starts it.
+//
+// A coroutine's locals outlive the event it was started for, so keep arena-backed containers
+// and event DOMs out of them across a co_await: their Arena::Scope is long gone by the time it
+// resumes
+template <typename T = void>
+class Task;
+
+namespace detail
+{
+    struct TaskPromiseBase
+    {
+        std::coroutine_handle<> continuation = std::noop_coroutine();
+        std::exception_ptr      exception;
+
+        // Hands straight over to the awaiter, rather than returning up through the resumer
+        struct Final
+        {
+            bool await_ready() const noexcept { return false; }
+            template <typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> self) noexcept
+            {
+                return self.promise().continuation;
+            }
+            void await_resume() const noexcept { }
+        };
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        Final               final_suspend() const noexcept { return {}; }
+        void                unhandled_exception() noexcept { exception = std::current_exception(); }
+    };
+
+    template <typename T>
+    struct TaskPromise : TaskPromiseBase
+    {
+        std::optional<T> value;
+
+        Task<T> get_return_object() noexcept;
+        template <typename U>
+        void return_value(U &&result)
+        {
+            value.emplace(std::forward<U>(result));
+        }
+        T result()
+        {
+            if (exception) std::rethrow_exception(exception);
+            return std::move(*value);
+        }
+    };
+
+    template <>
+    struct TaskPromise<void> : TaskPromiseBase
+    {
+        Task<void> get_return_object() noexcept;
+        void       return_void() const noexcept { }
+        void       result()
+        {
+            if (exception) std::rethrow_exception(exception);
+        }
+    };
+}    // namespace detail
+
+template <typename T>
+class Task
+{
+public:
+    using promise_type = detail::TaskPromise<T>;
+    using handle_type  = std::coroutine_handle<promise_type>;
+
+    Task() = default;
+    explicit Task(handle_type handle) noexcept : handle(handle) { }
+    ~Task()
+    {
+        if (handle) handle.destroy();
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) { }
+    Task &operator=(Task &&other) noexcept
+    {
+        if (this == &other) return *this;
+        if (handle) handle.destroy();
+        handle = std::exchange(other.handle, nullptr);
+        return *this;
+    }
+
+    bool valid() const noexcept { return (bool) handle; }
+
+    auto operator co_await() && noexcept
+    {
+        struct Awaiter
+        {
+            handle_type handle;
+
+            bool                    await_ready() const noexcept { return !handle; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+            {
+                handle.promise().continuation = awaiter;
+                return handle;
+            }
+            T await_resume() { return handle.promise().result(); }
+        };
+        return Awaiter { handle };
+    }
+
+private:
+    handle_type handle;
+};
+
+template <typename T>
+Task<T> detail::TaskPromise<T>::get_return_object() noexcept
+{
+    return Task<T>(std::coroutine_handle<TaskPromise>::from_promise(*this));
+}
+
+inline Task<void> detail::TaskPromise<void>::get_return_object() noexcept
+{
+    return Task<void>(std::coroutine_handle<TaskPromise>::from_promise(*this));
+}
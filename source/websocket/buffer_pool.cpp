@@ -0,0 +1,67 @@
+#include "buffer_pool.h"
+
+namespace
+{
+    inline u32 class_bits(size_t size) noexcept
+    {
+        u32 bits = 0;
+        while (((size_t) 1 << bits) < size) bits++;
+        return bits;
+    }
+}    // namespace
+
+void BufferPool::Release::operator()(u8 *data) const noexcept
+{
+    if (pool)
+        pool->release(data, capacity);
+    else
+        delete[] data;
+}
+
+BufferPool &BufferPool::global()
+{
+    // Never destroyed, as buffers can still come back from other statics' destructors
+    static BufferPool *pool = new BufferPool();
+    return *pool;
+}
+
+BufferPool::~BufferPool()
+{
+    u8 *data;
+    for (auto &size_class : classes)
+        while (size_class.free.try_dequeue(data)) delete[] data;
+}
+
+BufferPool::Buffer BufferPool::acquire(size_t size)
+{
+    acquired.fetch_add(1, std::memory_order_relaxed);
+
+    u32 bits = std::max(class_bits(size), min_class_bits);
+    if (bits > max_class_bits) return Buffer(new u8[size], Release { nullptr, size });
+
+    auto & size_class = classes[bits - min_class_bits];
+    size_t capacity   = (size_t) 1 << bits;
+
+    u8 *data;
+    if (size_class.free.try_dequeue(data))
+    {
+        size_class.cached.fetch_sub(1, std::memory_order_relaxed);
+        reused.fetch_add(1, std::memory_order_relaxed);
+        return Buffer(data, Release { this, capacity });
+    }
+    return Buffer(new u8[capacity], Release { this, capacity });
+}
+
+void BufferPool::release(u8 *data, size_t capacity) noexcept
+{
+    auto &size_class = classes[class_bits(capacity) - min_class_bits];
+
+    // Approximate, but only ever overshoots the budget by a buffer per racing thread
+    if ((size_class.cached.load(std::memory_order_relaxed) + 1) * capacity > class_budget ||
+        !size_class.free.enqueue(data))
+    {
+        delete[] data;
+        return;
+    }
+    size_class.cached.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+
+#include "util/types.h"
+#include "moodycamel/concurrentqueue.h"
+
+// Recycles payload buffers in power-of-two size classes. Buffers are filled on the listen
+// thread and released wherever the frame ends up (usually the bot thread), so the free lists
+// are lock-free queues. Anything bigger than the largest class is a plain allocation.
+class BufferPool
+{
+public:
+    struct Release
+    {
+        BufferPool *pool;
+        size_t      capacity;
+
+        void operator()(u8 *data) const noexcept;
+    };
+    using Buffer = std::unique_ptr<u8[], Release>;
+
+    struct Stats
+    {
+        u64 acquired;
+        u64 reused;    // Served from a free list instead of the heap
+    };
+
+    // Buffers can outlive any one WebSocket, so there is just the one pool
+    static BufferPool &global();
+
+    ~BufferPool();
+
+    // Returns a buffer of at least 'size' bytes
+    Buffer acquire(size_t size);
+
+    static size_t capacity(const Buffer &buffer) noexcept { return buffer.get_deleter().capacity; }
+
+    Stats stats() const noexcept { return { acquired.load(), reused.load() }; }
+
+private:
+    static constexpr u32    min_class_bits = 8;     // 256 B
+    static constexpr u32    max_class_bits = 20;    // 1 MiB
+    static constexpr size_t class_budget   = 1 << 20;    // Max bytes cached per class
+
+    struct SizeClass
+    {
+        moodycamel::ConcurrentQueue<u8 *> free;
+        std::atomic<size_t>               cached { 0 };
+    };
+    std::array<SizeClass, max_class_bits - min_class_bits + 1> classes;
+
+    std::atomic<u64> acquired { 0 };
+    std::atomic<u64> reused { 0 };
+
+    BufferPool() = default;
+
+    void release(u8 *data, size_t capacity) noexcept;
+};
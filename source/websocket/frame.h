@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "ws.h"
+#include "util/types.h"
+
+// RFC 6455 frame headers and masking, kept apart from any socket so the codec can be
+// benchmarked and reused on its own
+struct FrameHeader
+{
+    static constexpr size_t max_size = 2 + 8 + 4;
+
+    bool              fin;
+    u8                rsv;
+    WebSocket::Opcode opcode;
+    bool              masked;
+    u32               masking_key;    // In wire order
+    u64               payload_length;
+
+    // Size of the whole header, which the first two bytes decide
+    static size_t size(const u8 *first_two) noexcept
+    {
+        size_t size = 2;
+        switch (first_two[1] & 0x7F)
+        {
+        case 126: size += 2; break;
+        case 127: size += 8; break;
+        }
+        if (first_two[1] & 0x80) size += 4;
+        return size;
+    }
+
+    // 'data' must hold all size(data) bytes of the header
+    static FrameHeader decode(const u8 *data) noexcept
+    {
+        FrameHeader header;
+        header.fin            = data[0] & 0x80;
+        header.rsv            = (data[0] >> 4) & 0b111;
+        header.opcode         = (WebSocket::Opcode) (data[0] & 0x0F);
+        header.masked         = data[1] & 0x80;
+        header.masking_key    = 0;
+        header.payload_length = data[1] & 0x7F;
+
+        const u8 *next = data + 2;
+        if (header.payload_length == 126)
+        {
+            header.payload_length = (u64) next[0] << 8 | next[1];
+            next += 2;
+        }
+        else if (header.payload_length == 127)
+        {
+            header.payload_length = 0;
+            for (int i = 0; i < 8; i++)
+                header.payload_length = header.payload_length << 8 | next[i];
+            next += 8;
+        }
+        if (header.masked) std::memcpy(&header.masking_key, next, 4);
+        return header;
+    }
+
+    // Writes the header to 'out', which needs room for max_size bytes. Returns its size
+    size_t encode(u8 *out) const noexcept
+    {
+        u8 *start = out;
+        *out++    = (fin ? 0x80 : 0) | (rsv & 0b111) << 4 | ((u8) opcode & 0x0F);
+
+        u8 mask_bit = masked ? 0x80 : 0;
+        if (payload_length <= 125)
+            *out++ = mask_bit | (u8) payload_length;
+        else if (payload_length <= 0xFFFF)
+        {
+            *out++ = mask_bit | 126;
+            *out++ = (u8) (payload_length >> 8);
+            *out++ = (u8) payload_length;
+        }
+        else
+        {
+            *out++ = mask_bit | 127;
+            for (int shift = 56; shift >= 0; shift -= 8) *out++ = (u8) (payload_length >> shift);
+        }
+
+        if (masked)
+        {
+            std::memcpy(out, &masking_key, 4);
+            out += 4;
+        }
+        return out - start;
+    }
+};
+
+// dst = src ^ key, 8 bytes at a time. 'dst' may be 'src' to unmask in place
+inline void mask_copy(u8 *dst, const u8 *src, size_t len, u32 masking_key) noexcept
+{
+    u64    key = (u64) masking_key << 32 | masking_key;
+    size_t i   = 0;
+    for (; i + 8 <= len; i += 8)
+    {
+        u64 word;
+        std::memcpy(&word, src + i, 8);
+        word ^= key;
+        std::memcpy(dst + i, &word, 8);
+    }
+    for (; i < len; i++) dst[i] = src[i] ^ ((u8 *) &masking_key)[i & 0b11];
+}
+
+// Client messages go out in fragments of at most this many payload bytes
+inline constexpr size_t fragment_size = 4096;
+
+// Room encode_message() needs for 'length' bytes: up to 2 + 2 + 4 bytes of header per fragment
+inline size_t encoded_capacity(size_t length) noexcept
+{
+    return length + std::max(size_t(1), (length + fragment_size - 1) / fragment_size) * 8;
+}
+
+// Encodes a message the way a client has to send it: masked, with a fresh key per fragment.
+// Returns the bytes written to 'out'
+inline size_t encode_message(u8 *out, WebSocket::Opcode opcode, const u8 *data, size_t length)
+{
+    u8 *   start = out;
+    size_t i     = 0;
+    do {
+        FrameHeader header;
+        header.payload_length = std::min(length - i, fragment_size);
+        header.fin            = i + header.payload_length >= length;
+        header.rsv            = 0;
+        header.opcode         = i == 0 ? opcode : WebSocket::Opcode::continuation_frame;
+        header.masked         = true;
+        header.masking_key    = (u32) std::rand() << 16 | (u32) std::rand();
+
+        out += header.encode(out);
+        mask_copy(out, data + i, header.payload_length, header.masking_key);
+
+        out += header.payload_length;
+        i += header.payload_length;
+    } while (i < length);
+    return out - start;
+}
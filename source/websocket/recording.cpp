@@ -0,0 +1,101 @@
+#include "recording.h"
+
+#include <cstring>
+#include <iostream>
+
+#include "util/order.h"
+
+namespace
+{
+    constexpr char magic[8] = { 'G', 'L', 'S', 'R', 'E', 'C', '0', '1' };
+
+    constexpr size_t header_size = 8 + 1 + 8;
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    inline u64 little_endian(u64 value) noexcept
+    {
+        return __builtin_bswap64(value);
+    }
+#else
+    inline u64 little_endian(u64 value) noexcept
+    {
+        return value;
+    }
+#endif
+}    // namespace
+
+Recorder::Recorder(const std::string &path) : file(path, std::ios::out | std::ios::binary)
+{
+    if (!file.is_open())
+    {
+        std::cerr << "Failed to open recording " << path << "\n";
+        return;
+    }
+    file.write(magic, sizeof(magic));
+}
+
+void Recorder::write(const WebSocket::IFrame &frame)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file.is_open()) return;
+
+    if (count++ == 0) start_us = frame.received_us;
+
+    u8  header[header_size];
+    u64 offset = little_endian(frame.received_us - start_us);
+    u64 length = little_endian(frame.payload_length);
+    std::memcpy(header, &offset, 8);
+    header[8] = (u8) frame.opcode;
+    std::memcpy(header + 9, &length, 8);
+
+    file.write((const char *) header, header_size);
+    file.write((const char *) frame.payload_data.get() + frame.app_data_offset,
+               frame.payload_length);
+}
+
+void Recorder::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file.is_open()) file.flush();
+}
+
+Playback::Playback(const std::string &path) : file(path, std::ios::in | std::ios::binary)
+{
+    if (!file.is_open())
+    {
+        std::cerr << "Failed to open recording " << path << "\n";
+        return;
+    }
+
+    char header[sizeof(magic)];
+    if (!file.read(header, sizeof(header)) || std::memcmp(header, magic, sizeof(magic)) != 0)
+    {
+        std::cerr << path << " is not a GLSbot recording\n";
+        file.close();
+    }
+}
+
+bool Playback::next(WebSocket::IFrame &frame, u64 &offset_us)
+{
+    u8 header[header_size];
+    if (!file.is_open() || !file.read((char *) header, header_size)) return false;
+
+    u64 length;
+    std::memcpy(&offset_us, header, 8);
+    std::memcpy(&length, header + 9, 8);
+    offset_us = little_endian(offset_us);
+    length    = little_endian(length);
+
+    frame.opcode          = (WebSocket::Opcode) header[8];
+    frame.rsv             = 0;
+    frame.payload_length  = length;
+    frame.payload_data    = BufferPool::global().acquire(length);
+    frame.app_data_offset = 0;
+
+    if (!file.read((char *) frame.payload_data.get(), length))
+    {
+        std::cerr << "Recording is truncated\n";
+        return false;
+    }
+    return true;
+}
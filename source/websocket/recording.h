@@ -0,0 +1,50 @@
+#pragma once
+
+#include <fstream>
+#include <mutex>
+#include <string>
+
+#include "ws.h"
+#include "util/types.h"
+
+// Inbound frames as the consumer saw them, so a gateway session can be reproduced offline.
+//
+// File layout (little endian): the 8 byte magic "GLSREC01", then for every frame
+//   u64 offset_us    Microseconds since the first recorded frame
+//   u8  opcode
+//   u64 length
+//   u8  payload[length]
+// Payloads are stored after reassembly. There is no transport compression yet, so that is also
+// the decompressed stream.
+class Recorder
+{
+public:
+    explicit Recorder(const std::string &path);
+
+    bool is_open() const noexcept { return file.is_open(); }
+
+    void write(const WebSocket::IFrame &frame);
+    void flush();
+
+    u64 frames() const noexcept { return count; }
+
+private:
+    std::mutex    mutex;
+    std::ofstream file;
+    u64           start_us = 0;
+    u64           count    = 0;
+};
+
+class Playback
+{
+public:
+    explicit Playback(const std::string &path);
+
+    bool is_open() const noexcept { return file.is_open(); }
+
+    // Reads the next frame into 'frame' with a pooled payload. False at the end of the file
+    bool next(WebSocket::IFrame &frame, u64 &offset_us);
+
+private:
+    std::ifstream file;
+};
@@ -64,9 +64,15 @@
 #elif PLATFORM_UNIX 1
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <poll.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
 #include <cerrno>
+#include <cstring>
 
 #define INVALID_SOCKET -1
 #define SOCKET_ERROR   -1
@@ -77,8 +83,6 @@
 
 #endif
 
-std::mutex SecureSocketBase::_mutex = {};
-
 namespace
 {
 #ifdef PLATFORM_WINDOWS
@@ -137,7 +141,11 @@ namespace
     }
 }    // namespace
 
-SecureSocketBase::SecureSocketBase() noexcept : _handle(INVALID_SOCKET)
+SecureSocketBase::SecureSocketBase() noexcept :
+    _handle(INVALID_SOCKET),
+    use_tls(false),
+    tls { NULL, NULL },
+    _mutex(std::make_unique<std::mutex>())
 {
 }
 
@@ -146,11 +154,12 @@ SecureSocketBase::~SecureSocketBase()
     if (is_valid()) { close(); }
 }
 
-SecureSocketBase::SecureSocketBase(SecureSocketBase &&other) noexcept : _handle(other._handle)
+SecureSocketBase::SecureSocketBase(SecureSocketBase &&other) noexcept :
+    _handle(other._handle), use_tls(other.use_tls), tls(other.tls), _mutex(std::move(other._mutex))
 {
-    std::lock_guard<std::mutex> lock(_mutex);
     other._handle = INVALID_SOCKET;
     other.use_tls = false;
+    other._mutex  = std::make_unique<std::mutex>();
 
     other.tls.ctx = NULL;
     other.tls.ssl = NULL;
@@ -161,7 +170,7 @@ SecureSocketBase &SecureSocketBase::operator=(SecureSocketBase &&other) noexcept
     if (&other != this)
     {
         if (is_valid()) close();
-        std::lock_guard<std::mutex> lock(_mutex);
+        std::lock_guard<std::mutex> lock(*other._mutex);
 
         _handle = other._handle;
         use_tls = other.use_tls;
@@ -188,18 +197,18 @@ bool SecureSocketBase::is_valid() const noexcept
 
 void SecureSocketBase::close() noexcept
 {
-    std::lock_guard<std::mutex> lock(_mutex);
-    if (use_tls)
+    std::lock_guard<std::mutex> lock(*_mutex);
+    // A listening socket has a context but no connection
+    if (tls.ssl)
     {
         SSL_shutdown(tls.ssl);
         SSL_free(tls.ssl);
-
-        SSL_CTX_free(tls.ctx);
-
-        tls.ssl = NULL;
-        tls.ctx = NULL;
-        use_tls = false;
     }
+    if (tls.ctx) SSL_CTX_free(tls.ctx);
+
+    tls.ssl = NULL;
+    tls.ctx = NULL;
+    use_tls = false;
 
 #ifdef PLATFORM_WINDOWS
     // See
@@ -213,7 +222,11 @@ void SecureSocketBase::close() noexcept
     _handle = INVALID_SOCKET;
 }
 
-SecureSocketBase::SecureSocketBase(raw_socket_t handle) noexcept : _handle(handle)
+SecureSocketBase::SecureSocketBase(raw_socket_t handle) noexcept :
+    _handle(handle),
+    use_tls(false),
+    tls { NULL, NULL },
+    _mutex(std::make_unique<std::mutex>())
 {
 }
 
@@ -258,27 +271,24 @@ ClientSocket ClientSocket::connect(std::string address, std::string port, bool s
             continue;
         }
 
+        // Nagle's algorithm is TCP only, a datagram socket fails the setsockopt
         i32 flag = 1;
-        if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *) &flag, sizeof(flag)) == -1)
-        {
+        if (!udp && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *) &flag, sizeof(flag)) == -1)
             std::cout << "Could not disable nagle's algorithm! Error: \n"
                       << get_error_string() << "\n";
-            continue;
-        }
-
-        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == -1)
-        {
+        else if (::connect(fd, ai->ai_addr, ai->ai_addrlen) != -1)
+            break;
+        else
             std::cout << "Unable to connect! Error: \n" << get_error_string();
+
 #ifdef PLATFORM_WINDOWS
-            shutdown(fd, SD_BOTH);
-            closesocket(fd);
+        shutdown(fd, SD_BOTH);
+        closesocket(fd);
 #elif PLATFORM_UNIX 1
-            ::close(fd);
+        ::close(fd);
 #endif
-            continue;
-        }
-        break;
     }
+    freeaddrinfo(ai0);
     if (ai == NULL)
     {
         printf("ERROR: Unable to Connect to specified IP and Port\n");
@@ -294,7 +304,7 @@ ClientSocket::ClientSocket() noexcept
 
 i32 ClientSocket::read_bytes(u8 *buf, i32 buf_len) const
 {
-    std::lock_guard<std::mutex> lock(_mutex);
+    std::lock_guard<std::mutex> lock(*_mutex);
     i32                         result;
     if (buf_len <= 0 || buf == nullptr) return 0;
 
@@ -324,7 +334,7 @@ i32 ClientSocket::read_bytes(u8 *buf, i32 buf_len) const
 
 i32 ClientSocket::send_bytes(u8 const *buf, i32 buf_len) const noexcept
 {
-    std::lock_guard<std::mutex> lock(_mutex);
+    std::lock_guard<std::mutex> lock(*_mutex);
     i32                         result;
     if (buf_len <= 0 || buf == nullptr) return 0;
 
@@ -369,15 +379,31 @@ bool ClientSocket::is_localhost() const noexcept
 
 u32 ClientSocket::remaining() const noexcept
 {
-    u32 bytes_available;
+    u32 bytes_available = 0;
 #ifdef PLATFORM_WINDOWS
     ioctlsocket(_handle, FIONREAD, (u_long *) &bytes_available);
 #elif PLATFORM_UNIX 1
     ioctl(_handle, FIONREAD, &bytes_available);
 #endif
+    // Records already decrypted by OpenSSL are no longer in the kernel's buffer
+    if (use_tls) bytes_available += SSL_pending(tls.ssl);
     return bytes_available;
 }
 
+bool ClientSocket::wait_readable(u32 timeout_ms) const noexcept
+{
+    if (use_tls && SSL_pending(tls.ssl) > 0) return true;
+
+    pollfd fd {};
+    fd.fd     = _handle;
+    fd.events = POLLIN;
+#ifdef PLATFORM_WINDOWS
+    return WSAPoll(&fd, 1, timeout_ms) > 0;
+#elif PLATFORM_UNIX 1
+    return ::poll(&fd, 1, timeout_ms) > 0;
+#endif
+}
+
 ClientSocket ClientSocket::_from_raw_handle(raw_socket_t handle, bool secure)
 {
     return ClientSocket(handle, secure);
@@ -416,3 +442,245 @@ ClientSocket ClientSocket::invalid() noexcept
 {
     return ClientSocket(INVALID_SOCKET, false);
 }
+
+//
+// SERVER SOCKET
+//
+
+ServerSocket ServerSocket::listen(std::string address, std::string port, i32 backlog)
+{
+    addrinfo     hints, *ai;
+    int          i;
+    raw_socket_t fd;
+
+#ifdef PLATFORM_WINDOWS
+    if (!g_winsock_initialized)
+    {
+        WSADATA wsData;
+        WORD    ver = MAKEWORD(2, 2);
+
+        i32 ws0k = WSAStartup(ver, &wsData);
+
+        if (ws0k != 0) std::__throw_runtime_error("Cannot init winsock");
+        g_winsock_initialized = true;
+    }
+#endif
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_PASSIVE;
+    if ((i = getaddrinfo(address.c_str(), port.c_str(), &hints, &ai)) != 0)
+    {
+        printf("Unable to look up IP address: %s\n", gai_strerror(i));
+        return ServerSocket();
+    }
+
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd == INVALID_SOCKET)
+    {
+        std::cout << "Unable to create socket! Error: \n" << get_error_string() << "\n";
+        freeaddrinfo(ai);
+        return ServerSocket();
+    }
+
+    i32 flag = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *) &flag, sizeof(flag));
+
+    if (::bind(fd, ai->ai_addr, ai->ai_addrlen) == -1 || ::listen(fd, backlog) == -1)
+    {
+        std::cout << "Unable to listen on " << address << ":" << port
+                  << "! Error: \n"
+                  << get_error_string() << "\n";
+        freeaddrinfo(ai);
+#ifdef PLATFORM_WINDOWS
+        closesocket(fd);
+#elif PLATFORM_UNIX 1
+        ::close(fd);
+#endif
+        return ServerSocket();
+    }
+    freeaddrinfo(ai);
+
+    return ServerSocket(fd);
+}
+
+ServerSocket::ServerSocket() noexcept
+{
+}
+
+bool ServerSocket::use_certificate(const std::string &certificate, const std::string &key)
+{
+    if (tls.ctx) SSL_CTX_free(tls.ctx);
+
+    tls.ctx = SSL_CTX_new(TLS_server_method());
+    if (
+      tls.ctx == NULL ||
+      SSL_CTX_use_certificate_chain_file(tls.ctx, certificate.c_str()) != 1 ||
+      SSL_CTX_use_PrivateKey_file(tls.ctx, key.c_str(), SSL_FILETYPE_PEM) != 1)
+    {
+        ERR_print_errors_fp(stderr);
+        if (tls.ctx) SSL_CTX_free(tls.ctx);
+        tls.ctx = NULL;
+        return false;
+    }
+    return true;
+}
+
+ClientSocket ServerSocket::accept() const
+{
+    raw_socket_t fd = ::accept(_handle, NULL, NULL);
+    if (fd == INVALID_SOCKET) return ClientSocket::invalid();
+
+    i32 flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *) &flag, sizeof(flag));
+    auto client = ClientSocket::_from_raw_handle(fd, false);
+    if (!tls.ctx) return client;
+
+    // Every connection holds a reference, so the context outlives the listener if need be
+    SSL_CTX_up_ref(tls.ctx);
+    client.tls.ctx = tls.ctx;
+    client.tls.ssl = SSL_new(tls.ctx);
+    client.use_tls = true;
+    SSL_set_fd(client.tls.ssl, fd);
+    if (SSL_accept(client.tls.ssl) != 1)
+    {
+        ERR_print_errors_fp(stderr);
+        client.close();
+        return ClientSocket::invalid();
+    }
+    return client;
+}
+
+u16 ServerSocket::port() const noexcept
+{
+    sockaddr_in addr {};
+    socklen_t   len = sizeof(addr);
+    if (getsockname(_handle, (sockaddr *) &addr, &len) != 0) return 0;
+    return ntohs(addr.sin_port);
+}
+
+ServerSocket::ServerSocket(raw_socket_t handle) noexcept : SecureSocketBase(handle)
+{
+}
+
+//
+// DATAGRAM SOCKET
+//
+
+std::string DatagramSocket::Peer::host() const
+{
+    char name[INET6_ADDRSTRLEN] = {};
+    auto address = (const sockaddr *) storage;
+    if (address->sa_family == AF_INET)
+        inet_ntop(AF_INET, &((const sockaddr_in *) address)->sin_addr, name, sizeof(name));
+    else if (address->sa_family == AF_INET6)
+        inet_ntop(AF_INET6, &((const sockaddr_in6 *) address)->sin6_addr, name, sizeof(name));
+    return name;
+}
+
+u16 DatagramSocket::Peer::port() const
+{
+    auto address = (const sockaddr *) storage;
+    if (address->sa_family == AF_INET) return ntohs(((const sockaddr_in *) address)->sin_port);
+    if (address->sa_family == AF_INET6) return ntohs(((const sockaddr_in6 *) address)->sin6_port);
+    return 0;
+}
+
+DatagramSocket DatagramSocket::bind(std::string address, std::string port)
+{
+    addrinfo hints, *ai;
+    int      i;
+
+#ifdef PLATFORM_WINDOWS
+    if (!g_winsock_initialized)
+    {
+        WSADATA wsData;
+        WORD    ver = MAKEWORD(2, 2);
+
+        i32 ws0k = WSAStartup(ver, &wsData);
+
+        if (ws0k != 0) std::__throw_runtime_error("Cannot init winsock");
+        g_winsock_initialized = true;
+    }
+#endif
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags    = AI_PASSIVE;
+    if ((i = getaddrinfo(address.c_str(), port.c_str(), &hints, &ai)) != 0)
+    {
+        printf("Unable to look up IP address: %s\n", gai_strerror(i));
+        return DatagramSocket();
+    }
+
+    raw_socket_t fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd == INVALID_SOCKET || ::bind(fd, ai->ai_addr, ai->ai_addrlen) == -1)
+    {
+        std::cout << "Unable to bind " << address << ":" << port << "! Error: \n"
+                  << get_error_string() << "\n";
+        freeaddrinfo(ai);
+#ifdef PLATFORM_WINDOWS
+        if (fd != INVALID_SOCKET) closesocket(fd);
+#elif PLATFORM_UNIX 1
+        if (fd != INVALID_SOCKET) ::close(fd);
+#endif
+        return DatagramSocket();
+    }
+    freeaddrinfo(ai);
+
+    return DatagramSocket(fd);
+}
+
+DatagramSocket::DatagramSocket() noexcept
+{
+}
+
+DatagramSocket::DatagramSocket(raw_socket_t handle) noexcept : SecureSocketBase(handle)
+{
+}
+
+i32 DatagramSocket::receive_from(u8 *buf, i32 buf_len, Peer &from, u32 timeout_ms) const
+{
+    pollfd fd {};
+    fd.fd     = _handle;
+    fd.events = POLLIN;
+#ifdef PLATFORM_WINDOWS
+    if (WSAPoll(&fd, 1, timeout_ms) <= 0) return 0;
+#elif PLATFORM_UNIX 1
+    if (::poll(&fd, 1, timeout_ms) <= 0) return 0;
+#endif
+
+    socklen_t length = sizeof(from.storage);
+    i32       result = ::recvfrom(
+      _handle,
+      reinterpret_cast<char *>(buf),
+      buf_len,
+      0,
+      (sockaddr *) from.storage,
+      &length);
+    if (result < 0) return SOCK_ERROR;
+    from.length = length;
+    return result;
+}
+
+i32 DatagramSocket::send_to(u8 const *buf, i32 buf_len, const Peer &to) const noexcept
+{
+    i32 result = ::sendto(
+      _handle,
+      reinterpret_cast<char const *>(buf),
+      buf_len,
+      0,
+      (const sockaddr *) to.storage,
+      to.length);
+    return result < 0 ? SOCK_ERROR : result;
+}
+
+u16 DatagramSocket::port() const noexcept
+{
+    sockaddr_in addr {};
+    socklen_t   len = sizeof(addr);
+    if (getsockname(_handle, (sockaddr *) &addr, &len) != 0) return 0;
+    return ntohs(addr.sin_port);
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <string>
 #include <optional>
 #include <mutex>
 #include "util/types.h"
@@ -53,7 +54,9 @@ protected:
     bool    use_tls;
     TLS_CTX tls;
 
-    static std::mutex _mutex;
+    // Serializes reads and writes, as an SSL object can't be used from two threads at once.
+    // Per socket (and on the heap so it survives moves) so one connection can't stall another
+    std::unique_ptr<std::mutex> _mutex;
 };
 
 class ClientSocket final : public SecureSocketBase
@@ -71,6 +74,9 @@ public:
     bool is_localhost() const noexcept;
 
     u32 remaining() const noexcept;
+    // Blocks up to 'timeout_ms' until a read wouldn't block. Also true once the peer has hung
+    // up, so the read that follows sees it
+    bool wait_readable(u32 timeout_ms) const noexcept;
 
 private:
     static ClientSocket _from_raw_handle(raw_socket_t _handle, bool secure);
@@ -78,4 +84,56 @@ private:
     explicit ClientSocket(raw_socket_t, bool) noexcept;
 
     static ClientSocket invalid() noexcept;
+
+    friend class ServerSocket;
+};
+
+class ServerSocket final : public SecureSocketBase
+{
+public:
+    // Binds and listens on 'address':'port'. Invalid on failure
+    static ServerSocket listen(std::string address, std::string port, i32 backlog = 64);
+
+    ServerSocket() noexcept;    // Initializes to 'invalid'
+
+    // Accepted clients do a TLS handshake with this certificate chain and key, both PEM files
+    bool use_certificate(const std::string &certificate, const std::string &key);
+
+    // Blocks until a client connects. Invalid on failure
+    ClientSocket accept() const;
+    // The port actually bound, for when listen() was given "0"
+    u16 port() const noexcept;
+
+private:
+    explicit ServerSocket(raw_socket_t) noexcept;
+};
+
+// Unconnected UDP socket, for serving datagrams to whoever sends them. Clients connect a
+// ClientSocket with 'udp' instead
+class DatagramSocket final : public SecureSocketBase
+{
+public:
+    // Where a datagram came from, to reply to
+    struct Peer
+    {
+        alignas(8) u8 storage[128];    // A sockaddr_storage
+        u32 length = 0;
+
+        std::string host() const;
+        u16         port() const;
+    };
+
+    // Bound to 'address':'port'. Invalid on failure
+    static DatagramSocket bind(std::string address, std::string port);
+
+    DatagramSocket() noexcept;    // Initializes to 'invalid'
+
+    // Waits up to 'timeout_ms' for a datagram. Its length, 0 on timeout or SOCK_ERROR
+    i32 receive_from(u8 *buf, i32 buf_len, Peer &from, u32 timeout_ms) const;
+    i32 send_to(u8 const *buf, i32 buf_len, const Peer &to) const noexcept;
+
+    u16 port() const noexcept;
+
+private:
+    explicit DatagramSocket(raw_socket_t) noexcept;
 };
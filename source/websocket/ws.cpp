@@ -10,8 +10,13 @@
 #include <thread>
 #include <cstring>
 #include <queue>
+#include <array>
+#include <algorithm>
 
+#include "frame.h"
+#include "recording.h"
 #include "util/order.h"
+#include "util/metrics.h"
 
 #include <openssl/sha.h>
 #include <libbase64.h>
@@ -75,20 +80,6 @@ namespace
 
 }    // namespace
 
-void WebSocket::WSFrame::mask()
-{
-    if (this->header.mask)
-    {
-        assert(
-          ("ERROR: MSB in ext_payload_length is set.",
-           this->dynamic.ext_payload_length & (1 << 63)));
-        size_t len = (this->header.payload_length <= 125) ? this->header.payload_length
-                                                          : this->dynamic.ext_payload_length;
-        for (size_t i = 0; i < len; i++)
-            this->dynamic.payload_data[i] ^= ((u8 *) &this->dynamic.masking_key)[i & 0b11];
-    }
-}
-
 void WebSocket::send_frame(Opcode opcode, u8 *data, size_t data_len)
 {
     if (!connected)
@@ -97,235 +88,283 @@ void WebSocket::send_frame(Opcode opcode, u8 *data, size_t data_len)
         return;
     }
 
-    std::queue<WSFrame> enqueue_buffer;
+    // The whole message is encoded into one buffer, so messages sent from different threads
+    // can't interleave their fragments
+    auto   buffer = BufferPool::global().acquire(encoded_capacity(data_len));
+    size_t length = encode_message(buffer.get(), opcode, data, data_len);
 
-    if (data_len == 0)
+    outbound_queue.enqueue({ std::move(buffer), length });
     {
-        WSFrame frame;
-        frame.header.fin              = true;
-        frame.header.mask             = false;
-        frame.header.opcode           = opcode;
-        frame.header.rsv              = 0;
-        frame.dynamic.app_data_offset = 0;    // Since Application Data isn't being used
+        // Taken so the writer can't miss the wakeup between checking the queue and waiting
+        std::lock_guard<std::mutex> lock(writer_mutex);
+    }
+    writer_cv.notify_one();
+}
 
-        frame.header.payload_length = 0;
-        frame.dynamic.payload_data  = nullptr;
+void WebSocket::write()
+{
+    static auto &writes      = metrics::registry().counter("websocket_writes_total");
+    static auto &frames_sent = metrics::registry().counter("websocket_messages_sent_total");
 
-        frame.dynamic.ext_payload_length = 0;
-        frame.dynamic.masking_key        = std::rand() << 16 | std::rand();
-        frame.mask();
+    std::array<OFrame, 32> batch;
+    std::vector<u8>        coalesced;
 
-        enqueue_buffer.push(frame);
-    }
-    else
+    while (true)
     {
-        size_t index = 0;
+        {
+            std::unique_lock<std::mutex> lock(writer_mutex);
+            writer_cv.wait(
+              lock,
+              [&] { return writer_stop || outbound_queue.size_approx() > 0; });
+        }
 
-        WSFrame frame;
-        for (size_t i = 0; i < data_len; i += 4096)
+        size_t count;
+        while ((count = outbound_queue.try_dequeue_bulk(batch.data(), batch.size())) > 0)
         {
-            frame                         = {};
-            frame.header.fin              = false;
-            frame.header.mask             = true;
-            frame.header.opcode           = Opcode::continuation_frame;
-            frame.header.rsv              = 0;
-            frame.dynamic.app_data_offset = 0;    // Since Application Data isn't being used
-
-            size_t len = std::min(data_len - i, size_t(4096));
-            if (len > 0x7D)
+            if (replaying)
+                ;    // Nobody to send to
+            else if (count == 1)
+                socket.send_bytes(batch[0].data.get(), batch[0].length);
+            else
             {
-                frame.header.payload_length      = (len > 0xFFFF) ? 127 : 126;
-                frame.dynamic.ext_payload_length = len;
+                // One TLS write (and so shared records) for everything that piled up
+                coalesced.clear();
+                for (size_t i = 0; i < count; i++)
+                    coalesced.insert(
+                      coalesced.end(),
+                      batch[i].data.get(),
+                      batch[i].data.get() + batch[i].length);
+                socket.send_bytes(coalesced.data(), coalesced.size());
             }
-            else
-                frame.header.payload_length = len;
-
-            // Should I move to using the same pointer with different offsets instead of using
-            // lots of mini-mallocs?
-            // TODO
-            frame.dynamic.payload_data = new u8[len];
-            memcpy(frame.dynamic.payload_data, data + i, len);
-            // std::cout << frame.dynamic.payload_data;
 
-            frame.dynamic.masking_key = std::rand() << 16 | std::rand();
-            frame.mask();
-
-            enqueue_buffer.push(frame);
+            for (size_t i = 0; i < count; i++) batch[i].data.reset();
+            writes.add();
+            frames_sent.add(count);
         }
 
-        enqueue_buffer.front().header.opcode = opcode;
-        enqueue_buffer.back().header.fin     = true;
+        if (writer_stop) break;
     }
+}
 
-    // Send frames
-    WSFrame out;
-    while (!enqueue_buffer.empty())
-    {
-        out = enqueue_buffer.front();
-        enqueue_buffer.pop();
-
-        const size_t len = (out.header.payload_length <= 125) ? out.header.payload_length
-                                                              : out.dynamic.ext_payload_length;
-
-        u64 reversed_epl = out.dynamic.ext_payload_length;
-
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-        std::reverse((u8 *) &reversed_epl, (u8 *) &reversed_epl + 8);
-#elif defined(__BYTE_ORDER_RUNTIME__)
-        if (is_system_little_endian()) std::reverse((u8 *) &reversed_epl, (u8 *) &reversed_epl + 8);
-#endif
-
-        // TODO: Don't allocate every frame, use global buffer
-        u8 *   send_buffer = new u8[14 + len];
-        size_t index       = 2;
-
-        memcpy(send_buffer, (u8 *) &out.header, 2);
-        if (out.dynamic.ext_payload_length > 0)
-        {
-            memcpy(
-              send_buffer + index,
-              (u8 *) &reversed_epl + ((out.header.payload_length == 127) ? 0 : 6),
-              (out.header.payload_length == 127) ? 8 : 2);
-            index += (out.header.payload_length == 127) ? 8 : 2;
-        }
-        if (out.header.mask)
-        {
-            memcpy(send_buffer + index, (u8 *) &out.dynamic.masking_key, 4);
-            index += 4;
-        }
-        memcpy(send_buffer + index, out.dynamic.payload_data, len);
-        index += len;
-
-        socket.send_bytes(send_buffer, index);
-        // std::cout << "send bytes\n";
-        // dump_buffer(index, send_buffer);
+void WebSocket::start_writer()
+{
+    writer_stop = false;
+    writer      = std::thread(&WebSocket::write, this);
+}
 
-        delete[] send_buffer;
-        delete[] out.dynamic.payload_data;
+void WebSocket::stop_writer()
+{
+    if (!writer.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        writer_stop = true;
     }
-
-    // if (data_len != 0) std::cout << "Frame Sent. Opcode: " << std::to_string((u8) opcode) <<
-    // "\n";
+    writer_cv.notify_one();
+    writer.join();    // Flushes whatever is still queued
 }
 
 void WebSocket::listen()
 {
-    i32                  error = 1;
-    std::vector<WSFrame> fragment_queue;
-    while (connected)
+    static auto &frames_received = metrics::registry().counter("websocket_frames_received_total");
+    static auto &bytes_received  = metrics::registry().counter("websocket_bytes_received_total");
+
+    i32 error = 1;
+
+    // A header can straddle two reads, so short reads have to be finished off
+    auto read_exact = [&](u8 *buffer, i32 length)
     {
-        while (socket.remaining() > 0)
+        i32 read = 0;
+        while (read < length)
         {
-            u8      tmp[8];
-            WSFrame cur;
-            if (error = socket.read_bytes((u8 *) &cur.header, 2) < 0) break;
+            i32 result = socket.read_bytes(buffer + read, length - read);
+            if (result <= 0) return result < 0 ? result : SOCK_ERROR;
+            read += result;
+        }
+        return read;
+    };
 
-            cur.dynamic.ext_payload_length = 0;
-            cur.dynamic.masking_key        = 0;
-            switch (cur.header.payload_length)
-            {
-            case 126:
+    // Fragmented message being reassembled
+    BufferPool::Buffer message;
+    u64                message_length = 0;
+    Opcode             message_opcode = Opcode::text_frame;
+    u8                 message_rsv    = 0;
+    while (connected)
+    {
+        // Sleeps in the kernel rather than spinning on remaining(). The timeout is how long
+        // close() can take to be noticed
+        if (socket.remaining() == 0 && !socket.wait_readable(100)) continue;
+
+        // Readable with nothing buffered is the peer hanging up, which the read reports
+        do {
+            u8 raw[FrameHeader::max_size];
+            if ((error = read_exact(raw, 2)) < 0) break;
+            if ((error = read_exact(raw + 2, FrameHeader::size(raw) - 2)) < 0) break;
+
+            auto cur = FrameHeader::decode(raw);
+            u64  len = cur.payload_length;
+
+            // Read straight into the buffer the frame will be handed out in. Fragments are
+            // appended to the message they belong to as they arrive
+            bool fragment = !cur.fin || cur.opcode == Opcode::continuation_frame;
+            BufferPool::Buffer payload;
+            u8 *               payload_data;
+            if (fragment)
             {
-                error                          = socket.read_bytes(tmp, 2);
-                cur.dynamic.ext_payload_length = (u16) tmp[0] << 8 | (u16) tmp[1];
+                if (cur.opcode != Opcode::continuation_frame)
+                {
+                    message_opcode = cur.opcode;
+                    message_rsv    = cur.rsv;
+                    message_length = 0;
+                }
+                if (!message || BufferPool::capacity(message) < message_length + len)
+                {
+                    // Geometric growth, so a message is copied less than once on average
+                    auto grown = BufferPool::global().acquire(
+                      std::max(message_length + len, message_length * 2));
+                    if (message_length > 0)
+                        std::memcpy(grown.get(), message.get(), message_length);
+                    message = std::move(grown);
+                }
+                payload_data = message.get() + message_length;
             }
-            break;
-            case 127:
+            else
             {
-                error                          = socket.read_bytes(tmp, 8);
-                cur.dynamic.ext_payload_length = (u64) tmp[0] << 56 | (u64) tmp[1] << 48 |
-                  (u64) tmp[0] << 40 | (u64) tmp[1] << 32 | (u64) tmp[4] << 24 |
-                  (u64) tmp[5] << 16 | (u64) tmp[6] << 8 | (u64) tmp[7];
-            }
-            break;
+                payload      = BufferPool::global().acquire(len);
+                payload_data = payload.get();
             }
-            if (error < 0) break;
-            if (cur.header.mask)
-                if (error = socket.read_bytes((u8 *) &cur.dynamic.masking_key, 4) < 0) break;
-
-            assert(
-              ("ERROR: MSB in ext_payload_length is set.",
-               cur.dynamic.ext_payload_length & (1 << 63)));
 
-            u64 len = (cur.header.payload_length <= 125) ? cur.header.payload_length
-                                                         : cur.dynamic.ext_payload_length;
-
-            cur.dynamic.payload_data = new u8[len];
-            u64 temp_val             = 0;
+            u64 temp_val = 0;
             do {
                 if ((len - temp_val) <= 0) break;
-                error = socket.read_bytes(cur.dynamic.payload_data + temp_val, len - temp_val);
+                error = socket.read_bytes(payload_data + temp_val, len - temp_val);
                 if (error < 0) break;
                 temp_val += error;
             } while (temp_val < len);
             if (error < 0) break;
             if (temp_val != len) std::__throw_runtime_error("Read bytes != packet len");
 
-            cur.mask();
+            if (cur.masked) mask_copy(payload_data, payload_data, len, cur.masking_key);
+            frames_received.add();
+            bytes_received.add(len);
 
-            if (!cur.header.fin || cur.header.opcode == Opcode::continuation_frame)
-                fragment_queue.push_back(std::move(cur));
-            else
+            IFrame frame;
+            frame.app_data_offset = 0;
+            frame.received_us     = metrics::now_us();
+            if (!fragment)
             {
-                IFrame frame;
-                frame.app_data_offset = 0;
-                frame.opcode          = cur.header.opcode;
-                frame.rsv             = cur.header.rsv;
-
+                frame.opcode         = cur.opcode;
+                frame.rsv            = cur.rsv;
                 frame.payload_length = len;
-                frame.payload_data   = std::make_unique<u8[]>(len);
-                std::memcpy(frame.payload_data.get(), cur.dynamic.payload_data, len);
-
-                delete[] cur.dynamic.payload_data;
-
-                inbound_queue.enqueue(std::move(frame));
+                frame.payload_data   = std::move(payload);
             }
-
-            if (fragment_queue.size() > 1 && fragment_queue.back().header.fin)
+            else
             {
-                IFrame frame;
-
-                frame.app_data_offset = 0;
-                frame.opcode          = fragment_queue.front().header.opcode;
-                frame.rsv             = fragment_queue.front().header.rsv;
-
-                for (auto &frag : fragment_queue)
-                    frame.payload_length += (frag.header.payload_length <= 125)
-                      ? frag.header.payload_length
-                      : frag.dynamic.ext_payload_length;
-                frame.payload_data = std::make_unique<u8[]>(frame.payload_length);
-
-                size_t index = 0;
-                for (auto &frag : fragment_queue)
-                {
-                    len = (frag.header.payload_length <= 125) ? frag.header.payload_length
-                                                              : frag.dynamic.ext_payload_length;
-                    memcpy(frame.payload_data.get() + index, frag.dynamic.payload_data, len);
-                    index += len;
-
-                    delete[] frag.dynamic.payload_data;
-                }
-
-                inbound_queue.enqueue(std::move(frame));
-                fragment_queue.clear();
+                message_length += len;
+                if (!cur.fin) continue;
+
+                frame.opcode         = message_opcode;
+                frame.rsv            = message_rsv;
+                frame.payload_length = message_length;
+                frame.payload_data   = std::move(message);
+                message_length       = 0;
             }
-        }
+            bool closing = frame.opcode == Opcode::connection_close;
+            if (!push_inbound(std::move(frame))) return;
+            // Nothing follows a close frame but the peer hanging up, which isn't an error
+            if (closing) return;
+        } while (socket.remaining() > 0);
+        if (error < 0) break;
     }
-    if (error < 0)
+    // Failing after close() has begun is just the connection going away as asked
+    if (error < 0 && connected)
     {
-        std::string err_str = "ERROR! " + std::to_string(error);
-        std::__throw_runtime_error(err_str.c_str());
+        // Thrown from here it would take the whole process down, so it's a disconnect instead
+        std::cerr << "WebSocket read failed with " << error << ", disconnecting\n";
+        connected.store(false);
+        notify_inbound();
     }
 }
 
+void WebSocket::feed(std::string path, bool realtime)
+{
+    // Roughly what a fast server can have in flight. Keeps a fast replay from reading the
+    // whole file into memory ahead of the consumer
+    constexpr size_t max_queued = 1024;
+
+    Playback playback(path);
+    u64      start = metrics::now_us();
+    IFrame   frame;
+    u64      offset_us;
+    while (connected && playback.next(frame, offset_us))
+    {
+        if (realtime)
+        {
+            u64 now = metrics::now_us();
+            if (start + offset_us > now)
+                std::this_thread::sleep_for(std::chrono::microseconds(start + offset_us - now));
+        }
+        else
+            while (connected && inbound_queue.size_approx() >= max_queued)
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+        frame.received_us = metrics::now_us();
+        if (!push_inbound(std::move(frame))) return;
+    }
+
+    // The end of the recording is a disconnect, but only once everything has been consumed
+    while (connected && inbound_queue.size_approx() > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    connected.store(false);
+    notify_inbound();
+}
+
+void WebSocket::replay(std::string path, bool realtime)
+{
+    replaying = true;
+    overflowed.store(false);
+    connected.store(true);
+    reader = std::thread(&WebSocket::feed, this, std::move(path), realtime);
+    start_writer();
+}
+
 void WebSocket::close()
 {
-    send_frame(Opcode::connection_close, NULL, 0);
+    std::lock_guard<std::mutex> lock(lifecycle_mutex);
+    if (connected) send_frame(Opcode::connection_close, NULL, 0);
+    stop_writer();
+    stop_reader();
+}
+
+void WebSocket::stop_reader()
+{
     connected.store(false);
+    notify_inbound();
+    if (!reader.joinable()) return;
+    if (reader.get_id() == std::this_thread::get_id())
+        reader.detach();
+    else
+        reader.join();
 }
 
 WebSocket::WebSocket(std::string uri, bool udp)
 {
+    connect(std::move(uri), udp);
+}
+
+void WebSocket::connect(std::string uri, bool udp)
+{
+    std::lock_guard<std::mutex> lock(lifecycle_mutex);
+    stop_writer();
+    stop_reader();
+
+    // Whatever is left from a previous connection means nothing on this one
+    {
+        IFrame stale_in;
+        OFrame stale_out;
+        while (inbound_queue.try_dequeue(stale_in)) { }
+        while (outbound_queue.try_dequeue(stale_out)) { }
+    }
+
     if (uri.empty()) std::__throw_invalid_argument("URI null");
 
     bool secure = uri.substr(0, 6) == "wss://";
@@ -333,7 +372,7 @@ WebSocket::WebSocket(std::string uri, bool udp)
 
     std::string port = secure ? "443" : "80";
     size_t      i1 = uri.find(':', secure ? 6 : 5), i2 = uri.find('/', secure ? 6 : 5);
-    if (i1 != std::string::npos && i1 < i2) port = uri.substr(i1, i2 - i1);
+    if (i1 != std::string::npos && i1 < i2) port = uri.substr(i1 + 1, i2 - i1 - 1);
 
     std::string host     = uri.substr(secure ? 6 : 5, std::min(i1, i2) - (secure ? 6 : 5));
     std::string resource = uri.substr(i2);
@@ -363,15 +402,22 @@ WebSocket::WebSocket(std::string uri, bool udp)
 
         socket.send_bytes((u8 *) http_get.data(), http_get.size());
 
-        std::string read(4096, '0');
-        size_t      len = socket.read_bytes((u8 *) read.data(), 4096);
-        if (len < 0)
+        // A byte at a time up to the blank line, as the first frame can come in the same read
+        std::string read;
+        u8          byte;
+        while (read.size() < 4096 &&
+               (read.size() < 4 || read.compare(read.size() - 4, 4, "\r\n\r\n") != 0))
+        {
+            if (socket.read_bytes(&byte, 1) <= 0) break;
+            read.push_back(byte);
+        }
+        size_t len = read.size();
+        if (len == 0)
         {
             std::cerr << "Socket failed at reading\n";
             close();
             return;
         }
-        read.resize(len);
 
         if (read.substr(0, 8) != "HTTP/1.1")
         {
@@ -472,8 +518,10 @@ WebSocket::WebSocket(std::string uri, bool udp)
         }
     }
 
+    overflowed.store(false);
     connected.store(true);
-    std::thread(&WebSocket::listen, this).detach();    // TODO: Single Threaded
+    reader = std::thread(&WebSocket::listen, this);    // TODO: Single Threaded
+    start_writer();
     std::this_thread::sleep_for(std::chrono::milliseconds(100));
     std::cout << "Successfully Connected to WebSocket\n";
 }
@@ -483,22 +531,115 @@ size_t WebSocket::iqueue_sizeapprox()
     return inbound_queue.size_approx();
 }
 
-std::vector<WebSocket::IFrame> WebSocket::dump_iqueue()
+size_t WebSocket::oqueue_sizeapprox()
+{
+    return outbound_queue.size_approx();
+}
+
+size_t WebSocket::dump_iqueue(IFrame *out, size_t max)
+{
+    return inbound_queue.try_dequeue_bulk(out, max);
+}
+
+bool WebSocket::wait_iqueue(u32 timeout_ms, bool wakeable)
+{
+    std::unique_lock<std::mutex> lock(inbound_mutex);
+    inbound_waiting.store(true, std::memory_order_relaxed);
+    // Pairs with the fence in notify_inbound(): either the frame is seen here, or the producer
+    // sees that someone is waiting and wakes them
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    inbound_cv.wait_for(
+      lock,
+      std::chrono::milliseconds(timeout_ms),
+      [&] { return inbound_queue.size_approx() > 0 || !connected || (wakeable && woken); });
+    inbound_waiting.store(false, std::memory_order_relaxed);
+    return inbound_queue.size_approx() > 0;
+}
+
+void WebSocket::wake()
+{
+    woken = true;
+    notify_inbound();
+}
+
+bool WebSocket::push_inbound(IFrame &&frame)
+{
+    static auto &blocked = metrics::registry().counter(
+      "websocket_inbound_overflows_total",
+      "action=\"block\"");
+    static auto &dropped = metrics::registry().counter(
+      "websocket_inbound_overflows_total",
+      "action=\"drop\"");
+    static auto &disconnected = metrics::registry().counter(
+      "websocket_inbound_overflows_total",
+      "action=\"disconnect\"");
+    static auto &blocked_time =
+      metrics::registry().histogram("websocket_inbound_blocked_microseconds");
+    // Once, as it takes the registry's lock and this is per frame
+    [[maybe_unused]] static const bool described = []
+    {
+        metrics::registry().describe(
+          "websocket_inbound_overflows_total",
+          "Inbound frames that found the queue full, by what was done about it");
+        metrics::registry().describe(
+          "websocket_inbound_blocked_microseconds",
+          "Time the reader waited for room in the inbound queue");
+        return true;
+    }();
+
+    auto &limit = inbound_limit;
+    if (limit.frames > 0 && inbound_queue.size_approx() >= limit.frames)
+    {
+        bool data = frame.opcode == Opcode::text_frame || frame.opcode == Opcode::binary_frame;
+        if (limit.policy == Overflow::drop && data && limit.droppable && limit.droppable(frame))
+        {
+            dropped.add();
+            return true;
+        }
+        if (limit.policy == Overflow::disconnect)
+        {
+            disconnected.add();
+            std::cerr << "Inbound queue full, disconnecting\n";
+            overflowed.store(true);
+            connected.store(false);
+            notify_inbound();
+            return false;
+        }
+
+        // Not reading leaves the rest in the socket, until the server stops sending
+        blocked.add();
+        metrics::Timer timed(blocked_time);
+        while (connected && inbound_queue.size_approx() >= limit.frames)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (!connected) return false;
+    }
+
+    inbound_queue.enqueue(std::move(frame));
+    notify_inbound();
+    return true;
+}
+
+void WebSocket::notify_inbound()
 {
-    std::vector<IFrame> dump;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!inbound_waiting.load(std::memory_order_relaxed)) return;
 
-    dump.resize(inbound_queue.size_approx() + 1);
-    size_t ret = inbound_queue.try_dequeue_bulk(dump.begin(), dump.size());
-    dump.resize(ret);
+    std::lock_guard<std::mutex> lock(inbound_mutex);
+    inbound_cv.notify_one();
+}
 
-    return dump;
+WebSocket::~WebSocket()
+{
+    stop_writer();
+    stop_reader();
 }
 
 WebSocket::WebSocket(WebSocket &&other) noexcept
 {
     if (other.socket.is_valid())
     {
-        other.connected.store(false);
+        other.stop_writer();
+        other.stop_reader();
         other.inbound_queue.~ConcurrentQueue();
         other.socket = ClientSocket();
     }
@@ -508,14 +649,21 @@ WebSocket &WebSocket::operator=(WebSocket &&other) noexcept
 {
     if (&other != this)
     {
+        stop_writer();
+        stop_reader();
+        other.stop_writer();
+        other.stop_reader();
         if (socket.is_valid()) socket.close();
 
         socket        = std::move(other.socket);
         inbound_queue = std::move(other.inbound_queue);
-        connected.store(other.connected.load());
+        connected.store(socket.is_valid());
 
-        other.connected.store(false);
-        std::thread(&WebSocket::listen, this).detach();
+        if (connected)
+        {
+            reader = std::thread(&WebSocket::listen, this);
+            start_writer();
+        }
     }
     return *this;
 }
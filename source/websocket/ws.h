@@ -2,8 +2,13 @@
 
 #include <vector>
 #include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 #include "socket.h"
+#include "buffer_pool.h"
 #include "util/types.h"
 #include "moodycamel/concurrentqueue.h"
 
@@ -20,54 +25,83 @@ public:
         pong               = 0xA
     };
 
-private:
-    struct WSFrame    // Web Socket Frame
-    {
-        // Split for ease of reading
-        struct alignas(1)    // Lets hope alignas works how it should
-        {
-            // Reversed order due to byte layout
-            Opcode opcode : 4;
-            u8     rsv : 3;
-            bool   fin : 1;
-
-            u8   payload_length : 7;
-            bool mask : 1;
-        } header;
-
-        struct
-        {
-            u64 ext_payload_length;    // Can be 16 or 64 bits
-            u32 masking_key;           // Can be null
-
-            u8 *payload_data;       // Starts at 'Extension data'
-            u64 app_data_offset;    // Also the length of 'Extension data'
-        } dynamic;
-
-        // Bi-Directional
-        void mask();
-    };
-
     struct IFrame    // Internal Frame
     {
         Opcode opcode : 4;
         u8     rsv : 3;
         bool   _ : 1;    // Align to byte
 
-        u64                   payload_length;
-        std::unique_ptr<u8[]> payload_data;
-        u64                   app_data_offset;
+        u64                payload_length;
+        BufferPool::Buffer payload_data;    // Goes back to the pool when the frame is dropped
+        u64                app_data_offset;
+        u64                received_us;    // metrics::now_us() when the last byte was read
+    };
+
+    // What the reader does with a frame when the inbound queue is full
+    enum class Overflow : u8
+    {
+        block,    // Stops reading until there is room, and TCP slows the server down
+        drop,     // Drops it if 'droppable' says so, otherwise blocks
+        // Hangs up and sets 'overflowed', for the owner to reconnect and have the server replay
+        // what it missed
+        disconnect
+    };
+
+    struct InboundLimit
+    {
+        size_t   frames = 4096;    // 0 for no limit
+        Overflow policy = Overflow::block;
+        // Called from the reader on a text or binary frame, only once the queue is full
+        std::function<bool(const IFrame &frame)> droppable;
+    };
+
+private:
+    struct OFrame    // Outbound, already encoded and masked
+    {
+        BufferPool::Buffer data;
+        size_t             length;
     };
 
     moodycamel::ConcurrentQueue<IFrame> inbound_queue;
+    moodycamel::ConcurrentQueue<OFrame> outbound_queue;
+
+    // Lets the consumer sleep until frames arrive. Only taken when someone is waiting
+    std::mutex              inbound_mutex;
+    std::condition_variable inbound_cv;
+    std::atomic_bool        inbound_waiting { false };
+    std::atomic_bool        woken { false };
 
     ClientSocket socket;
 
+    // Runs listen(), or feed() for a replay
+    std::thread reader;
+    // Held by connect() and close(), as the heartbeat thread can close while the consumer
+    // reconnects, and the threads must only be joined once
+    std::mutex lifecycle_mutex;
+
+    // Only the writer thread touches the socket for sending, so senders never block on it
+    std::thread             writer;
+    std::mutex              writer_mutex;
+    std::condition_variable writer_cv;
+    std::atomic_bool        writer_stop { false };    // Set under writer_mutex, read without it too
+
+    bool replaying = false;    // Frames come from a recording, nothing is on the other end
+
+    InboundLimit inbound_limit;
+
     void listen();
+    void feed(std::string path, bool realtime);
+    bool push_inbound(IFrame &&frame);
+    void notify_inbound();
+    void write();
+    void start_writer();
+    void stop_writer();
+    void stop_reader();
 
 public:
     WebSocket() = default;
     WebSocket(std::string uri, bool udp = false);
+    ~WebSocket();
 
     WebSocket(const WebSocket &) = delete;
     WebSocket &operator=(const WebSocket &) = delete;
@@ -75,11 +109,35 @@ public:
     WebSocket(WebSocket &&) noexcept;
     WebSocket &operator=(WebSocket &&) noexcept;
 
+    // Only while nothing is connected, as the reader uses it
+    void set_inbound_limit(InboundLimit limit) { inbound_limit = std::move(limit); }
+
+    // Connects in place, closing any previous connection first
+    void connect(std::string uri, bool udp = false);
+
+    // Queues the message for the writer thread and returns immediately
     void send_frame(Opcode opcode, u8 *data, size_t data_len);
     void close();
 
-    std::vector<IFrame> dump_iqueue();
-    size_t              iqueue_sizeapprox();
-
-    std::atomic_bool connected;
+    // Feeds a recording (see recording.h) through the inbound queue in place of a server.
+    // 'realtime' keeps the recorded gaps between frames, otherwise frames come as fast as they
+    // are consumed. Sent frames are still encoded, then dropped
+    void replay(std::string path, bool realtime);
+
+    // Moves up to 'max' queued frames into 'out' and returns how many. 'out' is the caller's,
+    // so draining the queue in a loop doesn't allocate
+    size_t dump_iqueue(IFrame *out, size_t max);
+    // Blocks until a frame is queued or the connection drops, for up to 'timeout_ms'. A
+    // 'wakeable' wait ends on wake() too. True if there is something to dump
+    bool   wait_iqueue(u32 timeout_ms, bool wakeable = false);
+    // Ends a wakeable wait_iqueue() early, e.g. for work the consumer has queued elsewhere.
+    // From any thread. take_wake() says whether that's what happened, and resets it
+    void   wake();
+    bool   take_wake() noexcept { return woken.exchange(false); }
+    size_t iqueue_sizeapprox();
+    size_t oqueue_sizeapprox();
+
+    std::atomic_bool connected { false };
+    // The last connection was dropped by Overflow::disconnect. Cleared by connect()
+    std::atomic_bool overflowed { false };
 };
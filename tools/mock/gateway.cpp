@@ -0,0 +1,503 @@
+// Stand-in for Discord's gateway, for integration and load testing without a network.
+//
+// Point the bot at it with "gateway_url": "ws://127.0.0.1:8080" in config.json. Every session
+// gets Hello, READY and a GUILD_CREATE per guild. Then the script (--script) runs, one step a
+// line, # for comments. There is one script for the whole process: when a step ends the
+// session, whichever session comes next carries on from the following step.
+//
+//   wait <ms>
+//   flood <count> [events/s, 0 = unthrottled] [content...]   MESSAGE_CREATEs
+//   replay <recording> [fast]                                 Dispatches from a --record file
+//   heartbeat                                                 Ask for a heartbeat (op 1)
+//   ack_delay <ms>                                            Slow HeartbeatACKs from here on
+//   ack_drop                                                  Stop acknowledging altogether
+//   reconnect                                                 op 7, then hang up
+//   invalid_session [resumable]                               op 9
+//   disconnect [code]                                         Close frame, 4000 by default
+//   drop                                                      Hang up without a close frame
+//
+// A Resume with a session id handed out earlier gets the dispatches after its seq sent again,
+// then RESUMED. Anything else gets InvalidSession.
+// A Voice State Update (op 4) gets VOICE_STATE_UPDATE back and, when joining, a
+// VOICE_SERVER_UPDATE pointing at --voice-endpoint, where glsbot-mock-voice listens.
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "server.h"
+#include "discord/scan.h"
+#include "util/metrics.h"
+#include "websocket/recording.h"
+
+namespace
+{
+    using namespace discord;
+
+    struct Options
+    {
+        std::string port               = "8080";
+        std::string certificate        = "";
+        std::string key                = "";
+        u32         heartbeat_interval = 41250;
+        u32         guilds             = 1;
+        std::string script_path        = "";
+        std::string voice_endpoint     = "127.0.0.1:8082";
+    };
+
+    struct Step
+    {
+        std::string command;
+        std::string args;
+    };
+
+    std::vector<Step> load_script(const std::string &path)
+    {
+        std::vector<Step> steps;
+        std::ifstream     file(path);
+        if (!file.is_open())
+        {
+            std::cerr << "Failed to open script " << path << "\n";
+            std::exit(-1);
+        }
+
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (auto comment = line.find('#'); comment != std::string::npos) line.resize(comment);
+
+            std::istringstream words(line);
+            Step               step;
+            if (!(words >> step.command)) continue;
+            std::getline(words >> std::ws, step.args);
+            while (!step.args.empty() && std::isspace((u8) step.args.back())) step.args.pop_back();
+            steps.push_back(std::move(step));
+        }
+        return steps;
+    }
+
+    // Trimmed down, but shaped like the real thing so parsing costs about the same
+    constexpr char ready[] =
+      "{{\"v\":9,\"user\":{{\"id\":\"1\",\"username\":\"mock\",\"discriminator\":\"0000\","
+      "\"bot\":true}},\"guilds\":[{}],\"session_id\":\"{}\",\"application\":{{\"id\":\"1\","
+      "\"flags\":0}}}}";
+    constexpr char unavailable_guild[] = "{{\"id\":\"{}\",\"unavailable\":true}}";
+    constexpr char guild_create[] =
+      "{{\"id\":\"{0}\",\"name\":\"Mock {0}\",\"owner_id\":\"2\",\"member_count\":2,"
+      "\"channels\":[{{\"id\":\"{1}\",\"name\":\"general\",\"type\":0,\"position\":0}}],"
+      "\"members\":[{{\"user\":{{\"id\":\"1\",\"username\":\"mock\",\"discriminator\":"
+      "\"0000\"}}}},{{\"user\":{{\"id\":\"2\",\"username\":\"owner\",\"discriminator\":"
+      "\"0001\"}}}}]}}";
+    constexpr char message_create[] =
+      "{{\"type\":0,\"tts\":false,\"timestamp\":\"2021-01-01T00:00:00.000000+00:00\","
+      "\"pinned\":false,\"mentions\":[],\"mention_roles\":[],\"mention_everyone\":false,"
+      "\"id\":\"{}\",\"flags\":0,\"embeds\":[],\"edited_timestamp\":null,\"content\":\"{}\","
+      "\"components\":[],\"channel_id\":\"2000\",\"author\":{{\"username\":\"flood\","
+      "\"public_flags\":0,\"id\":\"3\",\"discriminator\":\"0003\",\"avatar\":null}},"
+      "\"attachments\":[],\"guild_id\":\"1000\"}}";
+
+    std::string escape(std::string_view str)
+    {
+        std::string out;
+        for (char c : str)
+        {
+            if (c == '"' || c == '\\') out.push_back('\\');
+            out.push_back(c);
+        }
+        return out;
+    }
+
+    constexpr size_t max_backlog = 20000;    // Dispatches kept for a Resume to replay
+
+    // A session's dispatches as sent, the last one numbered 'seq'. Shared with whichever
+    // connection has the session, so a quick Resume doesn't wait on the old one to wind down
+    struct Backlog
+    {
+        std::mutex              mutex;
+        u64                     seq = 0;
+        std::deque<std::string> frames;
+    };
+
+    // Sessions outlive connections, so that Resume can be tested
+    std::mutex                                                sessions_mutex;
+    std::unordered_map<std::string, std::shared_ptr<Backlog>> sessions;
+    std::atomic_uint64_t                                      next_session { 1 };
+
+    std::atomic_size_t next_step { 0 };
+
+    class Session
+    {
+    public:
+        Session(mock::Connection &ws, const Options &options, const std::vector<Step> &script) :
+            ws(ws), options(options), script(script)
+        { }
+
+        void run()
+        {
+            ws.send_text(fmt::format(
+              "{{\"op\":10,\"d\":{{\"heartbeat_interval\":{}}}}}",
+              options.heartbeat_interval));
+
+            std::thread       scripted;
+            WebSocket::Opcode opcode;
+            std::string       payload;
+            while (true)
+            {
+                auto result = ws.read(opcode, payload, 1000);
+                if (result == mock::Connection::Read::closed) break;
+                if (result == mock::Connection::Read::timeout) continue;
+                if (opcode != WebSocket::Opcode::text_frame) continue;
+
+                auto envelope = scan::envelope(payload);
+                switch (envelope.op)
+                {
+                case 1: heartbeat(); break;
+                case 2:
+                case 6:
+                {
+                    // Once per connection, unless the script has invalidated the session
+                    if (!session_id.empty() && !invalidated.exchange(false)) break;
+                    bool started = envelope.op == 2 ? identify() : resume(envelope.d);
+                    if (started && !scripted.joinable())
+                        scripted = std::thread(&Session::run_script, this);
+                }
+                break;
+                case 4: voice_state(envelope.d); break;
+                default: break;    // Presence updates, member requests and such are ignored
+                }
+            }
+
+            ws.drop();
+            if (scripted.joinable()) scripted.join();
+        }
+
+    private:
+        mock::Connection &       ws;
+        const Options &          options;
+        const std::vector<Step> &script;
+
+        std::string session_id;
+        // Replaced by the session's own on Resume. Dispatches come from the script and from
+        // replies
+        std::shared_ptr<Backlog> backlog = std::make_shared<Backlog>();
+        std::atomic_uint32_t ack_delay_ms { 0 };
+        std::atomic_bool     acking { true };
+        std::atomic_bool     invalidated { false };
+
+        void dispatch(std::string &out, std::string_view event, std::string_view data)
+        {
+            auto                        log = std::atomic_load(&backlog);
+            std::lock_guard<std::mutex> lock(log->mutex);
+            std::string                 frame;
+            mock::Connection::encode(
+              frame,
+              WebSocket::Opcode::text_frame,
+              fmt::format(
+                "{{\"op\":0,\"s\":{},\"t\":\"{}\",\"d\":{}}}",
+                ++log->seq,
+                event,
+                data));
+            out += frame;
+            log->frames.push_back(std::move(frame));
+            if (log->frames.size() > max_backlog) log->frames.pop_front();
+        }
+
+        void heartbeat()
+        {
+            if (!acking) return;
+            // Holds up reading too, much like an overloaded server would
+            if (u32 delay = ack_delay_ms)
+                std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+            ws.send_text("{\"op\":11}");
+        }
+
+        bool identify()
+        {
+            session_id = fmt::format("mock{}", next_session++);
+            {
+                std::lock_guard<std::mutex> lock(sessions_mutex);
+                sessions[session_id] = backlog;
+            }
+            std::cout << "Identified " << session_id << "\n";
+
+            std::string guilds, frames;
+            for (u32 i = 0; i < options.guilds; i++)
+            {
+                if (i > 0) guilds += ',';
+                guilds += fmt::format(unavailable_guild, 1000 + i);
+            }
+            dispatch(frames, "READY", fmt::format(ready, guilds, session_id));
+            for (u32 i = 0; i < options.guilds; i++)
+                dispatch(frames, "GUILD_CREATE", fmt::format(guild_create, 1000 + i, 2000 + i));
+            return ws.send(frames);
+        }
+
+        void voice_state(std::string_view data)
+        {
+            auto guild_id   = scan::string(scan::field(data, "guild_id"));
+            auto channel_id = scan::field(data, "channel_id");
+            bool leaving    = scan::is_null(channel_id);
+
+            std::string frames;
+            dispatch(
+              frames,
+              "VOICE_STATE_UPDATE",
+              fmt::format(
+                "{{\"guild_id\":\"{}\",\"channel_id\":{},\"user_id\":\"1\","
+                "\"session_id\":\"{}voice\",\"deaf\":false,\"mute\":false,"
+                "\"self_deaf\":false,\"self_mute\":false}}",
+                guild_id,
+                channel_id,
+                session_id));
+            if (!leaving)
+                dispatch(
+                  frames,
+                  "VOICE_SERVER_UPDATE",
+                  fmt::format(
+                    "{{\"token\":\"mocktoken\",\"guild_id\":\"{}\",\"endpoint\":\"{}\"}}",
+                    guild_id,
+                    options.voice_endpoint));
+            ws.send(frames);
+        }
+
+        bool resume(std::string_view data)
+        {
+            std::string              id(scan::string(scan::field(data, "session_id")));
+            auto                     from = scan::field(data, "seq");
+            std::shared_ptr<Backlog> saved;
+            {
+                std::lock_guard<std::mutex> lock(sessions_mutex);
+                auto                        it = sessions.find(id);
+                if (it == sessions.end())
+                {
+                    std::cout << "Unknown session " << id << ", invalidating\n";
+                    ws.send_text("{\"op\":9,\"d\":false}");
+                    return false;
+                }
+                saved = it->second;
+            }
+
+            // Whatever the client says it hasn't seen and is still kept, oldest first
+            u64         seen = scan::is_null(from) ? 0 : scan::integer(from);
+            std::string frames;
+            size_t      replayed = 0;
+            {
+                std::lock_guard<std::mutex> lock(saved->mutex);
+                u64    oldest = saved->seq - saved->frames.size() + 1;
+                size_t first  = seen < oldest ? 0 : seen - oldest + 1;
+                for (size_t i = first; i < saved->frames.size(); i++, replayed++)
+                    frames += saved->frames[i];
+            }
+
+            session_id = id;
+            std::atomic_store(&backlog, saved);
+            std::cout << "Resumed " << session_id << ", replaying " << replayed << "\n";
+
+            dispatch(frames, "RESUMED", "{}");
+            ws.send(frames);
+            return true;
+        }
+
+        void flood(u64 count, u64 rate, std::string_view content)
+        {
+            constexpr size_t batch_bytes = 64 * 1024;
+
+            std::string escaped = escape(content.empty() ? "hello" : content);
+            std::string batch;
+            u64         start = metrics::now_us();
+            u64         sent  = 0;
+            while (sent < count && ws.is_open())
+            {
+                u64 due = count;
+                if (rate > 0)
+                    due = std::min(count, (metrics::now_us() - start) * rate / 1000000 + 1);
+                if (due <= sent)
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                    continue;
+                }
+
+                batch.clear();
+                for (; sent < due && batch.size() < batch_bytes; sent++)
+                    dispatch(
+                      batch,
+                      "MESSAGE_CREATE",
+                      fmt::format(message_create, 100000 + sent, escaped));
+                if (!ws.send(batch)) break;
+            }
+
+            double seconds = (metrics::now_us() - start) / 1e6;
+            std::cout << fmt::format(
+              "Flooded {} events in {:.2f} s ({:.0f} events/s)\n",
+              sent,
+              seconds,
+              sent / seconds);
+        }
+
+        void replay(const std::string &path, bool fast)
+        {
+            Playback          playback(path);
+            WebSocket::IFrame frame;
+            u64               offset_us;
+            u64               start = metrics::now_us();
+            u64               sent  = 0;
+            std::string       frames;
+            while (ws.is_open() && playback.next(frame, offset_us))
+            {
+                if (frame.opcode != WebSocket::Opcode::text_frame) continue;
+                std::string_view payload((char *) frame.payload_data.get(), frame.payload_length);
+                auto             envelope = scan::envelope(payload);
+                if (envelope.op != 0 || envelope.t == "READY" || envelope.t == "RESUMED") continue;
+
+                if (!fast && start + offset_us > metrics::now_us())
+                    std::this_thread::sleep_for(
+                      std::chrono::microseconds(start + offset_us - metrics::now_us()));
+
+                // Renumbered so the session's sequence stays continuous
+                frames.clear();
+                dispatch(frames, envelope.t, envelope.d);
+                if (!ws.send(frames)) break;
+                sent++;
+            }
+            std::cout << "Replayed " << sent << " dispatches from " << path << "\n";
+        }
+
+        void run_script()
+        {
+            while (ws.is_open())
+            {
+                size_t index = next_step++;
+                if (index >= script.size()) return;
+                auto &step = script[index];
+
+                std::istringstream args(step.args);
+                std::string        word;
+                u64                count = 0, rate = 0;
+                if (step.command == "wait")
+                {
+                    args >> count;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(count));
+                }
+                else if (step.command == "flood")
+                {
+                    args >> count >> rate;
+                    std::string content;
+                    std::getline(args >> std::ws, content);
+                    flood(count, rate, content);
+                }
+                else if (step.command == "replay" && args >> word)
+                {
+                    std::string mode;
+                    args >> mode;
+                    replay(word, mode == "fast");
+                }
+                else if (step.command == "heartbeat")
+                    ws.send_text("{\"op\":1,\"d\":null}");
+                else if (step.command == "ack_delay")
+                {
+                    args >> count;
+                    ack_delay_ms = count;
+                }
+                else if (step.command == "ack_drop")
+                    acking = false;
+                else if (step.command == "reconnect")
+                {
+                    ws.send_text("{\"op\":7,\"d\":null}");
+                    ws.drop();
+                }
+                else if (step.command == "invalid_session")
+                {
+                    args >> word;
+                    invalidated = true;
+                    ws.send_text(fmt::format("{{\"op\":9,\"d\":{}}}", word == "resumable"));
+                }
+                else if (step.command == "disconnect")
+                {
+                    u64 code = 4000;
+                    args >> code;
+                    ws.close(code);
+                }
+                else if (step.command == "drop")
+                    ws.drop();
+                else
+                    std::cerr << "Unknown script step '" << step.command << "'\n";
+            }
+        }
+    };
+
+    void serve(ClientSocket socket, const Options &options, const std::vector<Step> &script)
+    {
+        mock::Request request;
+        if (!mock::read_request(socket, request)) return;
+
+        mock::Connection ws(std::move(socket));
+        if (!ws.accept(request)) return;
+
+        Session(ws, options, script).run();
+    }
+}    // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--port" && i + 1 < argc)
+            options.port = argv[++i];
+        else if (arg == "--tls" && i + 2 < argc)
+        {
+            options.certificate = argv[++i];
+            options.key         = argv[++i];
+        }
+        else if (arg == "--heartbeat-interval" && i + 1 < argc)
+            options.heartbeat_interval = std::stoul(argv[++i]);
+        else if (arg == "--guilds" && i + 1 < argc)
+            options.guilds = std::stoul(argv[++i]);
+        else if (arg == "--script" && i + 1 < argc)
+            options.script_path = argv[++i];
+        else if (arg == "--voice-endpoint" && i + 1 < argc)
+            options.voice_endpoint = argv[++i];
+        else
+        {
+            std::cout << "Usage: " << argv[0]
+                      << " [--port 8080] [--tls <cert.pem> <key.pem>] [--heartbeat-interval ms]"
+                         " [--guilds n] [--script file] [--voice-endpoint host:port]\n";
+            return -1;
+        }
+    }
+
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN);    // A client hanging up mid-flood is a failed send, not an exit
+#endif
+
+    std::vector<Step> script;
+    if (!options.script_path.empty()) script = load_script(options.script_path);
+
+    auto server = ServerSocket::listen("127.0.0.1", options.port);
+    if (!server.is_valid()) return -1;
+    if (!options.certificate.empty() && !server.use_certificate(options.certificate, options.key))
+        return -1;
+
+    std::cout << fmt::format(
+      "Mock gateway on {}://127.0.0.1:{}\n",
+      options.certificate.empty() ? "ws" : "wss",
+      options.port);
+    while (true)
+    {
+        auto client = server.accept();
+        if (!client.is_valid()) continue;
+        std::thread(serve, std::move(client), std::cref(options), std::cref(script)).detach();
+    }
+}
@@ -0,0 +1,289 @@
+// Stand-in for Discord's HTTP API, for measuring the bot's REST path without a network.
+//
+// Point the bot at it with "api_url": "http://127.0.0.1:8081/api" in config.json. It answers
+//
+//   GET  /api/gateway/bot                with --gateway-url
+//   POST /api/channels/{id}/messages     a message with a fresh id, echoing the content
+//   POST /api/users/@me/channels         the DM channel for recipient_id
+//
+// Each channel's messages, and every other route, get a bucket of --limit requests per --window
+// ms, announced in X-RateLimit-* headers like Discord's. Past that comes a 429 with retry_after.
+// --global caps requests per second across all routes, with a global 429 past it. --latency
+// delays every answer. Connections are kept alive; a summary goes out every second there was
+// traffic, so connection reuse and time spent rate limited can be read off directly.
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <fmt/format.h>
+
+#include "server.h"
+#include "discord/scan.h"
+#include "util/metrics.h"
+
+namespace
+{
+    using namespace discord;
+
+    struct Options
+    {
+        std::string port        = "8081";
+        std::string certificate = "";
+        std::string key         = "";
+        std::string gateway_url = "ws://127.0.0.1:8080";
+        u32         limit       = 5;
+        u32         window_ms   = 5000;
+        u32         global      = 50;
+        u32         latency_ms  = 0;
+    };
+
+    struct Bucket
+    {
+        u32 remaining = 0;
+        u64 reset_us  = 0;
+    };
+
+    std::mutex                              buckets_mutex;
+    std::unordered_map<std::string, Bucket> buckets;    // Route with its major id to bucket
+    Bucket                                  global_bucket;
+
+    std::atomic_uint64_t requests { 0 };
+    std::atomic_uint64_t limited { 0 };
+    std::atomic_uint64_t connections { 0 };
+    std::atomic_uint64_t next_id { 100000 };
+
+    // Takes one request out of the bucket for 'route'. Returns the headers describing it, or
+    // the 429 to send instead
+    bool take(
+      const Options     &options,
+      const std::string &route,
+      std::string       &headers,
+      std::string       &body)
+    {
+        std::lock_guard<std::mutex> lock(buckets_mutex);
+        u64                         now = metrics::now_us();
+
+        if (options.global > 0)
+        {
+            if (now >= global_bucket.reset_us)
+                global_bucket = { options.global, now + 1000000 };
+            if (global_bucket.remaining == 0)
+            {
+                double retry_after = (global_bucket.reset_us - now) / 1e6;
+                headers            = fmt::format(
+                  "Retry-After: {}\r\nX-RateLimit-Global: true\r\nX-RateLimit-Scope: global\r\n",
+                  (u64) retry_after + 1);
+                body = fmt::format(
+                  "{{\"message\": \"You are being rate limited.\", \"retry_after\": {:.3f}, "
+                  "\"global\": true}}",
+                  retry_after);
+                return false;
+            }
+            global_bucket.remaining--;
+        }
+
+        auto &bucket = buckets[route];
+        if (now >= bucket.reset_us) bucket = { options.limit, now + options.window_ms * 1000ull };
+
+        double reset_after = (bucket.reset_us - now) / 1e6;
+        if (bucket.remaining == 0)
+        {
+            headers = fmt::format(
+              "Retry-After: {}\r\nX-RateLimit-Limit: {}\r\nX-RateLimit-Remaining: 0\r\n"
+              "X-RateLimit-Reset-After: {:.3f}\r\nX-RateLimit-Scope: user\r\n",
+              (u64) reset_after + 1,
+              options.limit,
+              reset_after);
+            body = fmt::format(
+              "{{\"message\": \"You are being rate limited.\", \"retry_after\": {:.3f}, "
+              "\"global\": false}}",
+              reset_after);
+            return false;
+        }
+
+        bucket.remaining--;
+        headers = fmt::format(
+          "X-RateLimit-Limit: {}\r\nX-RateLimit-Remaining: {}\r\nX-RateLimit-Reset-After: "
+          "{:.3f}\r\nX-RateLimit-Bucket: {:x}\r\n",
+          options.limit,
+          bucket.remaining,
+          reset_after,
+          std::hash<std::string> {}(route));
+        return true;
+    }
+
+    // Status and body for a request within its limits
+    u16 answer(const Options &options, const mock::Request &request, std::string &body)
+    {
+        std::string_view target = request.target;
+        if (target.substr(0, 4) != "/api")
+        {
+            body = "{\"message\": \"404: Not Found\", \"code\": 0}";
+            return 404;
+        }
+        target.remove_prefix(4);
+
+        if (request.method == "GET" && target == "/gateway/bot")
+        {
+            body = fmt::format(
+              "{{\"url\": \"{}\", \"shards\": 1, \"session_start_limit\": {{\"total\": 1000, "
+              "\"remaining\": 999, \"reset_after\": 14400000, \"max_concurrency\": 1}}}}",
+              options.gateway_url);
+            return 200;
+        }
+
+        if (request.method == "POST" && target == "/users/@me/channels")
+        {
+            auto recipient = scan::string(scan::field(request.body, "recipient_id"));
+            if (recipient.empty())
+            {
+                body = "{\"message\": \"Invalid Form Body\", \"code\": 50035}";
+                return 400;
+            }
+            // One DM channel per recipient, so the id only depends on who it's with
+            body = fmt::format(
+              "{{\"id\": \"{}\", \"type\": 1, \"last_message_id\": null, \"recipients\": "
+              "[{{\"id\": \"{}\", \"username\": \"owner\", \"discriminator\": \"0001\"}}]}}",
+              500000 + scan::integer(recipient) % 100000,
+              recipient);
+            return 200;
+        }
+
+        constexpr std::string_view channels = "/channels/", messages = "/messages";
+        if (
+          request.method == "POST" && target.substr(0, channels.size()) == channels &&
+          target.size() > channels.size() + messages.size() &&
+          target.substr(target.size() - messages.size()) == messages)
+        {
+            auto channel_id = target.substr(
+              channels.size(),
+              target.size() - channels.size() - messages.size());
+            auto content = scan::field(request.body, "content");
+            body         = fmt::format(
+              "{{\"id\": \"{}\", \"type\": 0, \"channel_id\": \"{}\", \"content\": {}, "
+              "\"author\": {{\"id\": \"1\", \"username\": \"mock\", \"discriminator\": "
+              "\"0000\", \"bot\": true}}, \"timestamp\": \"2021-01-01T00:00:00.000000+00:00\", "
+              "\"tts\": false, \"mentions\": [], \"attachments\": [], \"embeds\": []}}",
+              next_id++,
+              channel_id,
+              content.empty() ? "\"\"" : content);
+            return 200;
+        }
+
+        body = "{\"message\": \"404: Not Found\", \"code\": 0}";
+        return 404;
+    }
+
+    void serve(ClientSocket socket, const Options &options)
+    {
+        connections++;
+
+        mock::Request request;
+        while (mock::read_request(socket, request))
+        {
+            requests++;
+            if (options.latency_ms > 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(options.latency_ms));
+
+            std::string headers, body;
+            if (request.header("authorization").substr(0, 4) != "Bot ")
+                mock::send_response(
+                  socket,
+                  401,
+                  "{\"message\": \"401: Unauthorized\", \"code\": 0}");
+            else if (!take(options, request.method + " " + request.target, headers, body))
+            {
+                limited++;
+                mock::send_response(socket, 429, body, headers);
+            }
+            else
+            {
+                u16 status = answer(options, request, body);
+                mock::send_response(socket, status, body, headers);
+            }
+
+            if (request.header("connection") == "close") break;
+        }
+        socket.close();
+    }
+
+    void report()
+    {
+        u64 last_requests = 0, last_limited = 0;
+        while (true)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            u64 now_requests = requests, now_limited = limited;
+            if (now_requests == last_requests) continue;
+
+            std::cout << fmt::format(
+              "{} requests/s, {} rate limited ({} requests over {} connections so far)\n",
+              now_requests - last_requests,
+              now_limited - last_limited,
+              now_requests,
+              connections.load());
+            last_requests = now_requests;
+            last_limited  = now_limited;
+        }
+    }
+}    // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--port" && i + 1 < argc)
+            options.port = argv[++i];
+        else if (arg == "--tls" && i + 2 < argc)
+        {
+            options.certificate = argv[++i];
+            options.key         = argv[++i];
+        }
+        else if (arg == "--gateway-url" && i + 1 < argc)
+            options.gateway_url = argv[++i];
+        else if (arg == "--limit" && i + 1 < argc)
+            options.limit = std::stoul(argv[++i]);
+        else if (arg == "--window" && i + 1 < argc)
+            options.window_ms = std::stoul(argv[++i]);
+        else if (arg == "--global" && i + 1 < argc)
+            options.global = std::stoul(argv[++i]);
+        else if (arg == "--latency" && i + 1 < argc)
+            options.latency_ms = std::stoul(argv[++i]);
+        else
+        {
+            std::cout << "Usage: " << argv[0]
+                      << " [--port 8081] [--tls <cert.pem> <key.pem>] [--gateway-url url]"
+                         " [--limit 5] [--window 5000] [--global 50, 0 = off] [--latency ms]\n";
+            return -1;
+        }
+    }
+
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    auto server = ServerSocket::listen("127.0.0.1", options.port);
+    if (!server.is_valid()) return -1;
+    if (!options.certificate.empty() && !server.use_certificate(options.certificate, options.key))
+        return -1;
+
+    std::cout << fmt::format(
+      "Mock REST API on {}://127.0.0.1:{}/api\n",
+      options.certificate.empty() ? "http" : "https",
+      options.port);
+    std::thread(report).detach();
+    while (true)
+    {
+        auto client = server.accept();
+        if (!client.is_valid()) continue;
+        std::thread(serve, std::move(client), std::cref(options)).detach();
+    }
+}
@@ -0,0 +1,260 @@
+#include "server.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include <fmt/format.h>
+#include <libbase64.h>
+#include <openssl/sha.h>
+
+#include "util/metrics.h"
+
+namespace
+{
+    std::string_view reason(u16 status)
+    {
+        switch (status)
+        {
+        case 101: return "Switching Protocols";
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 404: return "Not Found";
+        case 429: return "Too Many Requests";
+        default: return "Unknown";
+        }
+    }
+
+    inline std::string trim(std::string_view str)
+    {
+        while (!str.empty() && std::isspace((u8) str.front())) str.remove_prefix(1);
+        while (!str.empty() && std::isspace((u8) str.back())) str.remove_suffix(1);
+        return std::string(str);
+    }
+}    // namespace
+
+bool mock::read_request(const ClientSocket &socket, Request &request)
+{
+    // A byte at a time, so nothing past the headers is consumed
+    std::string head;
+    u8          byte;
+    while (head.size() < 4 || head.compare(head.size() - 4, 4, "\r\n\r\n") != 0)
+    {
+        if (head.size() > 16384 || socket.read_bytes(&byte, 1) <= 0) return false;
+        head.push_back(byte);
+    }
+
+    size_t line_end = head.find("\r\n");
+    size_t space1   = head.find(' ');
+    size_t space2   = head.find(' ', space1 + 1);
+    if (space1 == std::string::npos || space2 == std::string::npos || space2 > line_end)
+        return false;
+    request.method = head.substr(0, space1);
+    request.target = head.substr(space1 + 1, space2 - space1 - 1);
+
+    request.headers.clear();
+    for (size_t index = line_end + 2; index < head.size();)
+    {
+        size_t next  = head.find("\r\n", index);
+        size_t colon = head.find(':', index);
+        if (next == index) break;
+        if (colon != std::string::npos && colon < next)
+        {
+            std::string name = head.substr(index, colon - index);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            request.headers[name] =
+              trim(std::string_view(head).substr(colon + 1, next - colon - 1));
+        }
+        index = next + 2;
+    }
+
+    request.body.clear();
+    if (auto length = request.header("content-length"); !length.empty())
+    {
+        request.body.resize(std::strtoull(std::string(length).c_str(), nullptr, 10));
+        size_t read = 0;
+        while (read < request.body.size())
+        {
+            i32 result = socket.read_bytes(
+              (u8 *) request.body.data() + read,
+              request.body.size() - read);
+            if (result <= 0) return false;
+            read += result;
+        }
+    }
+    return true;
+}
+
+void mock::send_response(
+  const ClientSocket &socket,
+  u16                 status,
+  std::string_view    body,
+  std::string_view    headers)
+{
+    std::string response = fmt::format(
+      "HTTP/1.1 {} {}\r\nContent-Type: application/json\r\nContent-Length: {}\r\n{}\r\n{}",
+      status,
+      reason(status),
+      body.size(),
+      headers,
+      body);
+    socket.send_bytes((const u8 *) response.data(), response.size());
+}
+
+bool mock::Connection::accept(const Request &request)
+{
+    auto key = request.header("sec-websocket-key");
+    if (request.method != "GET" || key.empty())
+    {
+        send_response(socket, 400, "{\"message\": \"Expected a WebSocket upgrade\"}");
+        return false;
+    }
+
+    std::string accept_key = std::string(key) + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    u8          digest[SHA_DIGEST_LENGTH];
+    ::SHA1((const u8 *) accept_key.data(), accept_key.size(), digest);
+
+    std::string encoded(4 * ((sizeof(digest) + 2) / 3), '\0');
+    size_t      encoded_length = encoded.size();
+    ::base64_encode((const char *) digest, sizeof(digest), encoded.data(), &encoded_length, 0);
+    encoded.resize(encoded_length);
+
+    std::string response = fmt::format(
+      "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+      "Sec-WebSocket-Accept: {}\r\n\r\n",
+      encoded);
+    return socket.send_bytes((const u8 *) response.data(), response.size()) > 0;
+}
+
+void mock::Connection::encode(std::string &out, WebSocket::Opcode opcode, std::string_view payload)
+{
+    out.push_back((char) (0x80 | (u8) opcode));
+    if (payload.size() <= 125)
+        out.push_back((char) payload.size());
+    else if (payload.size() <= 0xFFFF)
+    {
+        out.push_back((char) 126);
+        out.push_back((char) (payload.size() >> 8));
+        out.push_back((char) payload.size());
+    }
+    else
+    {
+        out.push_back((char) 127);
+        for (int shift = 56; shift >= 0; shift -= 8)
+            out.push_back((char) (payload.size() >> shift));
+    }
+    out.append(payload);
+}
+
+bool mock::Connection::send(std::string_view frames)
+{
+    if (!is_open()) return false;
+    return socket.send_bytes((const u8 *) frames.data(), frames.size()) > 0;
+}
+
+bool mock::Connection::send_text(std::string_view payload)
+{
+    std::string frame;
+    encode(frame, WebSocket::Opcode::text_frame, payload);
+    return send(frame);
+}
+
+bool mock::Connection::read_exact(u8 *buffer, size_t length)
+{
+    size_t read = 0;
+    while (read < length)
+    {
+        i32 result = socket.read_bytes(buffer + read, length - read);
+        if (result <= 0) return false;
+        read += result;
+    }
+    return true;
+}
+
+mock::Connection::Read
+  mock::Connection::read(WebSocket::Opcode &opcode, std::string &payload, u32 timeout_ms)
+{
+    u64  deadline = metrics::now_us() + (u64) timeout_ms * 1000;
+    auto closed   = [&]
+    {
+        drop();
+        socket.close();
+        return Read::closed;
+    };
+
+    payload.clear();
+    while (true)
+    {
+        // Only read once something is there, as a blocked read would hold up senders
+        while (is_open() && socket.remaining() == 0)
+        {
+            if (metrics::now_us() >= deadline) return Read::timeout;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        u8 header[2];
+        if (!is_open() || !read_exact(header, 2)) return closed();
+
+        bool   fin    = header[0] & 0x80;
+        auto   frame  = (WebSocket::Opcode) (header[0] & 0x0F);
+        u64    length = header[1] & 0x7F;
+        u8     extended[8];
+        u8     mask[4] = {};
+        if (length == 126)
+        {
+            if (!read_exact(extended, 2)) return closed();
+            length = (u64) extended[0] << 8 | extended[1];
+        }
+        else if (length == 127)
+        {
+            if (!read_exact(extended, 8)) return closed();
+            length = 0;
+            for (int i = 0; i < 8; i++) length = length << 8 | extended[i];
+        }
+        if ((header[1] & 0x80) && !read_exact(mask, 4)) return closed();
+
+        // Control frames can come between the fragments of a message
+        bool        control = (u8) frame & 0x08;
+        std::string control_payload;
+        std::string &target = control ? control_payload : payload;
+        size_t       start  = target.size();
+        target.resize(start + length);
+        if (!read_exact((u8 *) target.data() + start, length)) return closed();
+        for (size_t i = 0; i < length; i++) target[start + i] ^= mask[i & 0b11];
+
+        if (frame == WebSocket::Opcode::ping)
+        {
+            std::string pong;
+            encode(pong, WebSocket::Opcode::pong, control_payload);
+            send(pong);
+            continue;
+        }
+        if (frame == WebSocket::Opcode::connection_close)
+        {
+            std::string close;
+            encode(close, WebSocket::Opcode::connection_close, control_payload.substr(0, 2));
+            send(close);
+            opcode  = frame;
+            payload = std::move(control_payload);
+            return closed();
+        }
+        if (control) continue;
+
+        if (frame != WebSocket::Opcode::continuation_frame) opcode = frame;
+        if (fin) return Read::message;
+    }
+}
+
+void mock::Connection::close(u16 code)
+{
+    std::string frame;
+    u8          payload[2] = { (u8) (code >> 8), (u8) code };
+    encode(frame, WebSocket::Opcode::connection_close, std::string_view((char *) payload, 2));
+    send(frame);
+    drop();
+}
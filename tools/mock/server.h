@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "util/types.h"
+#include "websocket/socket.h"
+#include "websocket/ws.h"
+
+// What the mock Discord servers have in common: reading HTTP requests and the server end of
+// a WebSocket. Only as much of either as GLSbot itself speaks.
+namespace mock
+{
+    struct Request
+    {
+        std::string method;
+        std::string target;
+        std::string body;
+
+        std::unordered_map<std::string, std::string> headers;    // Names are lowercase
+
+        std::string_view header(const std::string &name) const
+        {
+            auto it = headers.find(name);
+            return it == headers.end() ? std::string_view {} : it->second;
+        }
+    };
+
+    // Blocks for the next request on 'socket'. False once the client has gone
+    bool read_request(const ClientSocket &socket, Request &request);
+
+    // 'headers' are extra lines, each ending in \r\n
+    void send_response(
+      const ClientSocket &socket,
+      u16                 status,
+      std::string_view    body,
+      std::string_view    headers = {});
+
+    // Server end of a WebSocket. Reading and sending can happen from different threads
+    class Connection
+    {
+    public:
+        enum class Read
+        {
+            message,
+            timeout,
+            closed
+        };
+
+        explicit Connection(ClientSocket socket) : socket(std::move(socket)) { }
+
+        // Answers the upgrade request. False if it wasn't one
+        bool accept(const Request &request);
+
+        // Appends an unmasked frame to 'out', so many can go out in one write
+        static void encode(std::string &out, WebSocket::Opcode opcode, std::string_view payload);
+
+        bool send(std::string_view frames);
+        bool send_text(std::string_view payload);
+
+        // Waits up to 'timeout_ms' for the next message, unmasked and reassembled. Pings are
+        // answered here
+        Read read(WebSocket::Opcode &opcode, std::string &payload, u32 timeout_ms);
+
+        // Close frame with 'code', then the connection itself
+        void close(u16 code);
+        // Just the connection, like a crashed server. Safe from any thread; the socket is
+        // closed by whichever thread is in read()
+        void drop() { open.store(false); }
+
+        bool is_open() const noexcept { return open; }
+
+    private:
+        ClientSocket     socket;
+        std::atomic_bool open { true };
+
+        bool read_exact(u8 *buffer, size_t length);
+    };
+}    // namespace mock
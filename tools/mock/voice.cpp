@@ -0,0 +1,398 @@
+// Stand-in for a Discord voice server, for testing the bot's voice path without a network: the
+// voice gateway over TLS and the UDP side on the same port number.
+//
+// The mock gateway hands out 127.0.0.1:8082 as the voice endpoint (see its --voice-endpoint),
+// and voice always connects with wss://, so --tls is required. Every session gets a fresh SSRC
+// and key. Over UDP it answers IP discovery, then opens each RTP packet with its SSRC's key and
+// checks the stream: sequence numbers one apart, timestamps a 20 ms frame apart. Every second
+// with traffic it reports, per SSRC, packets, losses, packets that failed to authenticate, the
+// spread of arrival gaps and the RFC 3550 interarrival jitter.
+//
+// With --echo every packet goes back to its sender as another speaker (SSRC + 1000), for
+// testing the receive side; --loss and --reorder drop or swap that percentage of them.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "server.h"
+#include "discord/rtp.h"
+#include "discord/scan.h"
+#include "util/metrics.h"
+
+namespace
+{
+    using namespace discord;
+
+    struct Options
+    {
+        std::string port               = "8082";
+        std::string certificate        = "";
+        std::string key                = "";
+        u32         heartbeat_interval = 13750;
+        bool        echo               = false;
+        u32         loss_percent       = 0;
+        u32         reorder_percent    = 0;
+    };
+
+    constexpr u32 echo_ssrc_offset = 1000;
+
+    // What one SSRC has sent, since the last report unless it says otherwise
+    struct Stream
+    {
+        std::unique_ptr<rtp::Cipher> cipher = std::make_unique<rtp::Cipher>();
+
+        // Across reports
+        bool   started = false;
+        u16    last_sequence;
+        u32    last_timestamp;
+        u64    last_arrival_us;
+        double jitter_us = 0;
+
+        u64              packets = 0, silence = 0, lost = 0, reordered = 0, bad = 0, skips = 0;
+        std::vector<u64> gaps_us;
+
+        // Echoing it back
+        u16             echo_sequence = 0;
+        u32             echo_nonce    = 0;
+        std::vector<u8> held;    // Goes out after the next one
+    };
+
+    std::mutex                      streams_mutex;
+    std::unordered_map<u32, Stream> streams;
+    std::atomic_uint32_t            next_ssrc { 1 };
+    std::atomic_uint64_t            unknown { 0 };    // Packets for an SSRC nobody was given
+
+    // The payload's length once opened in place, -1 if it doesn't authenticate
+    i64 receive(Stream &stream, u8 *packet, size_t length)
+    {
+        u64  arrival = metrics::now_us();
+        auto header  = rtp::Header::decode(packet);
+        i64  payload = stream.cipher->open(packet, length, rtp::Header::size_of(packet));
+        if (payload < 0)
+        {
+            stream.bad++;
+            return -1;
+        }
+
+        if (stream.started)
+        {
+            i16 step = (i16) (header.sequence - stream.last_sequence);
+            if (step <= 0)
+            {
+                stream.reordered++;
+                return payload;
+            }
+            stream.lost += step - 1;
+            stream.gaps_us.push_back(arrival - stream.last_arrival_us);
+
+            // Ticks without audio move the clock on without a packet, which is fine as long
+            // as it's in whole frames
+            u32 elapsed = header.timestamp - stream.last_timestamp;
+            if (elapsed != rtp::frame_samples * step)
+                stream.skips += elapsed % rtp::frame_samples == 0 ? 1 : 0;
+
+            // RFC 3550 6.4.1: the difference in transit time, smoothed over 16 packets
+            double sent_us = elapsed * 1e6 / rtp::sample_rate;
+            double d       = (double) (arrival - stream.last_arrival_us) - sent_us;
+            stream.jitter_us += (std::fabs(d) - stream.jitter_us) / 16;
+        }
+        stream.started         = true;
+        stream.last_sequence   = header.sequence;
+        stream.last_timestamp  = header.timestamp;
+        stream.last_arrival_us = arrival;
+
+        stream.packets++;
+        auto *opus = packet + rtp::Header::size_of(packet);
+        if (payload == sizeof(rtp::silence_frame) &&
+            std::memcmp(opus, rtp::silence_frame, payload) == 0)
+            stream.silence++;
+        return payload;
+    }
+
+    void echo(
+      const DatagramSocket &      udp,
+      const DatagramSocket::Peer &peer,
+      const Options &             options,
+      Stream &                    stream,
+      const u8 *                  packet,
+      size_t                      payload)
+    {
+        thread_local std::mt19937          random(std::random_device {}());
+        std::uniform_int_distribution<u32> percent(0, 99);
+
+        // A lost packet still takes up its sequence number
+        auto header   = rtp::Header::decode(packet);
+        u16  sequence = stream.echo_sequence++;
+        if (percent(random) < options.loss_percent) return;
+
+        u8 out[rtp::Header::size + rtp::max_frame_size + rtp::Cipher::overhead];
+        rtp::Header { sequence, header.timestamp, header.ssrc + echo_ssrc_offset }.encode(out);
+        size_t size = stream.cipher->seal(
+          out,
+          rtp::Header::size,
+          packet + rtp::Header::size_of(packet),
+          payload,
+          stream.echo_nonce++);
+
+        if (!stream.held.empty())
+        {
+            udp.send_to(out, size, peer);
+            udp.send_to(stream.held.data(), stream.held.size(), peer);
+            stream.held.clear();
+        }
+        else if (percent(random) < options.reorder_percent)
+            stream.held.assign(out, out + size);
+        else
+            udp.send_to(out, size, peer);
+    }
+
+    void listen_udp(const DatagramSocket &udp, const Options &options)
+    {
+        std::vector<u8>      packet(2048);
+        DatagramSocket::Peer peer;
+        while (true)
+        {
+            i32 length = udp.receive_from(packet.data(), packet.size(), peer, 1000);
+            if (length <= 0) continue;
+
+            u32         ssrc;
+            std::string address;
+            u16         port;
+            if (rtp::discovery::decode(packet.data(), length, ssrc, address, port) ==
+                rtp::discovery::request)
+            {
+                u8 response[rtp::discovery::size];
+                rtp::discovery::encode(
+                  response,
+                  rtp::discovery::response,
+                  ssrc,
+                  peer.host(),
+                  peer.port());
+                udp.send_to(response, sizeof(response), peer);
+                continue;
+            }
+            if ((size_t) length < rtp::Header::size || (packet[0] & 0xC0) != 0x80) continue;
+
+            std::lock_guard<std::mutex> lock(streams_mutex);
+            auto it = streams.find(rtp::Header::decode(packet.data()).ssrc);
+            if (it == streams.end())
+            {
+                unknown++;
+                continue;
+            }
+            i64 payload = receive(it->second, packet.data(), length);
+            if (options.echo && payload >= 0)
+                echo(udp, peer, options, it->second, packet.data(), payload);
+        }
+    }
+
+    void report()
+    {
+        u64 last_unknown = 0;
+        while (true)
+        {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+
+            std::lock_guard<std::mutex> lock(streams_mutex);
+            for (auto &[ssrc, stream] : streams)
+            {
+                if (stream.packets == 0 && stream.bad == 0) continue;
+
+                auto &gaps = stream.gaps_us;
+                std::sort(gaps.begin(), gaps.end());
+                auto at = [&](double q)
+                {
+                    if (gaps.empty()) return 0.0;
+                    return gaps[std::min<size_t>(gaps.size() * q, gaps.size() - 1)] / 1e3;
+                };
+                std::cout << fmt::format(
+                  "ssrc {}: {} packets ({} silence), {} lost, {} reordered, {} bad, {} skips | "
+                  "gap p50 {:.2f} p99 {:.2f} max {:.2f} ms | jitter {:.3f} ms\n",
+                  ssrc,
+                  stream.packets,
+                  stream.silence,
+                  stream.lost,
+                  stream.reordered,
+                  stream.bad,
+                  stream.skips,
+                  at(0.5),
+                  at(0.99),
+                  gaps.empty() ? 0 : gaps.back() / 1e3,
+                  stream.jitter_us / 1e3);
+
+                stream.packets = stream.silence = stream.lost = stream.reordered = stream.bad =
+                  stream.skips                                                    = 0;
+                gaps.clear();
+            }
+            if (unknown != last_unknown)
+            {
+                std::cout << unknown - last_unknown << " packets for unknown SSRCs\n";
+                last_unknown = unknown;
+            }
+        }
+    }
+
+    void serve(ClientSocket socket, const Options &options, u16 udp_port)
+    {
+        mock::Request request;
+        if (!mock::read_request(socket, request)) return;
+
+        mock::Connection ws(std::move(socket));
+        if (!ws.accept(request)) return;
+
+        ws.send_text(fmt::format(
+          "{{\"op\":8,\"d\":{{\"v\":4,\"heartbeat_interval\":{}.0}}}}",
+          options.heartbeat_interval));
+
+        u32               ssrc = 0;
+        WebSocket::Opcode opcode;
+        std::string       payload;
+        while (true)
+        {
+            auto result = ws.read(opcode, payload, 1000);
+            if (result == mock::Connection::Read::closed) break;
+            if (result == mock::Connection::Read::timeout) continue;
+            if (opcode != WebSocket::Opcode::text_frame) continue;
+
+            auto envelope = scan::envelope(payload);
+            switch (envelope.op)
+            {
+            case 0:    // Identify
+                ssrc = next_ssrc++;
+                std::cout << fmt::format(
+                  "Identified {} in {}, ssrc {}\n",
+                  scan::string(scan::field(envelope.d, "user_id")),
+                  scan::string(scan::field(envelope.d, "server_id")),
+                  ssrc);
+                ws.send_text(fmt::format(
+                  "{{\"op\":2,\"d\":{{\"ssrc\":{},\"ip\":\"127.0.0.1\",\"port\":{},\"modes\":"
+                  "[\"{}\",\"aead_xchacha20_poly1305_rtpsize\"]}}}}",
+                  ssrc,
+                  udp_port,
+                  rtp::Cipher::mode));
+                break;
+            case 1:    // Select Protocol
+            {
+                auto data = scan::field(envelope.d, "data");
+                auto mode = scan::string(scan::field(data, "mode"));
+                if (mode != rtp::Cipher::mode)
+                {
+                    ws.close(4016);    // Unknown encryption mode
+                    break;
+                }
+                std::cout << fmt::format(
+                  "ssrc {} is at {}:{}\n",
+                  ssrc,
+                  scan::string(scan::field(data, "address")),
+                  scan::integer(scan::field(data, "port")));
+
+                std::random_device random;
+                std::array<u8, 32> key;
+                std::string        key_list;
+                for (auto &byte : key)
+                {
+                    byte = random();
+                    if (!key_list.empty()) key_list += ',';
+                    key_list += std::to_string(byte);
+                }
+                {
+                    std::lock_guard<std::mutex> lock(streams_mutex);
+                    streams[ssrc].cipher->set_key(key);
+                }
+                ws.send_text(fmt::format(
+                  "{{\"op\":4,\"d\":{{\"mode\":\"{}\",\"secret_key\":[{}]}}}}",
+                  mode,
+                  key_list));
+                if (options.echo)
+                    ws.send_text(fmt::format(
+                      "{{\"op\":5,\"d\":{{\"user_id\":\"echo\",\"ssrc\":{},\"speaking\":1}}}}",
+                      ssrc + echo_ssrc_offset));
+            }
+            break;
+            case 3: ws.send_text(fmt::format("{{\"op\":6,\"d\":{}}}", envelope.d)); break;
+            case 5:
+                std::cout << fmt::format(
+                  "ssrc {} speaking {}\n",
+                  ssrc,
+                  scan::integer(scan::field(envelope.d, "speaking")));
+                break;
+            case 7:    // Resume, which keeps whatever SSRC the client already has
+                std::cout << "Resumed\n";
+                ws.send_text("{\"op\":9,\"d\":null}");
+                break;
+            default: break;
+            }
+        }
+    }
+}    // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--port" && i + 1 < argc)
+            options.port = argv[++i];
+        else if (arg == "--tls" && i + 2 < argc)
+        {
+            options.certificate = argv[++i];
+            options.key         = argv[++i];
+        }
+        else if (arg == "--heartbeat-interval" && i + 1 < argc)
+            options.heartbeat_interval = std::stoul(argv[++i]);
+        else if (arg == "--echo")
+            options.echo = true;
+        else if (arg == "--loss" && i + 1 < argc)
+            options.loss_percent = std::stoul(argv[++i]);
+        else if (arg == "--reorder" && i + 1 < argc)
+            options.reorder_percent = std::stoul(argv[++i]);
+        else
+        {
+            std::cout << "Usage: " << argv[0]
+                      << " --tls <cert.pem> <key.pem> [--port 8082] [--heartbeat-interval ms]"
+                         " [--echo [--loss %] [--reorder %]]\n";
+            return -1;
+        }
+    }
+    if (options.certificate.empty())
+    {
+        std::cerr << "Voice connects with wss://, so --tls is required\n";
+        return -1;
+    }
+
+#ifndef _WIN32
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    auto server = ServerSocket::listen("127.0.0.1", options.port);
+    if (!server.is_valid() || !server.use_certificate(options.certificate, options.key)) return -1;
+    auto udp = DatagramSocket::bind("127.0.0.1", options.port);
+    if (!udp.is_valid()) return -1;
+
+    std::cout << fmt::format(
+      "Mock voice server on wss://127.0.0.1:{0} and udp://127.0.0.1:{0}\n",
+      options.port);
+    std::thread(listen_udp, std::cref(udp), std::cref(options)).detach();
+    std::thread(report).detach();
+    while (true)
+    {
+        auto client = server.accept();
+        if (!client.is_valid()) continue;
+        std::thread(serve, std::move(client), std::cref(options), udp.port()).detach();
+    }
+}